@@ -0,0 +1,425 @@
+// adaptive marching cubes over an octree
+//
+// the grid is covered by leaves of ADAPTIVE_LEAF_CELLS^3 cells, a leaf at level l
+// uses cells 2^l cubes wide. the host picks the leaves from the error pyramid built
+// by kernelAdaptiveError and balances them so leaves that touch differ by at most one
+// level, kernelMCAdaptive then marches every leaf's cells.
+//
+// the surface stays closed across level changes in two steps:
+//   - every lattice point takes its value as the coarsest leaf touching it sees it,
+//     samples on a coarse face that the finer side has but the coarse side doesn't
+//     are interpolated from the coarse corners. edge crossings then agree on both
+//     sides and the fine surface meets the shared face exactly where the coarse one
+//     does along the face's edges.
+//   - inside such a face the fine cells cut a polyline where the coarse cell cuts a
+//     straight segment. the coarse cell fills the sliver between them with triangles
+//     in the face plane (a transition cell), replaying the fine cells it borders.
+
+// cells per leaf axis, matches adaptive.cpp
+#define ADAPTIVE_LEAF_CELLS	8
+
+// cube edges lying on each face, faces are ordered -x +x -y +y -z +z
+constant int FACE_EDGES[6][4] =
+{
+	{ 3, 7, 8, 11 }, { 1, 5, 9, 10 },
+	{ 0, 4, 8, 9 }, { 2, 6, 10, 11 },
+	{ 0, 1, 2, 3 }, { 4, 5, 6, 7 }
+};
+
+// floats as ints that keep their order, for atomic_min/atomic_max
+int orderedFloat(float value)
+{
+	int bits = as_int(value);
+	return bits >= 0 ? bits : bits ^ 0x7fffffff;
+}
+
+int component(int4 v, int axis)
+{
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+float componentf(float4 v, int axis)
+{
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// the field at lattice point p as a leaf of the given level sees it: exact where p is
+// one of its corners, the average of the neighbouring corners where p falls half way
+// between them
+float restrictedSample(int4 p, int level, FIELD_PARAMS)
+{
+	int size = 1 << level;
+	int4 step = select((int4)(0), (int4)(size >> 1), (p & (int4)(size - 1)) != (int4)(0));
+	step.w = 0;
+	if (step.x == 0 && step.y == 0 && step.z == 0)
+		return sampleCorner(convert_float4(p), FIELD_ARGS);
+
+	float sum = 0;
+	int count = 0;
+	for (int i = 0; i < 8; ++i)
+	{
+		if (((i & 1) && step.x == 0) || ((i & 2) && step.y == 0) || ((i & 4) && step.z == 0))
+			continue;
+		int4 offset = (int4)((i & 1) ? 1 : -1, (i & 2) ? 1 : -1, (i & 4) ? 1 : -1, 0) * step;
+		sum += sampleCorner(convert_float4(p + offset), FIELD_ARGS);
+		++count;
+	}
+	return sum / count;
+}
+
+// level of the leaf covering a block of ADAPTIVE_LEAF_CELLS^3 cubes
+int levelAt(int4 block, global const uchar* levels, int4 mapSize)
+{
+	block = clamp(block, (int4)(0), mapSize - (int4)(1));
+	return levels[block.x + mapSize.x * (block.y + mapSize.y * block.z)];
+}
+
+// level of the coarsest leaf whose closure holds lattice point p
+int touchingLevel(int4 p, global const uchar* levels, int4 mapSize)
+{
+	int4 hi = p / ADAPTIVE_LEAF_CELLS;
+	int4 lo = select(hi, hi - (int4)(1), (p % ADAPTIVE_LEAF_CELLS == (int4)(0)) & (p > (int4)(0)));
+
+	int level = 0;
+	for (int z = lo.z; z <= hi.z; ++z)
+		for (int y = lo.y; y <= hi.y; ++y)
+			for (int x = lo.x; x <= hi.x; ++x)
+				level = max(level, levelAt((int4)(x, y, z, 0), levels, mapSize));
+	return level;
+}
+
+// the value every cell sharing lattice point p agrees on
+float leafSample(int4 p, int level, bool boundary, global const uchar* levels, int4 mapSize, FIELD_PARAMS)
+{
+	if (boundary)
+		level = max(level, touchingLevel(p, levels, mapSize));
+	return restrictedSample(p, level, FIELD_ARGS);
+}
+
+// corner values of a cube of a leaf at the given level
+void leafCube(int4 corner, int level, int4 leafMin, int4 leafMax, global const uchar* levels, int4 mapSize,
+			  float* cornerVolumes, FIELD_PARAMS)
+{
+	int size = 1 << level;
+	for (int i = 0; i < 8; ++i)
+	{
+		int4 p = corner + convert_int4(CUBE_CORNERS[i]) * size;
+		p.w = 0;
+		bool boundary = any((p.xyz == leafMin.xyz) | (p.xyz == leafMax.xyz));
+		cornerVolumes[i] = leafSample(p, level, boundary, levels, mapSize, FIELD_ARGS);
+	}
+}
+
+// takes grid space and writes world space, see worldPosition
+void emitTriangle(float4 a, float4 na, float4 b, float4 nb, float4 c, float4 nc, float4 origin, float4 spacing,
+				  int maxFaces, global uint* faceCount, global float4* vertices)
+{
+	// face along the normals like the marching cubes triangles do
+	if (dot(cross(b - a, c - a), na + nb + nc) < 0)
+	{
+		float4 t = b; b = c; c = t;
+		t = nb; nb = nc; nc = t;
+	}
+
+	uint face = atomic_inc(faceCount);
+	if (face >= maxFaces)
+		return;
+
+	vertices[face * 6] = worldPosition(a, origin, spacing);
+	vertices[face * 6 + 1] = worldNormal(na, spacing);
+	vertices[face * 6 + 2] = worldPosition(b, origin, spacing);
+	vertices[face * 6 + 3] = worldNormal(nb, spacing);
+	vertices[face * 6 + 4] = worldPosition(c, origin, spacing);
+	vertices[face * 6 + 5] = worldNormal(nc, spacing);
+}
+
+// bit per pair of the face's edges (first * 4 + second) that the cube's triangles
+// join along the face. interior diagonals are shared by two triangles and cancel.
+uint faceSegments(int flagIndex, int face)
+{
+	uint pairs = 0;
+	for (int triangleIndex = 0; triangleIndex < 5; ++triangleIndex)
+	{
+		if (TRIANGLE_TABLE[ flagIndex ][ 3 * triangleIndex ] < 0)
+			break;
+
+		int local[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			local[i] = -1;
+			for (int k = 0; k < 4; ++k)
+				if (FACE_EDGES[face][k] == TRIANGLE_TABLE[ flagIndex ][ 3 * triangleIndex + i ])
+					local[i] = k;
+		}
+		for (int i = 0; i < 3; ++i)
+		{
+			int a = local[i], b = local[(i + 1) % 3];
+			if (a >= 0 && b >= 0)
+				pairs ^= 1u << (min(a, b) * 4 + max(a, b));
+		}
+	}
+	return pairs;
+}
+
+// position of an edge's midpoint on a face, in quarters of the coarse cell relative
+// to its corner. 0 and 4 are the face's sides.
+int2 facePoint(int4 cubeCorner, float size, int edgeIndex, int4 coarseCorner, float quarter, int face)
+{
+	float4 midpoint = convert_float4(cubeCorner - coarseCorner) +
+		(CUBE_CORNERS[ EDGE_INDICES[ edgeIndex ][0] ] + EDGE_DIRECTIONS[ edgeIndex ] * 0.5f) * size;
+	int u = (face / 2 + 1) % 3, v = (face / 2 + 2) % 3;
+	return convert_int2_rte((float2)(componentf(midpoint, u), componentf(midpoint, v)) / quarter);
+}
+
+int faceSide(int2 point)
+{
+	return point.x == 0 ? 0 : (point.x == 4 ? 1 : (point.y == 0 ? 2 : (point.y == 4 ? 3 : -1)));
+}
+
+// closes the gap between a coarse cell's face and the finer cells across it
+void stitchFace(int face, int4 corner, int level, int flagIndex, float4* edgePosition, float4* edgeNormal,
+				float threshold, float4 origin, float4 spacing, int maxFaces, global uint* faceCount, global float4* vertices,
+				global const uchar* levels, int4 mapSize, FIELD_PARAMS)
+{
+	int size = 1 << level, half = size >> 1;
+	float quarter = half * 0.5f;
+	int axis = face / 2, u = (axis + 1) % 3, v = (axis + 2) % 3;
+
+	// coarse crossings and how the coarse cell pairs them, by side of the face
+	float4 coarsePosition[4], coarseNormal[4];
+	int coarsePartner[4] = { -1, -1, -1, -1 };
+	int sideOfEdge[4];
+	for (int k = 0; k < 4; ++k)
+	{
+		int edgeIndex = FACE_EDGES[face][k];
+		sideOfEdge[k] = faceSide(facePoint(corner, size, edgeIndex, corner, quarter, face));
+		coarsePosition[sideOfEdge[k]] = edgePosition[edgeIndex];
+		coarseNormal[sideOfEdge[k]] = edgeNormal[edgeIndex];
+	}
+	uint pairs = faceSegments(flagIndex, face);
+	for (int a = 0; a < 4; ++a)
+		for (int b = a + 1; b < 4; ++b)
+			if (pairs & (1u << (a * 4 + b)))
+			{
+				coarsePartner[sideOfEdge[a]] = sideOfEdge[b];
+				coarsePartner[sideOfEdge[b]] = sideOfEdge[a];
+			}
+
+	// replay the 2x2 fine cells across the face and chain their segments on it. the
+	// face has a 5x5 grid of quarter positions, crossings sit on 12 of them.
+	float4 finePosition[25], fineNormal[25];
+	int link[25][2];
+	for (int i = 0; i < 25; ++i)
+		link[i][0] = link[i][1] = -1;
+
+	int fineLevel = level - 1;
+	for (int i = 0; i < 4; ++i)
+	{
+		int4 fineCorner = corner;
+		int4 offset = (int4)(0);
+		if (axis == 0) offset.x = (face & 1) ? size : -half;
+		if (axis == 1) offset.y = (face & 1) ? size : -half;
+		if (axis == 2) offset.z = (face & 1) ? size : -half;
+		if (u == 0 || v == 0) offset.x = ((u == 0 ? i & 1 : i >> 1)) * half;
+		if (u == 1 || v == 1) offset.y = ((u == 1 ? i & 1 : i >> 1)) * half;
+		if (u == 2 || v == 2) offset.z = ((u == 2 ? i & 1 : i >> 1)) * half;
+		fineCorner += offset;
+
+		// every corner goes through the level lookup, the fine cell's own leaf might
+		// not be fine everywhere
+		float cornerVolumes[8];
+		for (int c = 0; c < 8; ++c)
+		{
+			int4 p = fineCorner + convert_int4(CUBE_CORNERS[c]) * half;
+			p.w = 0;
+			cornerVolumes[c] = leafSample(p, fineLevel, true, levels, mapSize, FIELD_ARGS);
+		}
+		int fineFlags = cubeFlags(cornerVolumes, threshold);
+
+		uint finePairs = faceSegments(fineFlags, face ^ 1);
+		for (int a = 0; a < 4; ++a)
+			for (int b = a + 1; b < 4; ++b)
+			{
+				if (!(finePairs & (1u << (a * 4 + b))))
+					continue;
+
+				int ends[2] = { FACE_EDGES[face ^ 1][a], FACE_EDGES[face ^ 1][b] };
+				int ids[2];
+				for (int e = 0; e < 2; ++e)
+				{
+					int2 point = facePoint(fineCorner, half, ends[e], corner, quarter, face);
+					ids[e] = point.x * 5 + point.y;
+					if (link[ids[e]][0] < 0)
+					{
+						finePosition[ids[e]] = edgeVertex(convert_float4(fineCorner), half, cornerVolumes, ends[e], threshold);
+						fineNormal[ids[e]] = fieldNormal(finePosition[ids[e]], FIELD_ARGS);
+					}
+				}
+				for (int e = 0; e < 2; ++e)
+				{
+					int slot = link[ids[e]][0] < 0 ? 0 : 1;
+					link[ids[e]][slot] = ids[1 - e];
+				}
+			}
+	}
+
+	// walk each fine chain from one side of the face to another and fan it from the
+	// coarse crossing it starts at. the chain's end joins the coarse crossing there.
+	// the restricted samples can't make closed loops inside the face, every chain
+	// ends on a side.
+	int finePartner[4] = { -1, -1, -1, -1 };
+	for (int id = 0; id < 25; ++id)
+	{
+		int side = faceSide((int2)(id / 5, id % 5));
+		if (side < 0 || link[id][0] < 0 || finePartner[side] >= 0)
+			continue;
+
+		float4 anchor = coarsePosition[side], anchorNormal = coarseNormal[side];
+		int previous = -1, current = id;
+		for (int steps = 0; steps < 12; ++steps)
+		{
+			int next = link[current][0] != previous ? link[current][0] : link[current][1];
+			if (next < 0)
+				break;
+			emitTriangle(anchor, anchorNormal, finePosition[current], fineNormal[current], finePosition[next], fineNormal[next],
+				origin, spacing, maxFaces, faceCount, vertices);
+			previous = current;
+			current = next;
+			if (faceSide((int2)(current / 5, current % 5)) >= 0)
+				break;
+		}
+
+		int endSide = faceSide((int2)(current / 5, current % 5));
+		if (current == id || endSide < 0)
+			continue;
+		emitTriangle(anchor, anchorNormal, finePosition[current], fineNormal[current], coarsePosition[endSide], coarseNormal[endSide],
+			origin, spacing, maxFaces, faceCount, vertices);
+		finePartner[side] = endSide;
+		finePartner[endSide] = side;
+	}
+
+	// on an ambiguous face the two sides can pair the four crossings differently,
+	// the quad left between the pairings is filled in
+	for (int side = 0; side < 4; ++side)
+	{
+		int s1 = finePartner[side];
+		int s2 = s1 >= 0 ? coarsePartner[s1] : -1;
+		int s3 = s2 >= 0 ? finePartner[s2] : -1;
+		if (s1 < 0 || s2 < 0 || s3 < 0 || s2 == side || side > min(s1, min(s2, s3)))
+			continue;
+		emitTriangle(coarsePosition[side], coarseNormal[side], coarsePosition[s1], coarseNormal[s1], coarsePosition[s2], coarseNormal[s2],
+			origin, spacing, maxFaces, faceCount, vertices);
+		emitTriangle(coarsePosition[side], coarseNormal[side], coarsePosition[s2], coarseNormal[s2], coarsePosition[s3], coarseNormal[s3],
+			origin, spacing, maxFaces, faceCount, vertices);
+	}
+}
+
+// error pass for one level: how far the field strays from what cells of this level
+// would interpolate, and the range it covers, per node. one work-item per sample of
+// the next finer level.
+kernel void kernelAdaptiveError(int a_level,
+								int4 a_gridSize,
+								int4 a_nodeCount,
+								int a_nodeOffset,
+								global int* a_nodeStats, // error, min, max per node
+								FIELD_PARAMS)
+{
+	int step = 1 << (a_level - 1);
+	int4 p = min((int4)(get_global_id(0), get_global_id(1), get_global_id(2), 0) * step, a_gridSize);
+	p.w = 0;
+	int4 node = min(p / (ADAPTIVE_LEAF_CELLS << a_level), a_nodeCount - (int4)(1));
+
+	float value = sampleCorner(convert_float4(p), FIELD_ARGS);
+	float error = fabs(value - restrictedSample(p, a_level, FIELD_ARGS));
+
+	global int* stats = a_nodeStats + (a_nodeOffset + node.x + a_nodeCount.x * (node.y + a_nodeCount.y * node.z)) * 3;
+	atomic_max(stats, orderedFloat(error));
+	atomic_min(stats + 1, orderedFloat(value));
+	atomic_max(stats + 2, orderedFloat(value));
+}
+
+// one work-item per cell of every leaf, leaves are (origin in cubes, level)
+kernel void kernelMCAdaptive(int a_maxFaces,
+							 global uint* a_faceCount,
+							 global float4* a_vertices,
+							 float a_threshold,
+							 float4 a_origin,
+							 float4 a_spacing,
+							 global const int4* a_leaves,
+							 global const uchar* a_levels,
+							 int4 a_mapSize,
+							 int4 a_gridSize,
+							 FIELD_PARAMS)
+{
+	const int leafCells = ADAPTIVE_LEAF_CELLS * ADAPTIVE_LEAF_CELLS * ADAPTIVE_LEAF_CELLS;
+	int4 leaf = a_leaves[get_global_id(0) / leafCells];
+	int cellIndex = get_global_id(0) % leafCells;
+
+	int level = leaf.w;
+	int size = 1 << level;
+	leaf.w = 0;
+	int4 cell = (int4)(cellIndex % ADAPTIVE_LEAF_CELLS, (cellIndex / ADAPTIVE_LEAF_CELLS) % ADAPTIVE_LEAF_CELLS,
+		cellIndex / (ADAPTIVE_LEAF_CELLS * ADAPTIVE_LEAF_CELLS), 0);
+	int4 corner = leaf + cell * size;
+	if (corner.x >= a_gridSize.x || corner.y >= a_gridSize.y || corner.z >= a_gridSize.z)
+		return;
+
+	float cornerVolumes[8];
+	leafCube(corner, level, leaf, leaf + (int4)(ADAPTIVE_LEAF_CELLS * size), a_levels, a_mapSize, cornerVolumes, FIELD_ARGS);
+	int flagIndex = cubeFlags(cornerVolumes, a_threshold);
+	if (EDGE_FLAGS[ flagIndex ] == 0)
+		return;
+
+	float4 cubeCorner = convert_float4(corner);
+	float4 edgePosition[12];
+	float4 edgeNormal[12];
+	for ( int edgeIndex = 0 ; edgeIndex < 12 ; ++edgeIndex )
+	{
+		if (EDGE_FLAGS[ flagIndex ] & (1<<edgeIndex))
+		{
+			edgePosition[ edgeIndex ] = edgeVertex(cubeCorner, size, cornerVolumes, edgeIndex, a_threshold);
+			edgeNormal[ edgeIndex ] = fieldNormal(edgePosition[ edgeIndex ], FIELD_ARGS);
+		}
+	}
+
+	for ( int triangleIndex = 0 ; triangleIndex < 5 ; ++triangleIndex )
+	{
+		if (TRIANGLE_TABLE[ flagIndex ][ 3 * triangleIndex ] < 0)
+			break;
+
+		uint startVertex = atomic_inc(a_faceCount);
+		if (startVertex >= a_maxFaces)
+			break;
+
+		for ( int triangleVertex = 0 ; triangleVertex < 3 ; ++triangleVertex )
+		{
+			int vertexIndex = TRIANGLE_TABLE[ flagIndex ][3 * triangleIndex + triangleVertex];
+			a_vertices[startVertex * 6 + triangleVertex * 2] = worldPosition(edgePosition[ vertexIndex ], a_origin, a_spacing);
+			a_vertices[startVertex * 6 + triangleVertex * 2 + 1] = worldNormal(edgeNormal[ vertexIndex ], a_spacing);
+		}
+	}
+
+	// faces on the leaf's boundary that border a finer leaf get a transition cell
+	if (level == 0)
+		return;
+	for (int face = 0; face < 6; ++face)
+	{
+		int axis = face / 2;
+		int c = component(cell, axis);
+		if (c != ((face & 1) ? ADAPTIVE_LEAF_CELLS - 1 : 0))
+			continue;
+
+		// the block just across the middle of the face
+		int4 across = corner + (int4)(size / 2);
+		across.w = 0;
+		if (axis == 0) across.x = (face & 1) ? corner.x + size : corner.x - 1;
+		if (axis == 1) across.y = (face & 1) ? corner.y + size : corner.y - 1;
+		if (axis == 2) across.z = (face & 1) ? corner.z + size : corner.z - 1;
+		if (any(across.xyz < (int3)(0)) || any(across.xyz >= a_gridSize.xyz))
+			continue;
+
+		if (levelAt(across / ADAPTIVE_LEAF_CELLS, a_levels, a_mapSize) < level)
+			stitchFace(face, corner, level, flagIndex, edgePosition, edgeNormal, a_threshold, a_origin, a_spacing,
+				a_maxFaces, a_faceCount, a_vertices, a_levels, a_mapSize, FIELD_ARGS);
+	}
+}
@@ -0,0 +1,278 @@
+#include "adaptive.h"
+
+#include <algorithm>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+// cells per leaf axis, matches adaptive.cl
+#define LEAF_CELLS 8
+
+// inverse of orderedFloat in adaptive.cl
+static float orderedToFloat(cl_int value)
+{
+	if (value < 0)
+		value ^= 0x7fffffff;
+	float result;
+	memcpy(&result, &value, sizeof(result));
+	return result;
+}
+
+static size_t blockIndex(const AdaptiveMesher& mesher, size_t x, size_t y, size_t z)
+{
+	return x + mesher.mapSize[0] * (y + mesher.mapSize[1] * z);
+}
+
+// sets every block of a node to the node's level
+static void fillNode(AdaptiveMesher& mesher, size_t x, size_t y, size_t z, int level)
+{
+	size_t blocks = (size_t)1 << level;
+	for (size_t bz = z * blocks; bz < (z + 1) * blocks && bz < mesher.mapSize[2]; ++bz)
+		for (size_t by = y * blocks; by < (y + 1) * blocks && by < mesher.mapSize[1]; ++by)
+			for (size_t bx = x * blocks; bx < (x + 1) * blocks && bx < mesher.mapSize[0]; ++bx)
+				mesher.levelMap[blockIndex(mesher, bx, by, bz)] = (cl_uchar)level;
+}
+
+// a level's error pass only sees samples at its own spacing, detail between them shows
+// up in the finer levels. each level is folded into the one above so a node's error and
+// range cover everything below it.
+static void foldStats(AdaptiveMesher& mesher)
+{
+	for (int level = 2; level <= mesher.maxLevel; ++level)
+	{
+		const size_t* childCounts = &mesher.nodeCounts[(level - 1) * 3];
+		const size_t* counts = &mesher.nodeCounts[level * 3];
+		for (size_t z = 0; z < childCounts[2]; ++z)
+			for (size_t y = 0; y < childCounts[1]; ++y)
+				for (size_t x = 0; x < childCounts[0]; ++x)
+				{
+					const cl_int* child = &mesher.stats[(mesher.nodeOffsets[level - 1] + x + childCounts[0] * (y + childCounts[1] * z)) * 3];
+					cl_int* parent = &mesher.stats[(mesher.nodeOffsets[level] + x / 2 + counts[0] * (y / 2 + counts[1] * (z / 2))) * 3];
+					// the values are ordered ints, they compare like the floats
+					parent[0] = std::max(parent[0], child[0]);
+					parent[1] = std::min(parent[1], child[1]);
+					parent[2] = std::max(parent[2], child[2]);
+				}
+	}
+}
+
+// splits a node while a coarser level would stray from the field by more than the
+// tolerance somewhere the surface could pass
+static void refineNode(AdaptiveMesher& mesher, const AdaptiveSettings& settings, cl_float threshold,
+	size_t x, size_t y, size_t z, int level)
+{
+	bool split = false;
+	if (level > 0)
+	{
+		const size_t* counts = &mesher.nodeCounts[level * 3];
+		const cl_int* stats = &mesher.stats[(mesher.nodeOffsets[level] + x + counts[0] * (y + counts[1] * z)) * 3];
+		float error = orderedToFloat(stats[0]);
+		float minimum = orderedToFloat(stats[1]);
+		float maximum = orderedToFloat(stats[2]);
+
+		float tolerance = settings.tolerance;
+		if (settings.focusDistance > 0)
+		{
+			float nodeSize = (float)(LEAF_CELLS << level);
+			float dx = (x + 0.5f) * nodeSize - settings.eye[0];
+			float dy = (y + 0.5f) * nodeSize - settings.eye[1];
+			float dz = (z + 0.5f) * nodeSize - settings.eye[2];
+			float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+			if (distance > settings.focusDistance)
+				tolerance *= distance / settings.focusDistance;
+		}
+
+		split = error > tolerance && minimum - error <= threshold && threshold < maximum + error;
+	}
+
+	if (!split)
+	{
+		fillNode(mesher, x, y, z, level);
+		return;
+	}
+
+	size_t blocks = (size_t)1 << (level - 1);
+	for (int child = 0; child < 8; ++child)
+	{
+		size_t cx = x * 2 + (child & 1), cy = y * 2 + ((child >> 1) & 1), cz = z * 2 + (child >> 2);
+		if (cx * blocks < mesher.mapSize[0] && cy * blocks < mesher.mapSize[1] && cz * blocks < mesher.mapSize[2])
+			refineNode(mesher, settings, threshold, cx, cy, cz, level - 1);
+	}
+}
+
+// splits leaves until every pair that touches, even at a corner, is at most one
+// level apart. transition cells only handle a single step.
+static void balanceLevels(AdaptiveMesher& mesher)
+{
+	const long size[3] = { (long)mesher.mapSize[0], (long)mesher.mapSize[1], (long)mesher.mapSize[2] };
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (long z = 0; z < size[2]; ++z)
+			for (long y = 0; y < size[1]; ++y)
+				for (long x = 0; x < size[0]; ++x)
+				{
+					int level = mesher.levelMap[blockIndex(mesher, x, y, z)];
+					bool split = false;
+					for (int n = 0; n < 27 && level > 1 && !split; ++n)
+					{
+						long nx = x + n % 3 - 1, ny = y + (n / 3) % 3 - 1, nz = z + n / 9 - 1;
+						if (nx >= 0 && ny >= 0 && nz >= 0 && nx < size[0] && ny < size[1] && nz < size[2])
+							split = mesher.levelMap[blockIndex(mesher, nx, ny, nz)] + 1 < level;
+					}
+					if (split)
+					{
+						// the leaf's blocks all become leaves one level down
+						for (int child = 0; child < 8; ++child)
+							fillNode(mesher, ((x >> level) << 1) + (child & 1), ((y >> level) << 1) + ((child >> 1) & 1),
+								((z >> level) << 1) + (child >> 2), level - 1);
+						changed = true;
+					}
+				}
+	}
+}
+
+bool createAdaptiveMesher(AdaptiveMesher& mesher, cl_context context, cl_program program, const size_t* gridSize)
+{
+	cl_int result = CL_SUCCESS;
+	mesher.error = clCreateKernel(program, "kernelAdaptiveError", &result);
+	CL_CHECK(result);
+	mesher.march = clCreateKernel(program, "kernelMCAdaptive", &result);
+	CL_CHECK(result);
+
+	// the root is the first level whose single leaf covers the grid
+	size_t largest = 0;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		mesher.gridSize[axis] = gridSize[axis];
+		mesher.mapSize[axis] = (gridSize[axis] + LEAF_CELLS - 1) / LEAF_CELLS;
+		if (gridSize[axis] > largest)
+			largest = gridSize[axis];
+	}
+	mesher.maxLevel = 0;
+	while (((size_t)LEAF_CELLS << mesher.maxLevel) < largest)
+		++mesher.maxLevel;
+
+	size_t nodeTotal = 0;
+	mesher.nodeCounts.resize((mesher.maxLevel + 1) * 3);
+	mesher.nodeOffsets.resize(mesher.maxLevel + 1);
+	for (int level = 0; level <= mesher.maxLevel; ++level)
+	{
+		size_t nodeSize = (size_t)LEAF_CELLS << level;
+		size_t* counts = &mesher.nodeCounts[level * 3];
+		for (int axis = 0; axis < 3; ++axis)
+			counts[axis] = (gridSize[axis] + nodeSize - 1) / nodeSize;
+		// level 0 leaves are never split, they need no stats
+		mesher.nodeOffsets[level] = nodeTotal;
+		if (level > 0)
+			nodeTotal += counts[0] * counts[1] * counts[2];
+	}
+	mesher.stats.resize(nodeTotal * 3);
+
+	size_t blockCount = mesher.mapSize[0] * mesher.mapSize[1] * mesher.mapSize[2];
+	mesher.levelMap.resize(blockCount);
+	mesher.leafList.reserve(blockCount);
+
+	mesher.nodeStats = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_int) * mesher.stats.size(), nullptr, &result);
+	CL_CHECK(result);
+	mesher.levels = clCreateBuffer(context, CL_MEM_READ_ONLY, blockCount, nullptr, &result);
+	CL_CHECK(result);
+	mesher.leaves = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(cl_int4) * blockCount, nullptr, &result);
+	CL_CHECK(result);
+
+	bool created = mesher.error != 0 && mesher.march != 0 && mesher.nodeStats != 0 && mesher.levels != 0 && mesher.leaves != 0;
+	if (!created)
+		releaseAdaptiveMesher(mesher);
+	return created;
+}
+
+void releaseAdaptiveMesher(AdaptiveMesher& mesher)
+{
+	releaseMemObject(mesher.leaves);
+	releaseMemObject(mesher.levels);
+	releaseMemObject(mesher.nodeStats);
+	releaseKernel(mesher.march);
+	releaseKernel(mesher.error);
+}
+
+cl_int marchAdaptive(AdaptiveMesher& mesher, cl_command_queue queue, const AdaptiveSettings& settings,
+	cl_float threshold, cl_float4 origin, cl_float4 spacing, cl_int maxFaces, cl_mem faceCount, cl_mem vertices,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event)
+{
+	// error pyramid, no error and an empty range to start with
+	for (size_t i = 0; i < mesher.stats.size(); i += 3)
+	{
+		mesher.stats[i] = 0;
+		mesher.stats[i + 1] = INT_MAX;
+		mesher.stats[i + 2] = INT_MIN;
+	}
+	cl_int result = clEnqueueWriteBuffer(queue, mesher.nodeStats, CL_FALSE, 0, sizeof(cl_int) * mesher.stats.size(), mesher.stats.data(),
+		waitCount, waitEvents, 0);
+
+	cl_int4 gridSize = { { (cl_int)mesher.gridSize[0], (cl_int)mesher.gridSize[1], (cl_int)mesher.gridSize[2], 1 } };
+	for (int level = 1; level <= mesher.maxLevel; ++level)
+	{
+		const size_t* counts = &mesher.nodeCounts[level * 3];
+		cl_int4 nodeCount = { { (cl_int)counts[0], (cl_int)counts[1], (cl_int)counts[2], 1 } };
+		cl_int nodeOffset = (cl_int)mesher.nodeOffsets[level];
+		size_t step = (size_t)1 << (level - 1);
+		size_t samples[3];
+		for (int axis = 0; axis < 3; ++axis)
+			samples[axis] = (mesher.gridSize[axis] + step - 1) / step + 1;
+
+		result |= clSetKernelArg(mesher.error, 0, sizeof(cl_int), &level);
+		result |= clSetKernelArg(mesher.error, 1, sizeof(cl_int4), &gridSize);
+		result |= clSetKernelArg(mesher.error, 2, sizeof(cl_int4), &nodeCount);
+		result |= clSetKernelArg(mesher.error, 3, sizeof(cl_int), &nodeOffset);
+		result |= clSetKernelArg(mesher.error, 4, sizeof(cl_mem), &mesher.nodeStats);
+		result |= clEnqueueNDRangeKernel(queue, mesher.error, 3, 0, samples, 0, 0, nullptr, 0);
+	}
+	result |= clEnqueueReadBuffer(queue, mesher.nodeStats, CL_TRUE, 0, sizeof(cl_int) * mesher.stats.size(), mesher.stats.data(), 0, nullptr, 0);
+	CL_CHECK(result);
+	if (result != CL_SUCCESS)
+		return result;
+
+	// octree down from the root, balanced, then flattened to its leaves
+	foldStats(mesher);
+	refineNode(mesher, settings, threshold, 0, 0, 0, mesher.maxLevel);
+	balanceLevels(mesher);
+
+	mesher.leafList.clear();
+	for (size_t z = 0; z < mesher.mapSize[2]; ++z)
+		for (size_t y = 0; y < mesher.mapSize[1]; ++y)
+			for (size_t x = 0; x < mesher.mapSize[0]; ++x)
+			{
+				int level = mesher.levelMap[blockIndex(mesher, x, y, z)];
+				size_t mask = ((size_t)1 << level) - 1;
+				if ((x & mask) == 0 && (y & mask) == 0 && (z & mask) == 0)
+				{
+					cl_int4 leaf = { { (cl_int)(x * LEAF_CELLS), (cl_int)(y * LEAF_CELLS), (cl_int)(z * LEAF_CELLS), level } };
+					mesher.leafList.push_back(leaf);
+				}
+			}
+
+	// the host copies are rewritten next time, the writes block
+	result = clEnqueueWriteBuffer(queue, mesher.levels, CL_TRUE, 0, mesher.levelMap.size(), mesher.levelMap.data(), 0, nullptr, 0);
+	result |= clEnqueueWriteBuffer(queue, mesher.leaves, CL_TRUE, 0, sizeof(cl_int4) * mesher.leafList.size(), mesher.leafList.data(), 0, nullptr, 0);
+
+	cl_int4 mapSize = { { (cl_int)mesher.mapSize[0], (cl_int)mesher.mapSize[1], (cl_int)mesher.mapSize[2], 1 } };
+	result |= clSetKernelArg(mesher.march, 0, sizeof(cl_int), &maxFaces);
+	result |= clSetKernelArg(mesher.march, 1, sizeof(cl_mem), &faceCount);
+	result |= clSetKernelArg(mesher.march, 2, sizeof(cl_mem), &vertices);
+	result |= clSetKernelArg(mesher.march, 3, sizeof(cl_float), &threshold);
+	result |= clSetKernelArg(mesher.march, 4, sizeof(cl_float4), &origin);
+	result |= clSetKernelArg(mesher.march, 5, sizeof(cl_float4), &spacing);
+	result |= clSetKernelArg(mesher.march, 6, sizeof(cl_mem), &mesher.leaves);
+	result |= clSetKernelArg(mesher.march, 7, sizeof(cl_mem), &mesher.levels);
+	result |= clSetKernelArg(mesher.march, 8, sizeof(cl_int4), &mapSize);
+	result |= clSetKernelArg(mesher.march, 9, sizeof(cl_int4), &gridSize);
+
+	size_t cells = mesher.leafList.size() * LEAF_CELLS * LEAF_CELLS * LEAF_CELLS;
+	if (cells > 0)
+		result |= clEnqueueNDRangeKernel(queue, mesher.march, 1, 0, &cells, 0, 0, nullptr, event);
+	else if (event != nullptr)
+		result |= clEnqueueMarkerWithWaitList(queue, 0, nullptr, event);
+	CL_CHECK(result);
+	return result;
+}
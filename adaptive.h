@@ -0,0 +1,51 @@
+#pragma once
+
+#include "clutil.h"
+
+#include <vector>
+
+// adaptive extraction: an octree over the grid picks coarse cells where the field is
+// close to linear (or far from the camera) and fine cells near detail, leaves of
+// different levels are stitched so the surface stays closed. triangles and work
+// follow the detail rather than the grid volume.
+struct AdaptiveSettings
+{
+	cl_float	tolerance;		// field error a coarser level may introduce
+	cl_float	eye[3];			// camera position in grid space
+	cl_float	focusDistance;	// the tolerance grows with distance past this, 0 to ignore the camera
+};
+
+struct AdaptiveMesher
+{
+	cl_kernel	error;
+	cl_kernel	march;
+
+	cl_mem		nodeStats;		// error, min and max per node of every level
+	cl_mem		levels;			// leaf level per block of leaf cells
+	cl_mem		leaves;			// origin and level of every leaf
+
+	size_t		gridSize[3];
+	size_t		mapSize[3];		// blocks per axis
+	int			maxLevel;		// root level, one leaf covers the grid
+
+	std::vector<size_t>		nodeCounts;		// per level, x y z
+	std::vector<size_t>		nodeOffsets;	// first node of each level in nodeStats
+	std::vector<cl_int>		stats;
+	std::vector<cl_uchar>	levelMap;
+	std::vector<cl_int4>	leafList;
+};
+
+// kernel arguments from this index on are the field's, see setFieldArgs
+#define ADAPTIVE_ERROR_FIELD_ARG 5
+#define ADAPTIVE_MARCH_FIELD_ARG 10
+
+bool createAdaptiveMesher(AdaptiveMesher& mesher, cl_context context, cl_program program, const size_t* gridSize);
+void releaseAdaptiveMesher(AdaptiveMesher& mesher);
+
+// measures the field, builds and balances the octree on the host (a small blocking
+// read of the error pyramid) and marches the leaves into vertices the way kernelMC
+// does, in the world space of origin and spacing. the field arguments must already be
+// set on both kernels.
+cl_int marchAdaptive(AdaptiveMesher& mesher, cl_command_queue queue, const AdaptiveSettings& settings,
+	cl_float threshold, cl_float4 origin, cl_float4 spacing, cl_int maxFaces, cl_mem faceCount, cl_mem vertices,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event);
@@ -0,0 +1,73 @@
+// batched marching of many small volumes in a single dispatch
+//
+// the volumes' samples are packed back to back in one buffer and described by a list
+// of BatchVolume. the dispatch is one work-item per cell of the whole batch, each finds
+// its volume by a binary search over the cell starts and marches its cube the way
+// kernelMC does, into the volume's own slice of the output and its own counter.
+
+// the batch packs linear buffers, it isn't built for the bricked or image fields
+#if defined(FIELD_VOLUME) && !defined(FIELD_BRICKED) && !defined(FIELD_IMAGE)
+
+// matches the host's BatchVolume in batch.h
+typedef struct
+{
+	int4	size;			// samples per axis, w = 1
+	float4	origin;			// world transform, see worldPosition
+	float4	spacing;
+	float2	scale;			// sample scale and bias, see field.cl
+	float	threshold;
+	uint	maxFaces;		// capacity of the volume's slice
+	ulong	sampleOffset;	// first sample within the packed samples
+	uint	faceOffset;		// first face of the volume's slice
+	uint	cellStart;		// first cell of the volume within the dispatch
+} BatchVolume;
+
+// volume holding a cell of the dispatch, cell starts ascend
+uint batchVolume(global const BatchVolume* volumes, uint volumeCount, uint cell)
+{
+	uint low = 0;
+	uint high = volumeCount - 1;
+	while (low < high)
+	{
+		uint middle = (low + high + 1) / 2;
+		if (volumes[middle].cellStart <= cell)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+	return low;
+}
+
+kernel void kernelMCBatch(global const BatchVolume* a_volumes,
+						  uint a_volumeCount,
+						  uint a_cellCount,
+						  global uint* a_faceCounts,
+						  global float4* a_vertices,
+						  global const VOXEL_T* a_samples)
+{
+	uint cell = get_global_id(0);
+	if (cell >= a_cellCount)
+		return;
+
+	uint index = batchVolume(a_volumes, a_volumeCount, cell);
+	BatchVolume volume = a_volumes[index];
+
+	// cells run x-major like the samples, one fewer than samples per axis
+	uint local = cell - volume.cellStart;
+	uint cellsX = volume.size.x - 1;
+	uint cellsY = volume.size.y - 1;
+	float4 cubeCorner = (float4)(local % cellsX, (local / cellsX) % cellsY, local / (cellsX * cellsY), 0.0f);
+
+	global const VOXEL_T* field = a_samples + volume.sampleOffset;
+	float cornerVolumes[8];
+	sampleCube(cubeCorner, cornerVolumes, field, volume.size, volume.scale);
+
+	// a sub-group can straddle volumes and so counters, each cube reserves on its own
+	int flagIndex = cubeFlags(cornerVolumes, volume.threshold);
+	int faces = cubeFaces(flagIndex);
+	uint firstFace = faces > 0 ? atomic_add(a_faceCounts + index, faces) : 0;
+	emitCube(cubeCorner, cornerVolumes, flagIndex, volume.threshold, volume.origin, volume.spacing, firstFace, volume.maxFaces,
+		a_vertices + (size_t)volume.faceOffset * 6, field, volume.size, volume.scale);
+}
+
+#endif
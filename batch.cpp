@@ -0,0 +1,156 @@
+#include "batch.h"
+
+#include <limits.h>
+#include <string.h>
+
+static_assert(sizeof(BatchVolume) == 80, "BatchVolume must match batch.cl");
+
+// replaces a buffer with a larger one when it can't hold bytes, the contents are lost
+static bool reserveBuffer(cl_context context, cl_mem_flags flags, cl_mem& buffer, size_t& capacity, size_t bytes)
+{
+	if (bytes <= capacity && buffer != 0)
+		return true;
+
+	if (buffer != 0)
+		clReleaseMemObject(buffer);
+	capacity = bytes > capacity * 2 ? bytes : capacity * 2;
+
+	// doubling may pass the device's largest allocation when bytes alone doesn't
+	cl_int result = CL_SUCCESS;
+	buffer = clCreateBuffer(context, flags, capacity, nullptr, &result);
+	if (result != CL_SUCCESS && capacity > bytes)
+	{
+		capacity = bytes;
+		buffer = clCreateBuffer(context, flags, capacity, nullptr, &result);
+	}
+	CL_CHECK(result);
+	if (result != CL_SUCCESS)
+	{
+		buffer = 0;
+		capacity = 0;
+	}
+	return buffer != 0;
+}
+
+bool createBatch(Batch& batch, cl_context context, cl_program program, VoxelType type)
+{
+	cl_int result = CL_SUCCESS;
+	batch.kernel = clCreateKernel(program, "kernelMCBatch", &result);
+	CL_CHECK(result);
+
+	batch.context = context;
+	batch.type = type;
+	batch.volumeLink = 0;
+	batch.sampleLink = 0;
+	batch.faceCountLink = 0;
+	batch.vertices = 0;
+	batch.volumeCapacity = 0;
+	batch.sampleCapacity = 0;
+	batch.faceCapacity = 0;
+	batch.countCapacity = 0;
+	clearBatch(batch);
+	return batch.kernel != 0;
+}
+
+void releaseBatch(Batch& batch)
+{
+	if (batch.vertices != 0)
+		clReleaseMemObject(batch.vertices);
+	if (batch.faceCountLink != 0)
+		clReleaseMemObject(batch.faceCountLink);
+	if (batch.sampleLink != 0)
+		clReleaseMemObject(batch.sampleLink);
+	if (batch.volumeLink != 0)
+		clReleaseMemObject(batch.volumeLink);
+	clReleaseKernel(batch.kernel);
+}
+
+void clearBatch(Batch& batch)
+{
+	batch.volumes.clear();
+	batch.samples.clear();
+	batch.faceCounts.clear();
+	batch.cellCount = 0;
+	batch.faceCount = 0;
+}
+
+bool addToBatch(Batch& batch, const Volume& volume, cl_float threshold, cl_uint maxFaces)
+{
+	if (volume.type != batch.type)
+	{
+		printf("Batched volumes must share a sample type!\n");
+		return false;
+	}
+
+	size_t cells = (volume.size[0] - 1) * (volume.size[1] - 1) * (volume.size[2] - 1);
+	if (batch.cellCount + cells > UINT_MAX || batch.faceCount + maxFaces > UINT_MAX)
+		return false;
+
+	BatchVolume entry;
+	entry.size.s[0] = (cl_int)volume.size[0];
+	entry.size.s[1] = (cl_int)volume.size[1];
+	entry.size.s[2] = (cl_int)volume.size[2];
+	entry.size.s[3] = 1;
+	entry.origin = volumeOrigin(volume);
+	entry.spacing = volumeSpacing(volume);
+	entry.scale = volumeNormalization(volume);
+	entry.threshold = threshold;
+	entry.maxFaces = maxFaces;
+	entry.sampleOffset = batch.samples.size() / volume.voxelBytes;
+	entry.faceOffset = (cl_uint)batch.faceCount;
+	entry.cellStart = (cl_uint)batch.cellCount;
+	batch.volumes.push_back(entry);
+
+	size_t bytes = volumeBytes(volume);
+	batch.samples.resize(batch.samples.size() + bytes);
+	memcpy(batch.samples.data() + batch.samples.size() - bytes, volumeSample(volume, 0, 0, 0), bytes);
+
+	batch.cellCount += cells;
+	batch.faceCount += maxFaces;
+	return true;
+}
+
+cl_int enqueueBatch(Batch& batch, cl_command_queue queue, cl_uint waitCount, const cl_event* waitEvents, cl_event* event)
+{
+	cl_uint volumeCount = (cl_uint)batch.volumes.size();
+	if (volumeCount == 0 || batch.cellCount == 0)
+		return clEnqueueMarkerWithWaitList(queue, waitCount, waitEvents, event);
+
+	bool reserved = reserveBuffer(batch.context, CL_MEM_READ_ONLY, batch.volumeLink, batch.volumeCapacity, sizeof(BatchVolume) * volumeCount);
+	reserved = reserveBuffer(batch.context, CL_MEM_READ_ONLY, batch.sampleLink, batch.sampleCapacity, batch.samples.size()) && reserved;
+	reserved = reserveBuffer(batch.context, CL_MEM_WRITE_ONLY, batch.vertices, batch.faceCapacity, sizeof(cl_float4) * 6 * batch.faceCount) && reserved;
+	reserved = reserveBuffer(batch.context, CL_MEM_READ_WRITE, batch.faceCountLink, batch.countCapacity, sizeof(cl_uint) * volumeCount) && reserved;
+	if (!reserved)
+		return CL_MEM_OBJECT_ALLOCATION_FAILURE;
+
+	// counters start at zero, the host copy is overwritten by the read at the end
+	batch.faceCounts.assign(volumeCount, 0);
+	cl_uint cellCount = (cl_uint)batch.cellCount;
+
+	// in order queue, only the first command needs the caller's events
+	cl_int result = clEnqueueWriteBuffer(queue, batch.volumeLink, CL_FALSE, 0, sizeof(BatchVolume) * volumeCount, batch.volumes.data(),
+		waitCount, waitEvents, 0);
+	result |= clEnqueueWriteBuffer(queue, batch.sampleLink, CL_FALSE, 0, batch.samples.size(), batch.samples.data(), 0, nullptr, 0);
+	result |= clEnqueueWriteBuffer(queue, batch.faceCountLink, CL_FALSE, 0, sizeof(cl_uint) * volumeCount, batch.faceCounts.data(), 0, nullptr, 0);
+
+	result |= clSetKernelArg(batch.kernel, 0, sizeof(cl_mem), &batch.volumeLink);
+	result |= clSetKernelArg(batch.kernel, 1, sizeof(cl_uint), &volumeCount);
+	result |= clSetKernelArg(batch.kernel, 2, sizeof(cl_uint), &cellCount);
+	result |= clSetKernelArg(batch.kernel, 3, sizeof(cl_mem), &batch.faceCountLink);
+	result |= clSetKernelArg(batch.kernel, 4, sizeof(cl_mem), &batch.vertices);
+	result |= clSetKernelArg(batch.kernel, 5, sizeof(cl_mem), &batch.sampleLink);
+
+	size_t globalSize = batch.cellCount;
+	result |= clEnqueueNDRangeKernel(queue, batch.kernel, 1, 0, &globalSize, 0, 0, nullptr, 0);
+	result |= clEnqueueReadBuffer(queue, batch.faceCountLink, CL_FALSE, 0, sizeof(cl_uint) * volumeCount, batch.faceCounts.data(), 0, nullptr, event);
+	CL_CHECK(result);
+	return result;
+}
+
+size_t batchFaceBudget(cl_device_id device, size_t memoryBudget)
+{
+	cl_ulong maxAlloc = 0;
+	clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxAlloc, 0);
+	size_t bytes = maxAlloc > 0 && maxAlloc < memoryBudget ? (size_t)maxAlloc : memoryBudget;
+	return bytes / (sizeof(cl_float4) * 6);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "clutil.h"
+#include "volume.h"
+
+#include <vector>
+
+// marches many small volumes with one dispatch and one upload, for workloads where
+// launch and finish latency would dominate a kernel per volume. the volumes must share
+// a sample type and the kernel comes from a program built with that type's
+// volumeBuildOptions.
+
+// one volume of a batch, matches BatchVolume in batch.cl
+struct BatchVolume
+{
+	cl_int4		size;			// samples per axis, w = 1
+	cl_float4	origin;			// world transform of the volume's vertices
+	cl_float4	spacing;
+	cl_float2	scale;
+	cl_float	threshold;
+	cl_uint		maxFaces;
+	cl_ulong	sampleOffset;
+	cl_uint		faceOffset;		// first face of the volume's slice of vertices
+	cl_uint		cellStart;
+};
+
+struct Batch
+{
+	cl_kernel					kernel;
+	cl_context					context;
+	VoxelType					type;
+
+	std::vector<BatchVolume>	volumes;
+	std::vector<char>			samples;		// packed on the host, must stay untouched until the batch completes
+	std::vector<cl_uint>		faceCounts;		// per volume, read back by the batch, may exceed the volume's maxFaces
+	size_t						cellCount;
+	size_t						faceCount;		// total capacity of the slices
+
+	cl_mem						volumeLink;
+	cl_mem						sampleLink;
+	cl_mem						faceCountLink;
+	cl_mem						vertices;		// every volume's faces, laid out like kernelMC's
+
+	size_t						volumeCapacity;	// current buffer sizes, grown as batches need
+	size_t						sampleCapacity;
+	size_t						faceCapacity;
+	size_t						countCapacity;
+};
+
+bool createBatch(Batch& batch, cl_context context, cl_program program, VoxelType type);
+void releaseBatch(Batch& batch);
+
+// empties the batch, the buffers are kept for the next one
+void clearBatch(Batch& batch);
+
+// copies the volume's samples into the batch and reserves a slice of maxFaces faces.
+// fails if the sample type differs from the batch's or the cells would overflow.
+bool addToBatch(Batch& batch, const Volume& volume, cl_float threshold, cl_uint maxFaces);
+
+// uploads the batch, marches every volume in one dispatch and queues a non-blocking
+// read of the face counts. faceCounts and vertices are valid once event completes,
+// the batch must not be changed before then.
+cl_int enqueueBatch(Batch& batch, cl_command_queue queue, cl_uint waitCount, const cl_event* waitEvents, cl_event* event);
+
+// faces a batch's vertex buffer can hold within memoryBudget bytes and the device's
+// largest allocation. batches are grown only while their slices add up to less.
+size_t batchFaceBudget(cl_device_id device, size_t memoryBudget);
@@ -0,0 +1,148 @@
+#include "clutil.h"
+
+#include <string>
+#include <string.h>
+
+// kernel files that make up the program, in compile order
+static const char* PROGRAM_FILES[] = { "field.cl", "mc.cl", "decimate.cl", "adaptive.cl", "nets.cl", "batch.cl", "sweep.cl", "edges.cl", "sph.cl" };
+static const int PROGRAM_FILE_COUNT = sizeof(PROGRAM_FILES) / sizeof(PROGRAM_FILES[0]);
+
+bool hasExtension(cl_device_id device, const char* extension)
+{
+	size_t extensionSize = 0;
+	cl_int result = clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, 0, nullptr, &extensionSize);
+	CL_CHECK(result);
+	if (result != CL_SUCCESS)
+		return false;
+
+	char* extensions = new char[extensionSize];
+	result = clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, extensionSize, extensions, &extensionSize);
+	CL_CHECK(result);
+
+	std::string devString(result == CL_SUCCESS ? extensions : "");
+	delete[] extensions;
+
+	// extensions are space separated, match whole names only
+	size_t oldPos = 0;
+	size_t spacePos = devString.find(' ', oldPos);
+	while (oldPos < devString.size())
+	{
+		if (spacePos == devString.npos)
+			spacePos = devString.size();
+		if (devString.compare(oldPos, spacePos - oldPos, extension) == 0 &&
+			strlen(extension) == spacePos - oldPos)
+			return true;
+		oldPos = spacePos + 1;
+		spacePos = devString.find(' ', oldPos);
+	}
+	return false;
+}
+
+void releaseKernel(cl_kernel& kernel)
+{
+	if (kernel != 0)
+		clReleaseKernel(kernel);
+	kernel = 0;
+}
+
+void releaseMemObject(cl_mem& memObject)
+{
+	if (memObject != 0)
+		clReleaseMemObject(memObject);
+	memObject = 0;
+}
+
+FieldArgs volumeFieldArgs(cl_mem samples, cl_int4 size, cl_float2 scale)
+{
+	FieldArgs args = {};
+	args.volume = true;
+	args.field = samples;
+	args.size = size;
+	args.scale = scale;
+	return args;
+}
+
+FieldArgs particleFieldArgs(cl_mem particles, cl_int particleCount)
+{
+	FieldArgs args = {};
+	args.field = particles;
+	args.particleCount = particleCount;
+	return args;
+}
+
+cl_int setFieldArgs(cl_kernel kernel, cl_uint first, const FieldArgs& args)
+{
+	cl_int result = CL_SUCCESS;
+	if (args.volume)
+	{
+		result |= clSetKernelArg(kernel, first, sizeof(cl_mem), &args.field);
+		result |= clSetKernelArg(kernel, first + 1, sizeof(cl_int4), &args.size);
+		result |= clSetKernelArg(kernel, first + 2, sizeof(cl_float2), &args.scale);
+	}
+	else
+	{
+		result |= clSetKernelArg(kernel, first, sizeof(cl_int), &args.particleCount);
+		result |= clSetKernelArg(kernel, first + 1, sizeof(cl_mem), &args.field);
+		if (args.cellCounts != 0)
+		{
+			result |= clSetKernelArg(kernel, first + 2, sizeof(cl_mem), &args.cellCounts);
+			result |= clSetKernelArg(kernel, first + 3, sizeof(cl_mem), &args.cellParticles);
+			result |= clSetKernelArg(kernel, first + 4, sizeof(cl_int4), &args.cellGrid);
+			result |= clSetKernelArg(kernel, first + 5, sizeof(cl_float), &args.radius);
+		}
+	}
+	return result;
+}
+
+cl_program buildProgram(cl_context context, cl_device_id device, const char* options, const char* kernelPath)
+{
+	// load kernel code
+	char* sources[PROGRAM_FILE_COUNT] = { 0 };
+	size_t sizes[PROGRAM_FILE_COUNT] = { 0 };
+	bool loaded = true;
+	for (int i = 0; i < PROGRAM_FILE_COUNT && loaded; ++i)
+	{
+		std::string path = std::string(kernelPath != nullptr ? kernelPath : ".") + "/" + PROGRAM_FILES[i];
+		FILE* file = fopen(path.c_str(), "rb");
+		if (file == nullptr)
+		{
+			printf("Failed to load kernel file %s!\n", path.c_str());
+			loaded = false;
+			break;
+		}
+		fseek(file, 0, SEEK_END);
+		sizes[i] = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		sources[i] = new char[sizes[i]];
+		fread(sources[i], sizeof(char), sizes[i], file);
+		fclose(file);
+	}
+
+	cl_program program = 0;
+	cl_int result = CL_SUCCESS;
+	if (loaded)
+	{
+		program = clCreateProgramWithSource(context, PROGRAM_FILE_COUNT, (const char**)sources, sizes, &result);
+		CL_CHECK(result);
+	}
+	for (int i = 0; i < PROGRAM_FILE_COUNT; ++i)
+		delete[] sources[i];
+	if (program == 0)
+		return 0;
+
+	// build program
+	result = clBuildProgram(program, 1, &device, options, 0, 0);
+	if (result != CL_SUCCESS)
+	{
+		size_t len = 0;
+		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, 0, &len);
+		char* log = new char[len];
+		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, len, log, 0);
+		printf("Kernel error:\n%s\n", log);
+		delete[] log;
+
+		clReleaseProgram(program);
+		return 0;
+	}
+	return program;
+}
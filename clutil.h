@@ -0,0 +1,52 @@
+#pragma once
+
+#ifdef __APPLE__
+	#include <OpenCL/cl.h>
+#else
+	#include <CL/cl.h>
+#endif
+
+#include <stdio.h>
+
+#define CL_CHECK(result) if (result != CL_SUCCESS) { printf("Error: %i\n", result); }
+
+// returns true if the device advertises the named extension
+bool hasExtension(cl_device_id device, const char* extension);
+
+// release a handle unless it is 0 and zero it, so objects that were only partly
+// created (or already released) can be released again
+void releaseKernel(cl_kernel& kernel);
+void releaseMemObject(cl_mem& memObject);
+
+// field inputs that follow FIELD_PARAMS in field.cl: the buffer backed volume's
+// samples, size (w = 1) and scale/bias, or the metaball particles
+struct FieldArgs
+{
+	bool		volume;
+	cl_mem		field;			// samples or particles
+	cl_int4		size;
+	cl_float2	scale;
+	cl_int		particleCount;
+
+	// the FIELD_SPH particles' cell binning (see sph.h), cellCounts is 0 for metaballs
+	cl_mem		cellCounts;
+	cl_mem		cellParticles;
+	cl_int4		cellGrid;
+	cl_float	radius;
+};
+
+// a volume's arguments (size in samples, w = 1), the particle members zeroed
+FieldArgs volumeFieldArgs(cl_mem samples, cl_int4 size, cl_float2 scale);
+
+// the metaballs' arguments, the volume and fluid members zeroed
+FieldArgs particleFieldArgs(cl_mem particles, cl_int particleCount);
+
+// sets the field's kernel arguments starting at index first
+cl_int setFieldArgs(cl_kernel kernel, cl_uint first, const FieldArgs& args);
+
+// loads the kernel sources (field.cl, mc.cl and the extraction passes that build on
+// them) and builds them for a single device. options are passed straight to the
+// compiler, e.g. "-D FIELD_VOLUME" to select the buffer backed field. prints the
+// build log and returns 0 on failure. the sources are read from kernelPath, or the
+// working directory when it is nullptr.
+cl_program buildProgram(cl_context context, cl_device_id device, const char* options, const char* kernelPath = nullptr);
@@ -0,0 +1,461 @@
+#include "codec.h"
+
+#include <math.h>
+#include <string.h>
+#include <unordered_map>
+
+#define CODEC_POSITION_BITS 16
+#define CODEC_NORMAL_BITS 10
+
+// rANS with byte renormalisation, frequencies sum to 1 << RANS_SCALE_BITS
+#define RANS_SCALE_BITS 12
+#define RANS_LOWER (1u << 23)
+#define RANS_SYMBOLS 256
+
+// a block's fixed part, the streams follow
+struct BlockHeader
+{
+	cl_uint		faceCount;
+	cl_uint		vertexCount;
+	cl_float	minimum[3];
+	cl_float	step[3];		// quantization step per axis
+};
+
+// a stream's bytes before and after coding, coded as 0 when stored as is
+struct StreamHeader
+{
+	cl_uint		rawBytes;
+	cl_uint		codedBytes;
+};
+
+// the longest a varint of a cl_uint gets
+#define VARINT_MAX_BYTES 5
+
+static void putVarint(std::vector<unsigned char>& out, cl_uint value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((unsigned char)value);
+}
+
+static bool getVarint(const unsigned char*& in, const unsigned char* end, cl_uint& value)
+{
+	value = 0;
+	for (int shift = 0; shift < 35; shift += 7)
+	{
+		if (in == end)
+			return false;
+		unsigned char byte = *in++;
+		value |= (cl_uint)(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+static cl_uint zigzag(int value)
+{
+	return ((cl_uint)value << 1) ^ (cl_uint)(value >> 31);
+}
+
+static int unzigzag(cl_uint value)
+{
+	return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+// frequencies scaled to sum to 1 << RANS_SCALE_BITS, every byte present keeps at least 1
+static void normalizeFrequencies(const size_t* counts, size_t total, unsigned short* frequencies)
+{
+	const int scale = 1 << RANS_SCALE_BITS;
+	int sum = 0;
+	for (int s = 0; s < RANS_SYMBOLS; ++s)
+	{
+		frequencies[s] = 0;
+		if (counts[s] > 0)
+		{
+			size_t scaled = counts[s] * scale / total;
+			frequencies[s] = (unsigned short)(scaled > 0 ? scaled : 1);
+		}
+		sum += frequencies[s];
+	}
+
+	// rounding is settled on the most frequent bytes, which lose the least
+	while (sum != scale)
+	{
+		int largest = 0;
+		for (int s = 1; s < RANS_SYMBOLS; ++s)
+			if (frequencies[s] > frequencies[largest])
+				largest = s;
+		if (sum > scale && frequencies[largest] > 1)
+		{
+			--frequencies[largest];
+			--sum;
+		}
+		else
+		{
+			++frequencies[largest];
+			++sum;
+		}
+	}
+}
+
+// appends the stream, entropy coded unless that wouldn't make it smaller
+static void putStream(std::vector<char>& out, const std::vector<unsigned char>& raw)
+{
+	StreamHeader header = { (cl_uint)raw.size(), 0 };
+	std::vector<unsigned char> coded;
+	unsigned short frequencies[RANS_SYMBOLS];
+	if (!raw.empty())
+	{
+		size_t counts[RANS_SYMBOLS] = { 0 };
+		for (size_t i = 0; i < raw.size(); ++i)
+			++counts[raw[i]];
+		normalizeFrequencies(counts, raw.size(), frequencies);
+		cl_uint starts[RANS_SYMBOLS];
+		cl_uint start = 0;
+		for (int s = 0; s < RANS_SYMBOLS; ++s)
+		{
+			starts[s] = start;
+			start += frequencies[s];
+		}
+
+		// the coder runs backwards so the decoder reads forwards, 12 bits a byte at worst
+		coded.resize(raw.size() * 2 + 8);
+		unsigned char* end = coded.data() + coded.size();
+		unsigned char* p = end;
+		cl_uint x = RANS_LOWER;
+		for (size_t i = raw.size(); i-- > 0;)
+		{
+			cl_uint frequency = frequencies[raw[i]];
+			cl_uint limit = ((RANS_LOWER >> RANS_SCALE_BITS) << 8) * frequency;
+			while (x >= limit)
+			{
+				*--p = (unsigned char)(x & 0xff);
+				x >>= 8;
+			}
+			x = ((x / frequency) << RANS_SCALE_BITS) + (x % frequency) + starts[raw[i]];
+		}
+		p -= 4;
+		p[0] = (unsigned char)x;
+		p[1] = (unsigned char)(x >> 8);
+		p[2] = (unsigned char)(x >> 16);
+		p[3] = (unsigned char)(x >> 24);
+
+		size_t codedBytes = end - p;
+		if (codedBytes + sizeof(frequencies) < raw.size())
+		{
+			header.codedBytes = (cl_uint)codedBytes;
+			coded.erase(coded.begin(), coded.begin() + (p - coded.data()));
+		}
+	}
+
+	out.insert(out.end(), (const char*)&header, (const char*)(&header + 1));
+	if (header.codedBytes == 0)
+		out.insert(out.end(), raw.begin(), raw.end());
+	else
+	{
+		out.insert(out.end(), (const char*)frequencies, (const char*)(frequencies + RANS_SYMBOLS));
+		out.insert(out.end(), coded.begin(), coded.end());
+	}
+}
+
+// maxRawBytes is the most the block's header allows the stream to hold, nothing is
+// allocated for a stream claiming more
+static bool getStream(const char*& in, const char* end, size_t maxRawBytes, std::vector<unsigned char>& raw)
+{
+	StreamHeader header;
+	if ((size_t)(end - in) < sizeof(header))
+		return false;
+	memcpy(&header, in, sizeof(header));
+	in += sizeof(header);
+	if (header.rawBytes > maxRawBytes)
+		return false;
+	raw.resize(header.rawBytes);
+	if (header.codedBytes == 0)
+	{
+		if ((size_t)(end - in) < header.rawBytes)
+			return false;
+		memcpy(raw.data(), in, header.rawBytes);
+		in += header.rawBytes;
+		return true;
+	}
+
+	unsigned short frequencies[RANS_SYMBOLS];
+	if ((size_t)(end - in) < sizeof(frequencies) + header.codedBytes || header.codedBytes < 4)
+		return false;
+	memcpy(frequencies, in, sizeof(frequencies));
+	in += sizeof(frequencies);
+
+	// slot to byte, the frequencies must fill the scale exactly
+	static const cl_uint scale = 1 << RANS_SCALE_BITS;
+	unsigned char symbols[scale];
+	cl_uint starts[RANS_SYMBOLS];
+	cl_uint start = 0;
+	for (int s = 0; s < RANS_SYMBOLS; ++s)
+	{
+		starts[s] = start;
+		if (start + frequencies[s] > scale)
+			return false;
+		memset(symbols + start, s, frequencies[s]);
+		start += frequencies[s];
+	}
+	if (start != scale)
+		return false;
+
+	const unsigned char* p = (const unsigned char*)in;
+	const unsigned char* codedEnd = p + header.codedBytes;
+	cl_uint x = p[0] | (p[1] << 8) | (p[2] << 16) | ((cl_uint)p[3] << 24);
+	p += 4;
+	for (size_t i = 0; i < raw.size(); ++i)
+	{
+		cl_uint slot = x & (scale - 1);
+		unsigned char s = symbols[slot];
+		raw[i] = s;
+		x = frequencies[s] * (x >> RANS_SCALE_BITS) + slot - starts[s];
+		while (x < RANS_LOWER && p < codedEnd)
+			x = (x << 8) | *p++;
+	}
+	in += header.codedBytes;
+	return true;
+}
+
+static void encodeNormal(const cl_float* n, cl_uint* q)
+{
+	const float range = (float)((1 << CODEC_NORMAL_BITS) - 1);
+	float length = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+	float x = length > 0 ? n[0] / length : 0;
+	float y = length > 0 ? n[1] / length : 0;
+	if (length > 0 && n[2] < 0)
+	{
+		float folded = (1 - fabsf(y)) * (x >= 0 ? 1 : -1);
+		y = (1 - fabsf(x)) * (y >= 0 ? 1 : -1);
+		x = folded;
+	}
+	q[0] = (cl_uint)floorf((x * 0.5f + 0.5f) * range + 0.5f);
+	q[1] = (cl_uint)floorf((y * 0.5f + 0.5f) * range + 0.5f);
+}
+
+static cl_float4 decodeNormal(const int* q)
+{
+	const float range = (float)((1 << CODEC_NORMAL_BITS) - 1);
+	float x = q[0] / range * 2 - 1;
+	float y = q[1] / range * 2 - 1;
+	float z = 1 - fabsf(x) - fabsf(y);
+	if (z < 0)
+	{
+		float unfolded = (1 - fabsf(y)) * (x >= 0 ? 1 : -1);
+		y = (1 - fabsf(x)) * (y >= 0 ? 1 : -1);
+		x = unfolded;
+	}
+	float length = sqrtf(x * x + y * y + z * z);
+	cl_float4 n = { { x / length, y / length, z / length, 0 } };
+	return n;
+}
+
+// the most a block of faceCount faces can take, every stream is stored as is at worst
+static size_t maxBlockBytes(cl_uint faceCount)
+{
+	size_t cornerCount = (size_t)faceCount * 3;
+	return sizeof(BlockHeader) + 3 * sizeof(StreamHeader) + cornerCount * VARINT_MAX_BYTES * (1 + 3 + 2);
+}
+
+static void encodeBlock(const cl_float4* vertices, cl_uint faceCount, std::vector<char>& out)
+{
+	BlockHeader header = { faceCount, 0, { 0, 0, 0 }, { 0, 0, 0 } };
+	const float range = (float)((1 << CODEC_POSITION_BITS) - 1);
+	size_t cornerCount = (size_t)faceCount * 3;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float minimum = cornerCount > 0 ? vertices[0].s[axis] : 0;
+		float maximum = minimum;
+		for (size_t i = 1; i < cornerCount; ++i)
+		{
+			minimum = fminf(minimum, vertices[i * 2].s[axis]);
+			maximum = fmaxf(maximum, vertices[i * 2].s[axis]);
+		}
+		header.minimum[axis] = minimum;
+		header.step[axis] = (maximum - minimum) / range;
+	}
+
+	// corners that quantize to the same position and normal are one vertex
+	std::unordered_map<unsigned long long, cl_uint> welded;
+	std::vector<cl_uint> quantized;		// 5 per vertex, position then normal
+	std::vector<unsigned char> indexStream, positionStream, normalStream;
+	welded.reserve(cornerCount / 2);
+	for (size_t i = 0; i < cornerCount; ++i)
+	{
+		cl_uint q[5];
+		for (int axis = 0; axis < 3; ++axis)
+			q[axis] = header.step[axis] > 0 ?
+				(cl_uint)floorf((vertices[i * 2].s[axis] - header.minimum[axis]) / header.step[axis] + 0.5f) : 0;
+		encodeNormal(vertices[i * 2 + 1].s, q + 3);
+
+		unsigned long long key = q[0] | ((unsigned long long)q[1] << 16) | ((unsigned long long)q[2] << 32);
+		std::unordered_map<unsigned long long, cl_uint>::iterator found = welded.find(key);
+		if (found != welded.end() && memcmp(&quantized[found->second * 5 + 3], q + 3, sizeof(cl_uint) * 2) == 0)
+			putVarint(indexStream, header.vertexCount - found->second);
+		else
+		{
+			putVarint(indexStream, 0);
+			const cl_uint* previous = header.vertexCount > 0 ? &quantized[(header.vertexCount - 1) * 5] : nullptr;
+			for (int c = 0; c < 5; ++c)
+			{
+				int delta = (int)q[c] - (previous != nullptr ? (int)previous[c] : 0);
+				putVarint(c < 3 ? positionStream : normalStream, zigzag(delta));
+			}
+			quantized.insert(quantized.end(), q, q + 5);
+			welded[key] = header.vertexCount++;
+		}
+	}
+
+	std::vector<char> block;
+	block.insert(block.end(), (const char*)&header, (const char*)(&header + 1));
+	putStream(block, indexStream);
+	putStream(block, positionStream);
+	putStream(block, normalStream);
+
+	cl_uint blockBytes = (cl_uint)block.size();
+	out.insert(out.end(), (const char*)&blockBytes, (const char*)(&blockBytes + 1));
+	out.insert(out.end(), block.begin(), block.end());
+}
+
+void encodeMeshBlock(const cl_float4* vertices, cl_uint faceCount, std::vector<char>& out)
+{
+	for (cl_uint first = 0; first < faceCount; first += MESH_CODEC_BLOCK_FACES)
+	{
+		cl_uint count = faceCount - first < MESH_CODEC_BLOCK_FACES ? faceCount - first : MESH_CODEC_BLOCK_FACES;
+		encodeBlock(vertices + (size_t)first * 6, count, out);
+	}
+}
+
+void encodeMeshEnd(std::vector<char>& out)
+{
+	cl_uint blockBytes = 0;
+	out.insert(out.end(), (const char*)&blockBytes, (const char*)(&blockBytes + 1));
+}
+
+MeshDecoder::MeshDecoder()
+	: m_file(nullptr),
+	m_failed(false)
+{
+}
+
+MeshDecoder::~MeshDecoder()
+{
+	close();
+}
+
+bool MeshDecoder::open(const char* path)
+{
+	close();
+	m_failed = false;
+	m_file = fopen(path, "rb");
+	if (m_file == nullptr)
+	{
+		printf("Failed to open %s!\n", path);
+		return false;
+	}
+	char magic[4];
+	if (fread(magic, 1, 4, m_file) != 4 || memcmp(magic, MESH_CODEC_MAGIC, 4) != 0)
+	{
+		printf("%s is not a compressed mesh!\n", path);
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MeshDecoder::close()
+{
+	if (m_file != nullptr)
+		fclose(m_file);
+	m_file = nullptr;
+}
+
+bool MeshDecoder::next(MeshBlock& block)
+{
+	block.vertices.clear();
+	block.indices.clear();
+	cl_uint blockBytes = 0;
+	if (m_file == nullptr || m_failed || fread(&blockBytes, sizeof(blockBytes), 1, m_file) != 1 || blockBytes == 0)
+		return false;
+
+	// sizes in the file are checked against what the format allows before anything is
+	// allocated for them
+	BlockHeader header;
+	m_failed = blockBytes < sizeof(header) || blockBytes > maxBlockBytes(MESH_CODEC_BLOCK_FACES);
+	if (!m_failed)
+	{
+		m_block.resize(blockBytes);
+		m_failed = fread(m_block.data(), 1, blockBytes, m_file) != blockBytes;
+	}
+	if (!m_failed)
+	{
+		memcpy(&header, m_block.data(), sizeof(header));
+		m_failed = header.faceCount == 0 || header.faceCount > MESH_CODEC_BLOCK_FACES ||
+			header.vertexCount > header.faceCount * 3 || blockBytes > maxBlockBytes(header.faceCount);
+	}
+	if (m_failed)
+	{
+		printf("Compressed mesh is corrupt!\n");
+		return false;
+	}
+
+	const char* in = m_block.data() + sizeof(header);
+	const char* end = m_block.data() + m_block.size();
+	size_t cornerCount = (size_t)header.faceCount * 3;
+	size_t vertexCount = header.vertexCount;
+	std::vector<unsigned char> indexStream, positionStream, normalStream;
+	m_failed = !getStream(in, end, cornerCount * VARINT_MAX_BYTES, indexStream) ||
+		!getStream(in, end, vertexCount * 3 * VARINT_MAX_BYTES, positionStream) ||
+		!getStream(in, end, vertexCount * 2 * VARINT_MAX_BYTES, normalStream);
+
+	// vertices in the order they were numbered, each a delta from the one before
+	const unsigned char* positions = positionStream.data();
+	const unsigned char* positionsEnd = positions + positionStream.size();
+	const unsigned char* normals = normalStream.data();
+	const unsigned char* normalsEnd = normals + normalStream.size();
+	int q[5] = { 0, 0, 0, 0, 0 };
+	block.vertices.reserve((size_t)header.vertexCount * 2);
+	for (cl_uint v = 0; v < header.vertexCount && !m_failed; ++v)
+	{
+		for (int c = 0; c < 5 && !m_failed; ++c)
+		{
+			cl_uint delta = 0;
+			m_failed = c < 3 ? !getVarint(positions, positionsEnd, delta) : !getVarint(normals, normalsEnd, delta);
+			q[c] += unzigzag(delta);
+		}
+		cl_float4 position = { { header.minimum[0] + q[0] * header.step[0], header.minimum[1] + q[1] * header.step[1],
+			header.minimum[2] + q[2] * header.step[2], 1 } };
+		block.vertices.push_back(position);
+		block.vertices.push_back(decodeNormal(q + 3));
+	}
+
+	// a corner's code counts back from the newest vertex it could use
+	const unsigned char* indices = indexStream.data();
+	const unsigned char* indicesEnd = indices + indexStream.size();
+	cl_uint numbered = 0;
+	block.indices.reserve((size_t)header.faceCount * 3);
+	for (size_t i = 0; i < (size_t)header.faceCount * 3 && !m_failed; ++i)
+	{
+		cl_uint back = 0;
+		m_failed = !getVarint(indices, indicesEnd, back);
+		if (back == 0 && numbered < header.vertexCount)
+			block.indices.push_back(numbered++);
+		else if (back <= numbered && back > 0)
+			block.indices.push_back(numbered - back);
+		else
+			m_failed = true;
+	}
+
+	if (m_failed)
+	{
+		printf("Compressed mesh is corrupt!\n");
+		block.vertices.clear();
+		block.indices.clear();
+	}
+	return !m_failed;
+}
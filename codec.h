@@ -0,0 +1,54 @@
+#pragma once
+
+#include "clutil.h"
+
+#include <vector>
+
+// compact meshes for .mcz files. a file is the magic followed by independent blocks,
+// so it is written and read a block at a time. a block welds its triangle soup back
+// into an indexed mesh, numbering vertices in the order the faces first use them:
+//   indices    per corner 0 for the next new vertex, otherwise how far back its
+//              vertex was numbered
+//   positions  quantized to 16 bits within the block's bounds, delta coded
+//   normals    octahedral, 10 bits a component, delta coded
+// each stream is varint bytes entropy coded with a static rANS coder.
+#define MESH_CODEC_MAGIC "MCZ1"
+
+// faces a block holds at most, so a reader knows how much a block can make it allocate
+#define MESH_CODEC_BLOCK_FACES (1u << 20)
+
+// encodes faceCount faces of a soup (3 vertices per face, each a position and a normal
+// float4) as blocks appended to out, more than one past MESH_CODEC_BLOCK_FACES
+void encodeMeshBlock(const cl_float4* vertices, cl_uint faceCount, std::vector<char>& out);
+
+// bytes that end a file, a block of no faces
+void encodeMeshEnd(std::vector<char>& out);
+
+// a decoded block: its vertices (a position and a normal float4 each) and three
+// indices per face into them
+struct MeshBlock
+{
+	std::vector<cl_float4>	vertices;
+	std::vector<cl_uint>	indices;
+};
+
+// reads a .mcz file block by block, holding one block in memory
+class MeshDecoder
+{
+public:
+	MeshDecoder();
+	~MeshDecoder();
+
+	bool open(const char* path);
+	void close();
+
+	// the next block, false once the file ends or is found to be corrupt
+	bool next(MeshBlock& block);
+
+	bool failed() const { return m_failed; }
+
+private:
+	FILE*				m_file;
+	std::vector<char>	m_block;
+	bool				m_failed;
+};
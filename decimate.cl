@@ -0,0 +1,169 @@
+// mesh decimation by vertex clustering
+//
+// the space around a triangle soup is split into cubic cells and every vertex is
+// snapped to the average of the vertices sharing its cell. triangles whose corners
+// end up in fewer than 3 cells collapse and are dropped. cells live in an open
+// addressed hash table so only the occupied ones take memory, the cell size is
+// derived on the device from the number of faces kernelMC produced so the whole
+// pass runs without reading anything back.
+
+// ints per cluster: key, vertex count, position sum (xyz), normal sum (xyz)
+#define CLUSTER_INTS	8
+#define CLUSTER_EMPTY	(-1)
+
+// cells per axis a key can tell apart, matches decimate.cpp. cells are never smaller
+// than the grid's extent over this many.
+#define CLUSTER_AXIS_BITS	10
+#define CLUSTER_AXIS_CELLS	(1 << CLUSTER_AXIS_BITS)
+
+// sums are kept in fixed point, positions as offsets within their cell
+#define CLUSTER_SCALE	1024.0f
+
+// a cell's coordinates from the grid's origin, packed. the key is the cell itself so a
+// single cmpxchg decides which slot is the cell's. the sign bit is never set so a key
+// can't be mistaken for an empty slot.
+int clusterKey(int4 cell)
+{
+	return cell.x | (cell.y << CLUSTER_AXIS_BITS) | (cell.z << (2 * CLUSTER_AXIS_BITS));
+}
+
+int4 clusterCell(int key)
+{
+	int mask = CLUSTER_AXIS_CELLS - 1;
+	return (int4)(key & mask, (key >> CLUSTER_AXIS_BITS) & mask, (key >> (2 * CLUSTER_AXIS_BITS)) & mask, 0);
+}
+
+uint clusterHash(int key, uint mask)
+{
+	uint h = (uint)key * 0x9e3779b1u;
+	return (h ^ (h >> 15)) & mask;
+}
+
+// picks the cell size for this mesh and resets the output counter. faces shrink with
+// the square of the cell size, the size is the larger of what reaches the budget and
+// the tolerance. both are in cubes, a_cubeSize turns them into the vertices' units.
+// a_minCellSize, in those units, keeps the grid within the cells a key can hold.
+kernel void kernelDecimateSetup(global const uint* a_faceCount,
+								uint a_maxFaces,
+								uint a_targetFaces,
+								float a_tolerance,
+								float a_cubeSize,
+								float a_minCellSize,
+								global float* a_cellSize,
+								global uint* a_outputFaceCount)
+{
+	uint faceCount = min(*a_faceCount, a_maxFaces);
+	float cellSize = a_tolerance;
+	if (a_targetFaces > 0)
+		cellSize = max(cellSize, sqrt((float)faceCount / a_targetFaces));
+
+	*a_cellSize = max(max(cellSize, 1.0f) * a_cubeSize, a_minCellSize);
+	*a_outputFaceCount = 0;
+}
+
+kernel void kernelDecimateClear(global int* a_clusters)
+{
+	global int* cluster = a_clusters + get_global_id(0) * CLUSTER_INTS;
+	vstore8((int8)(CLUSTER_EMPTY, 0, 0, 0, 0, 0, 0, 0), 0, cluster);
+}
+
+// one work-item per input vertex, adds it to its cell's cluster and remembers which
+// cluster that was
+kernel void kernelDecimateCluster(global const float4* a_vertices,
+								  global const uint* a_faceCount,
+								  uint a_maxFaces,
+								  float4 a_origin,
+								  global const float* a_cellSize,
+								  global int* a_clusters,
+								  uint a_clusterMask,
+								  global uint* a_vertexClusters)
+{
+	uint vertex = get_global_id(0);
+	if (vertex >= min(*a_faceCount, a_maxFaces) * 3)
+		return;
+
+	// vertices lie within the grid, the clamp only catches rounding at its far faces
+	float cellSize = *a_cellSize;
+	float4 position = (a_vertices[vertex * 2] - a_origin) / cellSize;
+	float4 normal = a_vertices[vertex * 2 + 1];
+	int4 cell = clamp(convert_int4_rtn(position), 0, CLUSTER_AXIS_CELLS - 1);
+	float4 cellCorner = convert_float4(cell);
+	int key = clusterKey(cell);
+
+	// the table holds at least one slot per vertex, probing always ends. a slot holding
+	// the key is the cell's whoever put it there, nobody waits on anybody.
+	uint slot = clusterHash(key, a_clusterMask);
+	for (;;)
+	{
+		int previous = atomic_cmpxchg(a_clusters + slot * CLUSTER_INTS, CLUSTER_EMPTY, key);
+		if (previous == CLUSTER_EMPTY || previous == key)
+			break;
+		slot = (slot + 1) & a_clusterMask;
+	}
+
+	int4 offset = convert_int4_rtn((position - cellCorner) * CLUSTER_SCALE);
+	int4 direction = convert_int4_rte(normal * CLUSTER_SCALE);
+	global int* cluster = a_clusters + slot * CLUSTER_INTS;
+	atomic_inc(cluster + 1);
+	atomic_add(cluster + 2, offset.x);
+	atomic_add(cluster + 3, offset.y);
+	atomic_add(cluster + 4, offset.z);
+	atomic_add(cluster + 5, direction.x);
+	atomic_add(cluster + 6, direction.y);
+	atomic_add(cluster + 7, direction.z);
+
+	a_vertexClusters[vertex] = slot;
+}
+
+// average position and normal of a cluster
+void clusterVertex(global const int* cluster, float4 origin, float cellSize, float4* position, float4* normal)
+{
+	int count = cluster[1];
+	int4 cell = clusterCell(cluster[0]);
+	float4 offset = convert_float4((int4)(cluster[2], cluster[3], cluster[4], 0)) / (CLUSTER_SCALE * count);
+	*position = origin + (convert_float4(cell) + offset) * cellSize;
+	position->w = 1;
+
+	*normal = convert_float4((int4)(cluster[5], cluster[6], cluster[7], 0));
+	if (dot(*normal, *normal) > 0)
+		*normal = normalize(*normal);
+}
+
+// one work-item per input face, emits it with its corners moved to their clusters
+// unless two of them merged
+kernel void kernelDecimateEmit(global const uint* a_vertexClusters,
+							   global const uint* a_faceCount,
+							   uint a_maxFaces,
+							   float4 a_origin,
+							   global const float* a_cellSize,
+							   global const int* a_clusters,
+							   int a_maxOutputFaces,
+							   global uint* a_outputFaceCount,
+							   global float4* a_output)
+{
+	uint face = get_global_id(0);
+	if (face >= min(*a_faceCount, a_maxFaces))
+		return;
+
+	uint a = a_vertexClusters[face * 3];
+	uint b = a_vertexClusters[face * 3 + 1];
+	uint c = a_vertexClusters[face * 3 + 2];
+	if (a == b || b == c || a == c)
+		return;
+
+	uint outputFace = atomic_inc(a_outputFaceCount);
+	if (outputFace >= a_maxOutputFaces)
+		return;
+
+	float cellSize = *a_cellSize;
+	float4 position, normal;
+	clusterVertex(a_clusters + a * CLUSTER_INTS, a_origin, cellSize, &position, &normal);
+	a_output[outputFace * 6] = position;
+	a_output[outputFace * 6 + 1] = normal;
+	clusterVertex(a_clusters + b * CLUSTER_INTS, a_origin, cellSize, &position, &normal);
+	a_output[outputFace * 6 + 2] = position;
+	a_output[outputFace * 6 + 3] = normal;
+	clusterVertex(a_clusters + c * CLUSTER_INTS, a_origin, cellSize, &position, &normal);
+	a_output[outputFace * 6 + 4] = position;
+	a_output[outputFace * 6 + 5] = normal;
+}
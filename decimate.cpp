@@ -0,0 +1,112 @@
+#include "decimate.h"
+
+// ints per cluster and cells per axis, match decimate.cl
+#define CLUSTER_INTS 8
+#define CLUSTER_AXIS_CELLS 1024
+
+bool createDecimator(Decimator& decimator, cl_context context, cl_program program, cl_uint maxFaces)
+{
+	cl_int result = CL_SUCCESS;
+	decimator.setup = clCreateKernel(program, "kernelDecimateSetup", &result);
+	CL_CHECK(result);
+	decimator.clear = clCreateKernel(program, "kernelDecimateClear", &result);
+	CL_CHECK(result);
+	decimator.cluster = clCreateKernel(program, "kernelDecimateCluster", &result);
+	CL_CHECK(result);
+	decimator.emit = clCreateKernel(program, "kernelDecimateEmit", &result);
+	CL_CHECK(result);
+
+	// every vertex can land in its own cell, a power of two at least that large keeps
+	// probing bounded and lets the hash wrap with a mask
+	decimator.maxFaces = maxFaces;
+	decimator.clusterCount = 1;
+	while (decimator.clusterCount < maxFaces * 3)
+		decimator.clusterCount <<= 1;
+
+	decimator.clusters = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_int) * CLUSTER_INTS * decimator.clusterCount, nullptr, &result);
+	CL_CHECK(result);
+	decimator.vertexClusters = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * 3 * maxFaces, nullptr, &result);
+	CL_CHECK(result);
+	decimator.cellSize = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_float), nullptr, &result);
+	CL_CHECK(result);
+
+	bool created = decimator.setup != 0 && decimator.clear != 0 && decimator.cluster != 0 && decimator.emit != 0 &&
+		decimator.clusters != 0 && decimator.vertexClusters != 0 && decimator.cellSize != 0;
+	if (!created)
+		releaseDecimator(decimator);
+	return created;
+}
+
+void releaseDecimator(Decimator& decimator)
+{
+	releaseMemObject(decimator.cellSize);
+	releaseMemObject(decimator.vertexClusters);
+	releaseMemObject(decimator.clusters);
+	releaseKernel(decimator.emit);
+	releaseKernel(decimator.cluster);
+	releaseKernel(decimator.clear);
+	releaseKernel(decimator.setup);
+}
+
+cl_int enqueueDecimate(Decimator& decimator, cl_command_queue queue, const DecimateSettings& settings,
+	const size_t* gridSize, cl_float4 origin, cl_float4 spacing, cl_mem vertices, cl_mem faceCount, cl_mem output,
+	cl_uint maxOutputFaces, cl_mem outputFaceCount, cl_uint waitCount, const cl_event* waitEvents, cl_event* event)
+{
+	// the kernels see the real face count only on the device, they are launched for
+	// the capacity and idle past the end
+	size_t setupSize = 1;
+	size_t clusterSize = decimator.clusterCount;
+	size_t vertexSize = decimator.maxFaces * 3;
+	size_t faceSize = decimator.maxFaces;
+	cl_uint clusterMask = decimator.clusterCount - 1;
+	cl_int maxOutput = (cl_int)maxOutputFaces;
+
+	// cells are sized in cubes of the mean spacing, and never so small that the grid
+	// takes more cells along an axis than a cluster's key can number
+	cl_float cubeSize = (spacing.s[0] + spacing.s[1] + spacing.s[2]) / 3;
+	cl_float minCellSize = 0;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		cl_float extent = gridSize[axis] * spacing.s[axis] / (CLUSTER_AXIS_CELLS - 1);
+		minCellSize = extent > minCellSize ? extent : minCellSize;
+	}
+
+	cl_int result = clSetKernelArg(decimator.setup, 0, sizeof(cl_mem), &faceCount);
+	result |= clSetKernelArg(decimator.setup, 1, sizeof(cl_uint), &decimator.maxFaces);
+	result |= clSetKernelArg(decimator.setup, 2, sizeof(cl_uint), &settings.targetFaces);
+	result |= clSetKernelArg(decimator.setup, 3, sizeof(cl_float), &settings.tolerance);
+	result |= clSetKernelArg(decimator.setup, 4, sizeof(cl_float), &cubeSize);
+	result |= clSetKernelArg(decimator.setup, 5, sizeof(cl_float), &minCellSize);
+	result |= clSetKernelArg(decimator.setup, 6, sizeof(cl_mem), &decimator.cellSize);
+	result |= clSetKernelArg(decimator.setup, 7, sizeof(cl_mem), &outputFaceCount);
+
+	result |= clSetKernelArg(decimator.clear, 0, sizeof(cl_mem), &decimator.clusters);
+
+	result |= clSetKernelArg(decimator.cluster, 0, sizeof(cl_mem), &vertices);
+	result |= clSetKernelArg(decimator.cluster, 1, sizeof(cl_mem), &faceCount);
+	result |= clSetKernelArg(decimator.cluster, 2, sizeof(cl_uint), &decimator.maxFaces);
+	result |= clSetKernelArg(decimator.cluster, 3, sizeof(cl_float4), &origin);
+	result |= clSetKernelArg(decimator.cluster, 4, sizeof(cl_mem), &decimator.cellSize);
+	result |= clSetKernelArg(decimator.cluster, 5, sizeof(cl_mem), &decimator.clusters);
+	result |= clSetKernelArg(decimator.cluster, 6, sizeof(cl_uint), &clusterMask);
+	result |= clSetKernelArg(decimator.cluster, 7, sizeof(cl_mem), &decimator.vertexClusters);
+
+	result |= clSetKernelArg(decimator.emit, 0, sizeof(cl_mem), &decimator.vertexClusters);
+	result |= clSetKernelArg(decimator.emit, 1, sizeof(cl_mem), &faceCount);
+	result |= clSetKernelArg(decimator.emit, 2, sizeof(cl_uint), &decimator.maxFaces);
+	result |= clSetKernelArg(decimator.emit, 3, sizeof(cl_float4), &origin);
+	result |= clSetKernelArg(decimator.emit, 4, sizeof(cl_mem), &decimator.cellSize);
+	result |= clSetKernelArg(decimator.emit, 5, sizeof(cl_mem), &decimator.clusters);
+	result |= clSetKernelArg(decimator.emit, 6, sizeof(cl_int), &maxOutput);
+	result |= clSetKernelArg(decimator.emit, 7, sizeof(cl_mem), &outputFaceCount);
+	result |= clSetKernelArg(decimator.emit, 8, sizeof(cl_mem), &output);
+	CL_CHECK(result);
+
+	// in order queue, only the first launch needs the caller's events
+	result = clEnqueueNDRangeKernel(queue, decimator.setup, 1, 0, &setupSize, 0, waitCount, waitEvents, 0);
+	result |= clEnqueueNDRangeKernel(queue, decimator.clear, 1, 0, &clusterSize, 0, 0, nullptr, 0);
+	result |= clEnqueueNDRangeKernel(queue, decimator.cluster, 1, 0, &vertexSize, 0, 0, nullptr, 0);
+	result |= clEnqueueNDRangeKernel(queue, decimator.emit, 1, 0, &faceSize, 0, 0, nullptr, event);
+	CL_CHECK(result);
+	return result;
+}
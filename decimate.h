@@ -0,0 +1,39 @@
+#pragma once
+
+#include "clutil.h"
+
+// on-device simplification of kernelMC's triangle soup by vertex clustering, meant
+// for previews where fewer triangles matter more than fidelity. the face count is
+// read on the device, nothing comes back to the host between marching and drawing.
+struct DecimateSettings
+{
+	cl_uint		targetFaces;	// rough face budget, 0 for none
+	cl_float	tolerance;		// smallest cell edge in cubes, vertices move at most a cell diagonal
+};
+
+struct Decimator
+{
+	cl_kernel	setup;
+	cl_kernel	clear;
+	cl_kernel	cluster;
+	cl_kernel	emit;
+
+	cl_mem		clusters;		// hash table of cells, one slot per possible vertex
+	cl_mem		vertexClusters;	// cluster of every input vertex
+	cl_mem		cellSize;
+	cl_uint		clusterCount;
+	cl_uint		maxFaces;
+};
+
+// sizes the decimator for meshes of up to maxFaces, the kernels come from a program
+// made by buildProgram. on failure whatever was created is released again.
+bool createDecimator(Decimator& decimator, cl_context context, cl_program program, cl_uint maxFaces);
+void releaseDecimator(Decimator& decimator);
+
+// decimates the faceCount (a device counter, as written by kernelMC) faces in vertices
+// into output, which holds up to maxOutputFaces. outputFaceCount receives the number
+// of faces emitted and may exceed maxOutputFaces in the same way kernelMC's does.
+// gridSize (in cubes), origin and spacing are the grid's the vertices were marched on.
+cl_int enqueueDecimate(Decimator& decimator, cl_command_queue queue, const DecimateSettings& settings,
+	const size_t* gridSize, cl_float4 origin, cl_float4 spacing, cl_mem vertices, cl_mem faceCount, cl_mem output,
+	cl_uint maxOutputFaces, cl_mem outputFaceCount, cl_uint waitCount, const cl_event* waitEvents, cl_event* event);
@@ -0,0 +1,105 @@
+// shared edge marching cubes
+//
+// kernelMC interpolates every crossed edge, and takes its six sample normal, once for
+// each of the up to four cubes around it. here a first pass gives every crossed
+// lattice edge its vertex once, indexed by the edge, and a second marches the cubes
+// into triangles of those vertices' indices. the mesh comes out indexed, the triangles
+// are kernelMC's.
+
+#define EDGES_NO_VERTEX	(-1)
+
+// first of the three edges (x, y, z) leaving the sample at p
+size_t edgesSampleIndex(int4 p, int4 sampleSize)
+{
+	return 3 * (p.x + sampleSize.x * ((size_t)p.y + (size_t)sampleSize.y * p.z));
+}
+
+// one work-item per sample, gives the crossed edges leaving it a vertex each.
+// a_edgeVertices receives the vertex of every edge, EDGES_NO_VERTEX for those the
+// surface misses (or when a_maxVertices is exceeded). vertices are placed in world
+// space like kernelMC's.
+kernel void kernelEdgesVertices(float a_threshold,
+								int a_maxVertices,
+								global uint* a_vertexCount,
+								global float4* a_vertices,
+								global int* a_edgeVertices,
+								float4 a_origin,
+								float4 a_spacing,
+								FIELD_PARAMS)
+{
+	int4 p = (int4)(get_global_id(0), get_global_id(1), get_global_id(2), 0);
+	int4 sampleSize = (int4)(get_global_size(0), get_global_size(1), get_global_size(2), 1);
+	float4 corner = convert_float4(p);
+	float cornerVolume = sampleCorner(corner, FIELD_ARGS);
+
+	// crossings are counted first so the work-item reserves its vertices at once
+	float endVolumes[3];
+	int crossed[3];
+	int crossings = 0;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		int4 step = (int4)(axis == 0, axis == 1, axis == 2, 0);
+		crossed[axis] = 0;
+		if (any((p + step).xyz >= sampleSize.xyz))
+			continue;
+		endVolumes[axis] = sampleCorner(corner + convert_float4(step), FIELD_ARGS);
+		crossed[axis] = (cornerVolume <= a_threshold) != (endVolumes[axis] <= a_threshold);
+		crossings += crossed[axis];
+	}
+
+	uint index = crossings > 0 ? atomic_add(a_vertexCount, crossings) : 0;
+	size_t first = edgesSampleIndex(p, sampleSize);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		int vertex = EDGES_NO_VERTEX;
+		if (crossed[axis] && index < a_maxVertices)
+		{
+			float4 step = (float4)(axis == 0, axis == 1, axis == 2, 0);
+			float4 position = corner + step * ((a_threshold - cornerVolume) / (endVolumes[axis] - cornerVolume));
+			position.w = 1.0f;
+			a_vertices[index * 2] = worldPosition(position, a_origin, a_spacing);
+			a_vertices[index * 2 + 1] = worldNormal(fieldNormal(position, FIELD_ARGS), a_spacing);
+			vertex = index;
+		}
+		index += crossed[axis];
+		a_edgeVertices[first + axis] = vertex;
+	}
+}
+
+// one work-item per cube, writes the cube's triangles as indices of its edges'
+// vertices. faces are reserved like kernelMC's, a triangle whose edge got no vertex
+// (a_maxVertices was exceeded) is written degenerate.
+kernel void kernelEdgesFaces(float a_threshold,
+							 int a_maxFaces,
+							 global uint* a_faceCount,
+							 global uint* a_indices,
+							 global const int* a_edgeVertices,
+							 FIELD_PARAMS)
+{
+	int4 cube = (int4)(get_global_id(0), get_global_id(1), get_global_id(2), 0);
+	int4 sampleSize = (int4)(get_global_size(0) + 1, get_global_size(1) + 1, get_global_size(2) + 1, 1);
+	float4 cubeCorner = convert_float4(cube);
+
+	float cornerVolumes[8];
+	sampleCube(cubeCorner, cornerVolumes, FIELD_ARGS);
+	int flagIndex = cubeFlags(cornerVolumes, a_threshold);
+	int faces = cubeFaces(flagIndex);
+	uint firstFace = reserveFaces(a_faceCount, faces);
+
+	for (int triangleIndex = 0; triangleIndex < faces; ++triangleIndex)
+	{
+		uint face = firstFace + triangleIndex;
+		if (face >= a_maxFaces)
+			break;
+
+		int vertices[3];
+		for (int triangleVertex = 0; triangleVertex < 3; ++triangleVertex)
+		{
+			int4 edge = LATTICE_EDGES[ TRIANGLE_TABLE[ flagIndex ][ 3 * triangleIndex + triangleVertex ] ];
+			vertices[triangleVertex] = a_edgeVertices[ edgesSampleIndex(cube + (int4)(edge.xyz, 0), sampleSize) + edge.w ];
+		}
+		if (vertices[0] == EDGES_NO_VERTEX || vertices[1] == EDGES_NO_VERTEX || vertices[2] == EDGES_NO_VERTEX)
+			vertices[0] = vertices[1] = vertices[2] = 0;
+		vstore3((uint3)(vertices[0], vertices[1], vertices[2]), face, a_indices);
+	}
+}
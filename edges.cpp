@@ -0,0 +1,89 @@
+#include "edges.h"
+#include "nets.h"
+
+bool createSharedEdges(SharedEdges& edges, cl_context context, cl_program program, const size_t* gridSize, cl_uint maxFaces)
+{
+	cl_int result = CL_SUCCESS;
+	edges.vertices = clCreateKernel(program, "kernelEdgesVertices", &result);
+	CL_CHECK(result);
+	edges.faces = clCreateKernel(program, "kernelEdgesFaces", &result);
+	CL_CHECK(result);
+	edges.expand = clCreateKernel(program, "kernelNetsExpand", &result);
+	CL_CHECK(result);
+
+	for (int axis = 0; axis < 3; ++axis)
+		edges.gridSize[axis] = gridSize[axis];
+	edges.maxVertices = maxFaces;
+	edges.maxFaces = maxFaces;
+
+	size_t sampleCount = (gridSize[0] + 1) * (gridSize[1] + 1) * (gridSize[2] + 1);
+	edges.edgeVertices = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_int) * 3 * sampleCount, nullptr, &result);
+	CL_CHECK(result);
+	edges.vertexCount = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), nullptr, &result);
+	CL_CHECK(result);
+	edges.meshVertices = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_float4) * 2 * edges.maxVertices, nullptr, &result);
+	CL_CHECK(result);
+	edges.meshIndices = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * 3 * maxFaces, nullptr, &result);
+	CL_CHECK(result);
+
+	bool created = edges.vertices != 0 && edges.faces != 0 && edges.expand != 0 && edges.edgeVertices != 0 &&
+		edges.vertexCount != 0 && edges.meshVertices != 0 && edges.meshIndices != 0;
+	if (!created)
+		releaseSharedEdges(edges);
+	return created;
+}
+
+void releaseSharedEdges(SharedEdges& edges)
+{
+	releaseMemObject(edges.meshIndices);
+	releaseMemObject(edges.meshVertices);
+	releaseMemObject(edges.vertexCount);
+	releaseMemObject(edges.edgeVertices);
+	releaseKernel(edges.expand);
+	releaseKernel(edges.faces);
+	releaseKernel(edges.vertices);
+}
+
+cl_int enqueueSharedEdges(SharedEdges& edges, cl_command_queue queue, cl_float threshold,
+	cl_float4 origin, cl_float4 spacing, cl_mem vertices, cl_mem indices, cl_mem faceCount,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event)
+{
+	static const cl_uint zero = 0;
+	cl_int maxVertices = (cl_int)edges.maxVertices;
+	cl_int maxFaces = (cl_int)edges.maxFaces;
+
+	cl_int result = clSetKernelArg(edges.vertices, 0, sizeof(cl_float), &threshold);
+	result |= clSetKernelArg(edges.vertices, 1, sizeof(cl_int), &maxVertices);
+	result |= clSetKernelArg(edges.vertices, 2, sizeof(cl_mem), &edges.vertexCount);
+	result |= clSetKernelArg(edges.vertices, 3, sizeof(cl_mem), &vertices);
+	result |= clSetKernelArg(edges.vertices, 4, sizeof(cl_mem), &edges.edgeVertices);
+	result |= clSetKernelArg(edges.vertices, 5, sizeof(cl_float4), &origin);
+	result |= clSetKernelArg(edges.vertices, 6, sizeof(cl_float4), &spacing);
+
+	result |= clSetKernelArg(edges.faces, 0, sizeof(cl_float), &threshold);
+	result |= clSetKernelArg(edges.faces, 1, sizeof(cl_int), &maxFaces);
+	result |= clSetKernelArg(edges.faces, 2, sizeof(cl_mem), &faceCount);
+	result |= clSetKernelArg(edges.faces, 3, sizeof(cl_mem), &indices);
+	result |= clSetKernelArg(edges.faces, 4, sizeof(cl_mem), &edges.edgeVertices);
+	CL_CHECK(result);
+
+	// in order queue, only the first command needs the caller's events. every edge has
+	// its vertex before any cube looks it up.
+	size_t sampleSize[3] = { edges.gridSize[0] + 1, edges.gridSize[1] + 1, edges.gridSize[2] + 1 };
+	result = clEnqueueWriteBuffer(queue, edges.vertexCount, CL_FALSE, 0, sizeof(cl_uint), &zero, waitCount, waitEvents, 0);
+	result |= clEnqueueNDRangeKernel(queue, edges.vertices, 3, 0, sampleSize, 0, 0, nullptr, 0);
+	result |= clEnqueueNDRangeKernel(queue, edges.faces, 3, 0, edges.gridSize, 0, 0, nullptr, event);
+	CL_CHECK(result);
+	return result;
+}
+
+cl_int enqueueSharedEdgesSoup(SharedEdges& edges, cl_command_queue queue, cl_float threshold,
+	cl_float4 origin, cl_float4 spacing, cl_mem output, cl_mem faceCount,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event)
+{
+	cl_int result = enqueueSharedEdges(edges, queue, threshold, origin, spacing, edges.meshVertices, edges.meshIndices, faceCount,
+		waitCount, waitEvents, 0);
+	result |= enqueueExpandFaces(edges.expand, queue, edges.meshVertices, edges.meshIndices, faceCount, edges.maxFaces, output,
+		0, nullptr, event);
+	return result;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "clutil.h"
+
+// shared edge marching cubes, kernelMC's triangles with every crossed lattice edge's
+// vertex (position and normal) computed once instead of once per cube around it. the
+// mesh is indexed like a surface net's: vertices are a position and a normal float4
+// and faces are three uint indices.
+struct SharedEdges
+{
+	cl_kernel	vertices;
+	cl_kernel	faces;
+	cl_kernel	expand;
+
+	cl_mem		edgeVertices;	// vertex of every lattice edge, three per sample
+	cl_mem		vertexCount;
+	cl_mem		meshVertices;	// scratch mesh for enqueueSharedEdgesSoup
+	cl_mem		meshIndices;
+
+	size_t		gridSize[3];
+	cl_uint		maxVertices;
+	cl_uint		maxFaces;
+};
+
+// kernel arguments from this index on are the field's, see setFieldArgs
+#define EDGES_VERTICES_FIELD_ARG 7
+#define EDGES_FACES_FIELD_ARG 5
+
+// sizes the edge map for a grid and meshes of up to maxFaces triangles (and as many
+// vertices, a closed surface has about half that), the kernels come from a program
+// made by buildProgram
+bool createSharedEdges(SharedEdges& edges, cl_context context, cl_program program, const size_t* gridSize, cl_uint maxFaces);
+void releaseSharedEdges(SharedEdges& edges);
+
+// extracts the mesh into vertices and indices (a GL element buffer works), counting
+// triangles into faceCount which the caller zeroes as it would for kernelMC. the field
+// arguments must already be set on the vertices and faces kernels. vertices are
+// placed in the world space of origin and spacing, see volumeOrigin.
+cl_int enqueueSharedEdges(SharedEdges& edges, cl_command_queue queue, cl_float threshold,
+	cl_float4 origin, cl_float4 spacing, cl_mem vertices, cl_mem indices, cl_mem faceCount,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event);
+
+// extracts the mesh into the scratch mesh and expands it into a triangle soup laid out
+// like kernelMC's output, for the decimator and the exporters
+cl_int enqueueSharedEdgesSoup(SharedEdges& edges, cl_command_queue queue, cl_float threshold,
+	cl_float4 origin, cl_float4 spacing, cl_mem output, cl_mem faceCount,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event);
@@ -0,0 +1,599 @@
+#include "engine.h"
+
+VolumeSource::VolumeSource(const Volume& volume, VolumeStorage storage)
+	: m_volume(volume),
+	m_storage(storage),
+	m_buffer(0)
+{
+}
+
+VolumeSource::~VolumeSource()
+{
+	unbind();
+}
+
+const char* VolumeSource::buildOptions() const
+{
+	return volumeBuildOptions(m_volume, m_storage);
+}
+
+void VolumeSource::gridSize(size_t* size) const
+{
+	for (int axis = 0; axis < 3; ++axis)
+		size[axis] = m_volume.size[axis] - 1;
+}
+
+void VolumeSource::worldTransform(cl_float4& origin, cl_float4& spacing) const
+{
+	origin = volumeOrigin(m_volume);
+	spacing = volumeSpacing(m_volume);
+}
+
+bool VolumeSource::bind(cl_context context, cl_device_id device, cl_command_queue, FieldArgs& args)
+{
+	// wrapping the mapping is cheap, the buffer only lives for one march. bricks and
+	// images are copies, made again for every march.
+	cl_int result = CL_SUCCESS;
+	m_buffer = createVolumeField(context, device, m_volume, m_storage, &result);
+	if (m_buffer == 0)
+		return false;
+
+	args.volume = true;
+	args.field = m_buffer;
+	for (int axis = 0; axis < 3; ++axis)
+		args.size.s[axis] = (cl_int)m_volume.size[axis];
+	args.size.s[3] = 1;
+	args.scale = volumeNormalization(m_volume, m_storage);
+	args.particleCount = 0;
+	return true;
+}
+
+void VolumeSource::unbind()
+{
+	if (m_buffer != 0)
+		clReleaseMemObject(m_buffer);
+	m_buffer = 0;
+}
+
+ParticleSource::ParticleSource(size_t x, size_t y, size_t z)
+	: m_context(0),
+	m_buffer(0),
+	m_capacity(0)
+{
+	m_gridSize[0] = x;
+	m_gridSize[1] = y;
+	m_gridSize[2] = z;
+}
+
+ParticleSource::~ParticleSource()
+{
+	if (m_buffer != 0)
+		clReleaseMemObject(m_buffer);
+}
+
+void ParticleSource::gridSize(size_t* size) const
+{
+	for (int axis = 0; axis < 3; ++axis)
+		size[axis] = m_gridSize[axis];
+}
+
+bool ParticleSource::bind(cl_context context, cl_device_id, cl_command_queue queue, FieldArgs& args)
+{
+	cl_int result = CL_SUCCESS;
+	size_t count = particles.empty() ? 1 : particles.size();
+	if (m_buffer == 0 || m_context != context || m_capacity < count)
+	{
+		if (m_buffer != 0)
+			clReleaseMemObject(m_buffer);
+		m_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(cl_float4) * count, nullptr, &result);
+		CL_CHECK(result);
+		m_context = context;
+		m_capacity = m_buffer != 0 ? count : 0;
+		if (m_buffer == 0)
+			return false;
+	}
+
+	// the kernel runs after the write on the same queue, the particles may change once
+	// the march returns
+	if (!particles.empty())
+	{
+		result = clEnqueueWriteBuffer(queue, m_buffer, CL_FALSE, 0, sizeof(cl_float4) * particles.size(), particles.data(), 0, nullptr, 0);
+		CL_CHECK(result);
+	}
+
+	args.volume = false;
+	args.field = m_buffer;
+	args.particleCount = (cl_int)particles.size();
+	return result == CL_SUCCESS;
+}
+
+bool HostMeshSink::consume(cl_command_queue queue, cl_mem source, cl_uint firstFace, cl_uint faceCount)
+{
+	vertices.resize((size_t)faceCount * 6);
+	if (faceCount == 0)
+		return true;
+	cl_int result = clEnqueueReadBuffer(queue, source, CL_TRUE, sizeof(cl_float4) * 6 * firstFace, sizeof(cl_float4) * 6 * faceCount,
+		vertices.data(), 0, nullptr, 0);
+	CL_CHECK(result);
+	return result == CL_SUCCESS;
+}
+
+bool WriterMeshSink::consume(cl_command_queue queue, cl_mem vertices, cl_uint firstFace, cl_uint faceCount)
+{
+	return m_writer.write(queue, vertices, faceCount, 0, nullptr, firstFace);
+}
+
+MarchingCubesEngine::MarchingCubesEngine()
+	: m_context(0),
+	m_device(0),
+	m_queue(0),
+	m_vertices(0),
+	m_faceCountLink(0),
+	m_capacity(0),
+	m_maxFaces(4 * 1024 * 1024),
+	m_faceCount(0),
+	m_tuning(nullptr),
+	m_pendingJobs(0)
+{
+}
+
+MarchingCubesEngine::~MarchingCubesEngine()
+{
+	shutdown();
+}
+
+bool MarchingCubesEngine::init(cl_device_type deviceType, const char* kernelPath, cl_command_queue_properties properties)
+{
+	cl_platform_id platform;
+	cl_int result = clGetPlatformIDs(1, &platform, 0);
+	CL_CHECK(result);
+	cl_device_id device = 0;
+	if (result == CL_SUCCESS)
+	{
+		result = clGetDeviceIDs(platform, deviceType, 1, &device, 0);
+		CL_CHECK(result);
+	}
+	if (result != CL_SUCCESS)
+		return false;
+
+	cl_context context = clCreateContext(nullptr, 1, &device, 0, 0, &result);
+	CL_CHECK(result);
+	if (context == 0)
+		return false;
+
+	bool initialised = init(context, device, kernelPath, properties);
+	clReleaseContext(context);
+	return initialised;
+}
+
+bool MarchingCubesEngine::init(cl_context context, cl_device_id device, const char* kernelPath, cl_command_queue_properties properties)
+{
+	shutdown();
+
+	cl_int result = CL_SUCCESS;
+	m_queue = clCreateCommandQueue(context, device, properties, &result);
+	CL_CHECK(result);
+	if (m_queue == 0)
+		return false;
+
+	clRetainContext(context);
+	m_context = context;
+	m_device = device;
+	m_kernelPath = kernelPath != nullptr ? kernelPath : ".";
+
+	m_faceCountLink = clCreateBuffer(m_context, CL_MEM_READ_WRITE, sizeof(cl_uint), nullptr, &result);
+	CL_CHECK(result);
+	return m_faceCountLink != 0;
+}
+
+void MarchingCubesEngine::shutdown()
+{
+	wait();
+	if (m_queue != 0)
+		clFinish(m_queue);
+
+	for (std::map<std::string, Program>::iterator it = m_programs.begin(); it != m_programs.end(); ++it)
+	{
+		clReleaseKernel(it->second.kernel);
+		clReleaseProgram(it->second.program);
+	}
+	m_programs.clear();
+
+	if (m_vertices != 0)
+		clReleaseMemObject(m_vertices);
+	if (m_faceCountLink != 0)
+		clReleaseMemObject(m_faceCountLink);
+	if (m_queue != 0)
+		clReleaseCommandQueue(m_queue);
+	if (m_context != 0)
+		clReleaseContext(m_context);
+
+	m_vertices = 0;
+	m_faceCountLink = 0;
+	m_capacity = 0;
+	m_queue = 0;
+	m_context = 0;
+	m_device = 0;
+}
+
+cl_program MarchingCubesEngine::program(const char* options)
+{
+	Program* built = m_context != 0 ? marchProgram(options) : nullptr;
+	return built != nullptr ? built->program : 0;
+}
+
+MarchingCubesEngine::Program* MarchingCubesEngine::marchProgram(const char* options)
+{
+	std::string key = options != nullptr ? options : "";
+	std::map<std::string, Program>::iterator it = m_programs.find(key);
+	if (it != m_programs.end())
+		return &it->second;
+
+	Program program = { 0, 0 };
+	program.program = buildProgram(m_context, m_device, options, m_kernelPath.c_str());
+	if (program.program == 0)
+		return nullptr;
+
+	cl_int result = CL_SUCCESS;
+	program.kernel = clCreateKernel(program.program, "kernelMC", &result);
+	CL_CHECK(result);
+	if (program.kernel == 0)
+	{
+		clReleaseProgram(program.program);
+		return nullptr;
+	}
+	return &(m_programs[key] = program);
+}
+
+bool MarchingCubesEngine::reserveFaces(cl_uint faces)
+{
+	if (faces <= m_capacity && m_vertices != 0)
+		return true;
+
+	// grow geometrically so a slowly growing mesh doesn't reallocate every call
+	cl_uint capacity = m_capacity * 2 > faces ? m_capacity * 2 : faces;
+	if (capacity > m_maxFaces)
+		capacity = m_maxFaces;
+
+	if (m_vertices != 0)
+		clReleaseMemObject(m_vertices);
+	cl_int result = CL_SUCCESS;
+	m_vertices = clCreateBuffer(m_context, CL_MEM_READ_WRITE, sizeof(cl_float4) * 6 * capacity, nullptr, &result);
+	CL_CHECK(result);
+	m_capacity = m_vertices != 0 ? capacity : 0;
+	return m_vertices != 0;
+}
+
+// zeroes the counts, then runs kernel with its arguments set in the tuned shape
+cl_int MarchingCubesEngine::enqueueTuned(cl_kernel kernel, const size_t* gridSize, cl_mem counts, size_t countBytes,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event)
+{
+	static const cl_uint zero = 0;
+	cl_int result = clEnqueueFillBuffer(m_queue, counts, &zero, sizeof(zero), 0, countBytes, waitCount, waitEvents, 0);
+
+	// a sweep adds to the counts, they start over afterwards
+	const size_t* localSize = nullptr;
+	bool swept = false;
+	if (m_tuning != nullptr)
+		localSize = tunedLocalSize(*m_tuning, m_queue, kernel, 3, gridSize, waitCount, waitEvents, &swept);
+	if (swept)
+		result |= clEnqueueFillBuffer(m_queue, counts, &zero, sizeof(zero), 0, countBytes, 0, nullptr, 0);
+	result |= clEnqueueNDRangeKernel(m_queue, kernel, 3, 0, gridSize, localSize, 0, nullptr, event);
+	CL_CHECK(result);
+	return result;
+}
+
+cl_int MarchingCubesEngine::enqueueMarch(cl_kernel kernel, const FieldArgs& args, const size_t* gridSize, const cl_float4& origin,
+	const cl_float4& spacing, cl_float threshold, cl_uint maxFaces, cl_mem vertices, cl_mem faceCount,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event)
+{
+	cl_int faces = (cl_int)maxFaces;
+	cl_int result = clSetKernelArg(kernel, 0, sizeof(cl_int), &faces);
+	result |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &faceCount);
+	result |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &vertices);
+	result |= clSetKernelArg(kernel, 3, sizeof(cl_float), &threshold);
+	result |= clSetKernelArg(kernel, 4, sizeof(cl_float4), &origin);
+	result |= clSetKernelArg(kernel, 5, sizeof(cl_float4), &spacing);
+	result |= setFieldArgs(kernel, 6, args);
+	CL_CHECK(result);
+	if (result != CL_SUCCESS)
+		return result;
+	return enqueueTuned(kernel, gridSize, faceCount, sizeof(cl_uint), waitCount, waitEvents, event);
+}
+
+cl_int MarchingCubesEngine::enqueueMarchLevels(cl_kernel kernel, const FieldArgs& args, const size_t* gridSize, const cl_float4& origin,
+	const cl_float4& spacing, cl_mem thresholds, cl_uint levelCount, cl_uint levelFaces, cl_mem vertices, cl_mem faceCounts,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event)
+{
+	cl_int faces = (cl_int)levelFaces;
+	cl_int count = (cl_int)levelCount;
+	cl_int result = clSetKernelArg(kernel, 0, sizeof(cl_int), &faces);
+	result |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &faceCounts);
+	result |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &vertices);
+	result |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &thresholds);
+	result |= clSetKernelArg(kernel, 4, sizeof(cl_int), &count);
+	result |= clSetKernelArg(kernel, 5, sizeof(cl_float4), &origin);
+	result |= clSetKernelArg(kernel, 6, sizeof(cl_float4), &spacing);
+	result |= setFieldArgs(kernel, 7, args);
+	CL_CHECK(result);
+	if (result != CL_SUCCESS)
+		return result;
+	return enqueueTuned(kernel, gridSize, faceCounts, sizeof(cl_uint) * levelCount, waitCount, waitEvents, event);
+}
+
+// transform is the field's origin and spacing, the count is read back blocking
+cl_int MarchingCubesEngine::marchOnce(Program& program, const FieldArgs& args, const size_t* gridSize, const cl_float4* transform,
+	cl_float threshold, cl_uint* faceCount)
+{
+	cl_int result = enqueueMarch(program.kernel, args, gridSize, transform[0], transform[1], threshold, m_capacity,
+		m_vertices, m_faceCountLink);
+	result |= clEnqueueReadBuffer(m_queue, m_faceCountLink, CL_TRUE, 0, sizeof(cl_uint), faceCount, 0, nullptr, 0);
+	CL_CHECK(result);
+	return result;
+}
+
+bool MarchingCubesEngine::march(FieldSource& field, cl_float threshold, MeshSink& sink)
+{
+	m_faceCount = 0;
+	if (m_context == 0)
+		return false;
+
+	Program* fieldProgram = marchProgram(field.buildOptions());
+	if (fieldProgram == nullptr || !reserveFaces(m_capacity > 0 ? m_capacity : 64 * 1024))
+		return false;
+
+	size_t gridSize[3];
+	field.gridSize(gridSize);
+	cl_float4 transform[2];
+	field.worldTransform(transform[0], transform[1]);
+	FieldArgs args = {};
+	if (!field.bind(m_context, m_device, m_queue, args))
+		return false;
+
+	cl_uint faceCount = 0;
+	cl_int result = marchOnce(*fieldProgram, args, gridSize, transform, threshold, &faceCount);
+
+	// the count is exact even when the faces didn't fit, one more pass gets them all
+	if (result == CL_SUCCESS && faceCount > m_capacity && m_capacity < m_maxFaces && reserveFaces(faceCount))
+		result = marchOnce(*fieldProgram, args, gridSize, transform, threshold, &faceCount);
+	field.unbind();
+	if (result != CL_SUCCESS)
+		return false;
+
+	if (faceCount > m_capacity)
+		printf("Mesh has %u faces but the engine only holds %u, it will be truncated!\n", faceCount, m_capacity);
+	m_faceCount = faceCount < m_capacity ? faceCount : m_capacity;
+	return sink.consume(m_queue, m_vertices, 0, m_faceCount);
+}
+
+struct MarchingCubesEngine::Job
+{
+	MarchingCubesEngine*	engine;
+	FieldSource*			field;
+	cl_context				context;
+	cl_command_queue		queue;
+	cl_kernel				kernel;			// the job's own, its arguments stay set
+	cl_mem					vertices;
+	cl_mem					faceCountLink;
+	cl_uint					capacity;
+	cl_uint					maxFaces;
+	cl_uint					faceCount;
+	size_t					gridSize[3];
+	LocalSize				local;			// 0 for the driver's choice
+	bool					grown;			// marched again after overflowing
+	MarchResult				result;
+	std::function<void(MarchResult&)>	done;
+};
+
+bool MarchingCubesEngine::submit(FieldSource& field, cl_float threshold, const std::function<void(MarchResult&)>& done)
+{
+	MarchResult failed = { false, std::vector<cl_float4>() };
+	Program* fieldProgram = m_context != 0 ? marchProgram(field.buildOptions()) : nullptr;
+	if (fieldProgram == nullptr)
+	{
+		done(failed);
+		return false;
+	}
+
+	Job* job = new Job();
+	job->engine = this;
+	job->field = &field;
+	job->context = m_context;
+	job->queue = m_queue;
+	job->maxFaces = m_maxFaces;
+	job->capacity = m_capacity > 0 ? m_capacity : (m_maxFaces < 64 * 1024 ? m_maxFaces : 64 * 1024);
+	job->faceCount = 0;
+	job->grown = false;
+	job->result.ok = false;
+	job->done = done;
+	for (int axis = 0; axis < 3; ++axis)
+		job->local.size[axis] = 0;
+
+	cl_int result = CL_SUCCESS;
+	job->kernel = clCreateKernel(fieldProgram->program, "kernelMC", &result);
+	CL_CHECK(result);
+	job->vertices = clCreateBuffer(m_context, CL_MEM_READ_WRITE, sizeof(cl_float4) * 6 * job->capacity, nullptr, &result);
+	CL_CHECK(result);
+	job->faceCountLink = clCreateBuffer(m_context, CL_MEM_READ_WRITE, sizeof(cl_uint), nullptr, &result);
+	CL_CHECK(result);
+
+	field.gridSize(job->gridSize);
+	cl_float4 transform[2];
+	field.worldTransform(transform[0], transform[1]);
+	FieldArgs args = {};
+	bool bound = job->kernel != 0 && job->vertices != 0 && job->faceCountLink != 0 &&
+		field.bind(m_context, m_device, m_queue, args);
+	if (!bound)
+	{
+		job->field = nullptr;
+		result = CL_INVALID_OPERATION;
+	}
+	else
+	{
+		cl_int maxFaces = (cl_int)job->capacity;
+		result = clSetKernelArg(job->kernel, 0, sizeof(cl_int), &maxFaces);
+		result |= clSetKernelArg(job->kernel, 1, sizeof(cl_mem), &job->faceCountLink);
+		result |= clSetKernelArg(job->kernel, 2, sizeof(cl_mem), &job->vertices);
+		result |= clSetKernelArg(job->kernel, 3, sizeof(cl_float), &threshold);
+		result |= clSetKernelArg(job->kernel, 4, sizeof(cl_float4), &transform[0]);
+		result |= clSetKernelArg(job->kernel, 5, sizeof(cl_float4), &transform[1]);
+		result |= setFieldArgs(job->kernel, 6, args);
+		CL_CHECK(result);
+
+		// a sweep blocks this once, its runs only add to the job's counter which is
+		// zeroed before the march
+		bool swept = false;
+		const size_t* localSize = m_tuning != nullptr && result == CL_SUCCESS ?
+			tunedLocalSize(*m_tuning, m_queue, job->kernel, 3, job->gridSize, 0, nullptr, &swept) : nullptr;
+		if (localSize != nullptr)
+			for (int axis = 0; axis < 3; ++axis)
+				job->local.size[axis] = localSize[axis];
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_jobMutex);
+		++m_pendingJobs;
+	}
+	if (result == CL_SUCCESS)
+		result = enqueueJob(*job);
+	if (result != CL_SUCCESS)
+	{
+		finishJob(job, false);
+		return false;
+	}
+	return true;
+}
+
+std::future<MarchResult> MarchingCubesEngine::submit(FieldSource& field, cl_float threshold)
+{
+	std::shared_ptr<std::promise<MarchResult> > promise = std::make_shared<std::promise<MarchResult> >();
+	std::future<MarchResult> future = promise->get_future();
+	submit(field, threshold, [promise](MarchResult& result) { promise->set_value(std::move(result)); });
+	return future;
+}
+
+void MarchingCubesEngine::wait()
+{
+	std::unique_lock<std::mutex> lock(m_jobMutex);
+	m_jobsDone.wait(lock, [this]() { return m_pendingJobs == 0; });
+}
+
+// zeroes the count, marches and reads the count back into the job, whose callback
+// takes it from there. the callbacks call it too, so it only blocks when the read
+// into the job was queued but its callback couldn't be set: the caller frees the job
+// on failure, the read has to be done first. once the callback is set the job may
+// already be finished and deleted on the runtime's thread, it isn't touched again.
+cl_int MarchingCubesEngine::enqueueJob(Job& job)
+{
+	static const cl_uint zero = 0;
+	cl_command_queue queue = job.queue;
+	const size_t* localSize = job.local.size[0] != 0 ? job.local.size : nullptr;
+	cl_event counted = 0;
+	cl_int result = clEnqueueWriteBuffer(queue, job.faceCountLink, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, nullptr, 0);
+	if (result == CL_SUCCESS)
+		result = clEnqueueNDRangeKernel(queue, job.kernel, 3, 0, job.gridSize, localSize, 0, nullptr, 0);
+	if (result == CL_SUCCESS)
+		result = clEnqueueReadBuffer(queue, job.faceCountLink, CL_FALSE, 0, sizeof(cl_uint), &job.faceCount, 0, nullptr, &counted);
+	if (result == CL_SUCCESS)
+		result = clSetEventCallback(counted, CL_COMPLETE, jobCounted, &job);
+	CL_CHECK(result);
+	clFlush(queue);
+	if (result != CL_SUCCESS && counted != 0)
+	{
+		clWaitForEvents(1, &counted);
+		clReleaseEvent(counted);
+	}
+	return result;
+}
+
+void CL_CALLBACK MarchingCubesEngine::jobCounted(cl_event event, cl_int status, void* data)
+{
+	Job* job = (Job*)data;
+	clReleaseEvent(event);
+	if (status != CL_COMPLETE)
+	{
+		finishJob(job, false);
+		return;
+	}
+
+	// the count is exact even when the faces didn't fit, one more pass gets them all
+	cl_int result = CL_SUCCESS;
+	if (job->faceCount > job->capacity && job->capacity < job->maxFaces && !job->grown)
+	{
+		job->capacity = job->faceCount < job->maxFaces ? job->faceCount : job->maxFaces;
+		job->grown = true;
+		clReleaseMemObject(job->vertices);
+		job->vertices = clCreateBuffer(job->context, CL_MEM_READ_WRITE, sizeof(cl_float4) * 6 * job->capacity, nullptr, &result);
+		CL_CHECK(result);
+		if (job->vertices != 0)
+		{
+			cl_int maxFaces = (cl_int)job->capacity;
+			result = clSetKernelArg(job->kernel, 0, sizeof(cl_int), &maxFaces);
+			result |= clSetKernelArg(job->kernel, 2, sizeof(cl_mem), &job->vertices);
+			if (result == CL_SUCCESS)
+				result = enqueueJob(*job);
+		}
+		if (result != CL_SUCCESS)
+			finishJob(job, false);
+		return;
+	}
+
+	if (job->faceCount > job->capacity)
+		printf("Mesh has %u faces but the engine only holds %u, it will be truncated!\n", job->faceCount, job->capacity);
+	cl_uint faces = job->faceCount < job->capacity ? job->faceCount : job->capacity;
+	job->result.vertices.resize((size_t)faces * 6);
+	if (faces == 0)
+	{
+		finishJob(job, true);
+		return;
+	}
+
+	// the job belongs to jobRead as soon as its callback is set
+	cl_command_queue queue = job->queue;
+	cl_event read = 0;
+	result = clEnqueueReadBuffer(queue, job->vertices, CL_FALSE, 0, sizeof(cl_float4) * 6 * faces, job->result.vertices.data(),
+		0, nullptr, &read);
+	CL_CHECK(result);
+	if (result == CL_SUCCESS)
+		result = clSetEventCallback(read, CL_COMPLETE, jobRead, job);
+	clFlush(queue);
+	if (result != CL_SUCCESS)
+	{
+		// finishJob frees the vertices the read may still be writing
+		if (read != 0)
+		{
+			clWaitForEvents(1, &read);
+			clReleaseEvent(read);
+		}
+		finishJob(job, false);
+	}
+}
+
+void CL_CALLBACK MarchingCubesEngine::jobRead(cl_event event, cl_int status, void* data)
+{
+	clReleaseEvent(event);
+	finishJob((Job*)data, status == CL_COMPLETE);
+}
+
+void MarchingCubesEngine::finishJob(Job* job, bool ok)
+{
+	if (job->field != nullptr)
+		job->field->unbind();
+	if (job->vertices != 0)
+		clReleaseMemObject(job->vertices);
+	if (job->faceCountLink != 0)
+		clReleaseMemObject(job->faceCountLink);
+	if (job->kernel != 0)
+		clReleaseKernel(job->kernel);
+
+	job->result.ok = ok;
+	if (!ok)
+		job->result.vertices.clear();
+	job->done(job->result);
+
+	MarchingCubesEngine* engine = job->engine;
+	delete job;
+	std::lock_guard<std::mutex> lock(engine->m_jobMutex);
+	if (--engine->m_pendingJobs == 0)
+		engine->m_jobsDone.notify_all();
+}
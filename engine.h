@@ -0,0 +1,277 @@
+#pragma once
+
+#include "clutil.h"
+#include "export.h"
+#include "tune.h"
+#include "volume.h"
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#define MC_COROUTINES
+#endif
+
+// the marching cubes core without a window, for services that extract many meshes.
+// the engine keeps its context, queue, built programs and output buffers across
+// calls so only the first job pays for setting OpenCL up. fields come from a
+// FieldSource and meshes go to a MeshSink, both can be implemented by the embedder.
+// an engine is not thread safe, use one per thread.
+
+// a scalar field the engine can march
+class FieldSource
+{
+public:
+	virtual ~FieldSource() {}
+
+	// compiler options that select the field in field.cl, nullptr for the metaballs
+	virtual const char* buildOptions() const = 0;
+
+	// cubes per axis
+	virtual void gridSize(size_t* size) const = 0;
+
+	// where the grid sits in world space, vertices come out transformed by it. origin
+	// is the first corner's position and spacing (w = 1) the size of a cube per axis.
+	virtual void worldTransform(cl_float4& origin, cl_float4& spacing) const
+	{
+		origin.s[0] = origin.s[1] = origin.s[2] = origin.s[3] = 0;
+		spacing.s[0] = spacing.s[1] = spacing.s[2] = spacing.s[3] = 1;
+	}
+
+	// makes the field available to the device and fills in its kernel arguments
+	virtual bool bind(cl_context context, cl_device_id device, cl_command_queue queue, FieldArgs& args) = 0;
+
+	// the march that used the arguments has finished
+	virtual void unbind() {}
+};
+
+// a volume that fits in memory, marched straight out of its mapping or out of a
+// bricked or image copy, by storage
+class VolumeSource : public FieldSource
+{
+public:
+	explicit VolumeSource(const Volume& volume, VolumeStorage storage = VOLUME_LINEAR);
+	~VolumeSource();
+
+	const char* buildOptions() const override;
+	void gridSize(size_t* size) const override;
+	void worldTransform(cl_float4& origin, cl_float4& spacing) const override;
+	bool bind(cl_context context, cl_device_id device, cl_command_queue queue, FieldArgs& args) override;
+	void unbind() override;
+
+private:
+	const Volume&	m_volume;
+	VolumeStorage	m_storage;
+	cl_mem			m_buffer;
+};
+
+// metaballs around a list of particles, the particles may change between marches
+class ParticleSource : public FieldSource
+{
+public:
+	ParticleSource(size_t x, size_t y, size_t z);
+	~ParticleSource();
+
+	const char* buildOptions() const override { return nullptr; }
+	void gridSize(size_t* size) const override;
+	bool bind(cl_context context, cl_device_id device, cl_command_queue queue, FieldArgs& args) override;
+
+	std::vector<cl_float4>	particles;
+
+private:
+	size_t		m_gridSize[3];
+	cl_context	m_context;
+	cl_mem		m_buffer;		// kept and regrown across marches
+	size_t		m_capacity;
+};
+
+// receives a finished mesh: 3 vertices per face, each a position and a normal float4
+class MeshSink
+{
+public:
+	virtual ~MeshSink() {}
+
+	// faces [firstFace, firstFace + faceCount) of vertices. reads may be left queued on
+	// queue, the engine only reuses the buffer behind them.
+	virtual bool consume(cl_command_queue queue, cl_mem vertices, cl_uint firstFace, cl_uint faceCount) = 0;
+};
+
+// copies the mesh into host memory
+class HostMeshSink : public MeshSink
+{
+public:
+	bool consume(cl_command_queue queue, cl_mem vertices, cl_uint firstFace, cl_uint faceCount) override;
+
+	std::vector<cl_float4>	vertices;
+};
+
+// hands the mesh to a MeshWriter, which must be open on the engine's context and queue
+class WriterMeshSink : public MeshSink
+{
+public:
+	explicit WriterMeshSink(MeshWriter& writer) : m_writer(writer) {}
+
+	bool consume(cl_command_queue queue, cl_mem vertices, cl_uint firstFace, cl_uint faceCount) override;
+
+private:
+	MeshWriter&	m_writer;
+};
+
+// a mesh from an asynchronous march, laid out like HostMeshSink's. ok is false when
+// the march failed.
+struct MarchResult
+{
+	bool					ok;
+	std::vector<cl_float4>	vertices;
+};
+
+class MarchingCubesEngine
+{
+public:
+	MarchingCubesEngine();
+	~MarchingCubesEngine();
+
+	// creates a context and queue on the first device of the given type. kernelPath
+	// is where the .cl files are, nullptr for the working directory. properties are the
+	// queue's, CL_QUEUE_PROFILING_ENABLE to time its commands.
+	bool init(cl_device_type deviceType = CL_DEVICE_TYPE_ALL, const char* kernelPath = nullptr,
+		cl_command_queue_properties properties = 0);
+
+	// runs on a context the caller made (a GL sharing one for example), which is retained
+	bool init(cl_context context, cl_device_id device, const char* kernelPath = nullptr,
+		cl_command_queue_properties properties = 0);
+
+	void shutdown();
+
+	// marches the field and hands the mesh to the sink. the output grows as meshes
+	// need it up to maxFaces, a mesh that overflows is marched again into a larger
+	// buffer once, past maxFaces it is truncated.
+	bool march(FieldSource& field, cl_float threshold, MeshSink& sink);
+
+	// marches without waiting: the field is bound and the march enqueued before it
+	// returns, done is called with the mesh once it has been read back. every job has
+	// its own output and kernel so any number can be in flight on the queue. done runs
+	// on the OpenCL runtime's callback thread (or right away when the march can't be
+	// enqueued) and should hand heavy work on. the field must stay alive and bound,
+	// a ParticleSource's particles unchanged, until then, the field is unbound on that
+	// thread, and it can only be in one march at a time. a mesh that overflows the
+	// output is marched again into a larger one like march's, the engine's own output
+	// isn't touched.
+	bool submit(FieldSource& field, cl_float threshold, const std::function<void(MarchResult&)>& done);
+
+	// submit with the mesh as a future
+	std::future<MarchResult> submit(FieldSource& field, cl_float threshold);
+
+	// blocks until every submitted march is done
+	void wait();
+
+	// the program built with the compiler options (nullptr for the metaballs), built on
+	// first use and owned by the engine. extractions other than kernelMC make their
+	// kernels from it.
+	cl_program program(const char* options);
+
+	// enqueues a march of kernel (kernelMC from program) over gridSize into buffers the
+	// caller keeps, a GL buffer for example. the count is zeroed first, the work-group
+	// shape comes from the tuning database. nothing is waited on or read back.
+	cl_int enqueueMarch(cl_kernel kernel, const FieldArgs& args, const size_t* gridSize, const cl_float4& origin,
+		const cl_float4& spacing, cl_float threshold, cl_uint maxFaces, cl_mem vertices, cl_mem faceCount,
+		cl_uint waitCount = 0, const cl_event* waitEvents = nullptr, cl_event* event = nullptr);
+
+	// enqueueMarch for kernelMCLevels: levelCount thresholds, each level with a slice of
+	// levelFaces faces in vertices and its own count in faceCounts
+	cl_int enqueueMarchLevels(cl_kernel kernel, const FieldArgs& args, const size_t* gridSize, const cl_float4& origin,
+		const cl_float4& spacing, cl_mem thresholds, cl_uint levelCount, cl_uint levelFaces, cl_mem vertices, cl_mem faceCounts,
+		cl_uint waitCount = 0, const cl_event* waitEvents = nullptr, cl_event* event = nullptr);
+
+	void setMaxFaces(cl_uint maxFaces) { m_maxFaces = maxFaces; }
+
+	// work-group shapes from (and, when it tunes, swept into) a database opened for
+	// the engine's device. the database must outlive the engine, nullptr for the driver's.
+	void setTuning(TuningDatabase* tuning) { m_tuning = tuning; }
+
+	// faces the last march handed to its sink
+	cl_uint faceCount() const { return m_faceCount; }
+
+	cl_context context() const { return m_context; }
+	cl_device_id device() const { return m_device; }
+	cl_command_queue queue() const { return m_queue; }
+	const char* kernelPath() const { return m_kernelPath.c_str(); }
+
+private:
+	struct Program
+	{
+		cl_program	program;
+		cl_kernel	kernel;
+	};
+
+	// a submitted march, see engine.cpp
+	struct Job;
+	static void CL_CALLBACK jobCounted(cl_event event, cl_int status, void* data);
+	static void CL_CALLBACK jobRead(cl_event event, cl_int status, void* data);
+	static cl_int enqueueJob(Job& job);
+	static void finishJob(Job* job, bool ok);
+
+	// built once per set of compiler options
+	Program* marchProgram(const char* options);
+	bool reserveFaces(cl_uint faces);
+	cl_int marchOnce(Program& program, const FieldArgs& args, const size_t* gridSize, const cl_float4* transform,
+		cl_float threshold, cl_uint* faceCount);
+	cl_int enqueueTuned(cl_kernel kernel, const size_t* gridSize, cl_mem counts, size_t countBytes,
+		cl_uint waitCount, const cl_event* waitEvents, cl_event* event);
+
+	cl_context		m_context;
+	cl_device_id	m_device;
+	cl_command_queue	m_queue;
+	std::string		m_kernelPath;
+	std::map<std::string, Program>	m_programs;
+
+	cl_mem			m_vertices;
+	cl_mem			m_faceCountLink;
+	cl_uint			m_capacity;		// faces m_vertices holds
+	cl_uint			m_maxFaces;
+	cl_uint			m_faceCount;
+	TuningDatabase*	m_tuning;
+
+	// submitted marches not done yet
+	std::mutex				m_jobMutex;
+	std::condition_variable	m_jobsDone;
+	int						m_pendingJobs;
+};
+
+#ifdef MC_COROUTINES
+// co_await MarchAwaitable(engine, field, threshold) in a C++20 coroutine submits the
+// march and resumes with its MarchResult once it is read back, on the thread submit
+// calls done on
+class MarchAwaitable
+{
+public:
+	MarchAwaitable(MarchingCubesEngine& engine, FieldSource& field, cl_float threshold)
+		: m_engine(engine), m_field(field), m_threshold(threshold) {}
+
+	bool await_ready() const { return false; }
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		// the coroutine may already be running again when submit returns
+		m_engine.submit(m_field, m_threshold, [this, handle](MarchResult& result)
+		{
+			m_result = std::move(result);
+			handle.resume();
+		});
+	}
+
+	MarchResult await_resume() { return std::move(m_result); }
+
+private:
+	MarchingCubesEngine&	m_engine;
+	FieldSource&			m_field;
+	cl_float				m_threshold;
+	MarchResult				m_result;
+};
+#endif
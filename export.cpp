@@ -0,0 +1,477 @@
+#include "export.h"
+#include "codec.h"
+
+#include <math.h>
+#include <string.h>
+
+// counts are written fixed width so they can be patched in place once known
+#define COUNT_FORMAT "%010u"
+
+// size of the padded header of a mapped ply, vertices start on the following page
+#define MAPPED_HEADER_BYTES 4096
+// the kernel writes 2 float4 per vertex, 3 vertices per face
+#define FACE_BYTES (sizeof(cl_float4) * 6)
+// uchar count followed by 3 uint indices
+#define FACE_LIST_BYTES (1 + 3 * sizeof(cl_uint))
+
+bool meshFormatFromPath(const char* path, MeshFormat& format)
+{
+	const char* extension = strrchr(path, '.');
+	if (extension == nullptr)
+		return false;
+
+	if (strcmp(extension, ".ply") == 0 || strcmp(extension, ".PLY") == 0)
+		format = MESH_PLY;
+	else if (strcmp(extension, ".stl") == 0 || strcmp(extension, ".STL") == 0)
+		format = MESH_STL;
+	else if (strcmp(extension, ".obj") == 0 || strcmp(extension, ".OBJ") == 0)
+		format = MESH_OBJ;
+	else if (strcmp(extension, ".mcz") == 0 || strcmp(extension, ".MCZ") == 0)
+		format = MESH_MCZ;
+	else
+		return false;
+	return true;
+}
+
+MeshWriter::MeshWriter()
+	: m_file(nullptr),
+	m_format(MESH_PLY),
+	m_queue(0),
+	m_chunkFaces(0),
+	m_closing(false),
+	m_failed(false),
+	m_faceCount(0)
+{
+}
+
+MeshWriter::~MeshWriter()
+{
+	close();
+}
+
+bool MeshWriter::open(cl_context context, cl_command_queue queue, const char* path, MeshFormat format,
+	cl_uint chunkFaces, int chunkCount)
+{
+	close();
+
+	m_file = fopen(path, "wb");
+	if (m_file == nullptr)
+	{
+		printf("Failed to open %s for writing!\n", path);
+		return false;
+	}
+	setvbuf(m_file, nullptr, _IOFBF, 1024 * 1024);
+
+	m_format = format;
+	m_queue = queue;
+	m_chunkFaces = chunkFaces;
+	m_closing = false;
+	m_failed = false;
+	m_faceCount = 0;
+
+	// pinned staging, mapped once for the life of the writer
+	cl_int result = CL_SUCCESS;
+	size_t chunkBytes = sizeof(cl_float4) * 6 * chunkFaces;
+	m_chunks.resize(chunkCount);
+	for (int i = 0; i < chunkCount; ++i)
+	{
+		Chunk& chunk = m_chunks[i];
+		chunk.staging = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, chunkBytes, nullptr, &result);
+		CL_CHECK(result);
+		chunk.vertices = (cl_float4*)clEnqueueMapBuffer(queue, chunk.staging, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, chunkBytes, 0, nullptr, nullptr, &result);
+		CL_CHECK(result);
+		chunk.faceCount = 0;
+		chunk.ready = 0;
+		if (chunk.vertices == nullptr)
+			m_failed = true;
+		m_free.push_back(i);
+	}
+
+	writeHeader();
+	m_thread = std::thread(&MeshWriter::writeChunks, this);
+	return !m_failed;
+}
+
+bool MeshWriter::write(cl_command_queue queue, cl_mem vertices, cl_uint faceCount,
+	cl_uint waitCount, const cl_event* waitEvents, cl_uint firstFace)
+{
+	for (cl_uint first = 0; first < faceCount; first += m_chunkFaces)
+	{
+		int index = acquireChunk();
+		Chunk& chunk = m_chunks[index];
+		chunk.faceCount = faceCount - first < m_chunkFaces ? faceCount - first : m_chunkFaces;
+
+		cl_int result = clEnqueueReadBuffer(queue, vertices, CL_FALSE, sizeof(cl_float4) * 6 * ((size_t)firstFace + first), sizeof(cl_float4) * 6 * chunk.faceCount,
+			chunk.vertices, waitCount, waitEvents, &chunk.ready);
+		CL_CHECK(result);
+		if (result != CL_SUCCESS)
+		{
+			chunk.ready = 0;
+			chunk.faceCount = 0;
+			submitChunk(index);
+			return false;
+		}
+		submitChunk(index);
+	}
+
+	// the writer thread waits on the reads, make sure they get to the device
+	clFlush(queue);
+	return true;
+}
+
+void MeshWriter::write(const cl_float4* vertices, cl_uint faceCount)
+{
+	for (cl_uint first = 0; first < faceCount; first += m_chunkFaces)
+	{
+		int index = acquireChunk();
+		Chunk& chunk = m_chunks[index];
+		chunk.faceCount = faceCount - first < m_chunkFaces ? faceCount - first : m_chunkFaces;
+		chunk.ready = 0;
+		memcpy(chunk.vertices, vertices + 6 * (size_t)first, sizeof(cl_float4) * 6 * chunk.faceCount);
+		submitChunk(index);
+	}
+}
+
+bool MeshWriter::close()
+{
+	if (m_file == nullptr)
+		return false;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closing = true;
+		m_changed.notify_all();
+	}
+	m_thread.join();
+
+	// ply lists its faces after every vertex, they index the soup in order
+	if (m_format == MESH_PLY)
+	{
+		const size_t faceBytes = 1 + 3 * sizeof(cl_uint);
+		const size_t facesPerBlock = 64 * 1024;
+		m_encoded.resize(faceBytes * facesPerBlock);
+		for (size_t first = 0; first < m_faceCount; first += facesPerBlock)
+		{
+			size_t count = m_faceCount - first < facesPerBlock ? m_faceCount - first : facesPerBlock;
+			char* out = m_encoded.data();
+			for (size_t i = 0; i < count; ++i)
+			{
+				cl_uint indices[3] = { (cl_uint)(first + i) * 3, (cl_uint)(first + i) * 3 + 1, (cl_uint)(first + i) * 3 + 2 };
+				*out++ = 3;
+				memcpy(out, indices, sizeof(indices));
+				out += sizeof(indices);
+			}
+			if (fwrite(m_encoded.data(), faceBytes, count, m_file) != count)
+				m_failed = true;
+		}
+	}
+
+	// patch the counts into the header
+	char count[16];
+	cl_uint faceCount = (cl_uint)m_faceCount;
+	switch (m_format)
+	{
+	case MESH_PLY:
+		fseek(m_file, m_countOffsets[0], SEEK_SET);
+		sprintf(count, COUNT_FORMAT, faceCount * 3);
+		fwrite(count, 1, 10, m_file);
+		fseek(m_file, m_countOffsets[1], SEEK_SET);
+		sprintf(count, COUNT_FORMAT, faceCount);
+		fwrite(count, 1, 10, m_file);
+		break;
+	case MESH_STL:
+		fseek(m_file, 80, SEEK_SET);
+		fwrite(&faceCount, sizeof(cl_uint), 1, m_file);
+		break;
+	case MESH_MCZ:
+		m_encoded.clear();
+		encodeMeshEnd(m_encoded);
+		if (fwrite(m_encoded.data(), 1, m_encoded.size(), m_file) != m_encoded.size())
+			m_failed = true;
+		break;
+	default:
+		break;
+	}
+
+	if (fclose(m_file) != 0)
+		m_failed = true;
+	m_file = nullptr;
+
+	for (size_t i = 0; i < m_chunks.size(); ++i)
+	{
+		if (m_chunks[i].vertices != nullptr)
+			clEnqueueUnmapMemObject(m_queue, m_chunks[i].staging, m_chunks[i].vertices, 0, nullptr, nullptr);
+		clReleaseMemObject(m_chunks[i].staging);
+	}
+	clFinish(m_queue);
+	m_chunks.clear();
+	m_free.clear();
+
+	if (m_failed)
+		printf("Failed writing mesh!\n");
+	return !m_failed;
+}
+
+int MeshWriter::acquireChunk()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (m_free.empty())
+		m_changed.wait(lock);
+	int index = m_free.front();
+	m_free.pop_front();
+	return index;
+}
+
+void MeshWriter::submitChunk(int chunk)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_full.push_back(chunk);
+	m_changed.notify_all();
+}
+
+void MeshWriter::writeChunks()
+{
+	for (;;)
+	{
+		int index = -1;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while (m_full.empty() && !m_closing)
+				m_changed.wait(lock);
+			if (m_full.empty())
+				return;
+			index = m_full.front();
+			m_full.pop_front();
+		}
+
+		Chunk& chunk = m_chunks[index];
+		if (chunk.ready != 0)
+		{
+			if (clWaitForEvents(1, &chunk.ready) != CL_SUCCESS)
+				chunk.faceCount = 0;
+			clReleaseEvent(chunk.ready);
+			chunk.ready = 0;
+		}
+		writeFaces(chunk.vertices, chunk.faceCount);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_free.push_back(index);
+		m_changed.notify_all();
+	}
+}
+
+void MeshWriter::writeHeader()
+{
+	switch (m_format)
+	{
+	case MESH_PLY:
+		fprintf(m_file, "ply\nformat binary_little_endian 1.0\ncomment OpenCLMC\nelement vertex ");
+		m_countOffsets[0] = ftell(m_file);
+		fprintf(m_file, COUNT_FORMAT "\n"
+			"property float x\nproperty float y\nproperty float z\n"
+			"property float nx\nproperty float ny\nproperty float nz\n"
+			"element face ", 0);
+		m_countOffsets[1] = ftell(m_file);
+		fprintf(m_file, COUNT_FORMAT "\nproperty list uchar uint vertex_indices\nend_header\n", 0);
+		break;
+	case MESH_STL:
+	{
+		char header[80] = "OpenCLMC";
+		cl_uint faceCount = 0;
+		fwrite(header, 1, sizeof(header), m_file);
+		fwrite(&faceCount, sizeof(cl_uint), 1, m_file);
+		break;
+	}
+	case MESH_OBJ:
+		fprintf(m_file, "# OpenCLMC\n");
+		break;
+	case MESH_MCZ:
+		fwrite(MESH_CODEC_MAGIC, 1, 4, m_file);
+		break;
+	}
+}
+
+void MeshWriter::writeFaces(const cl_float4* vertices, cl_uint faceCount)
+{
+	char* out = nullptr;
+	switch (m_format)
+	{
+	case MESH_PLY:
+		// position and normal, dropping the w components
+		m_encoded.resize(sizeof(cl_float) * 6 * 3 * faceCount);
+		out = m_encoded.data();
+		for (cl_uint i = 0; i < faceCount * 3; ++i)
+		{
+			memcpy(out, vertices[i * 2].s, sizeof(cl_float) * 3);
+			memcpy(out + sizeof(cl_float) * 3, vertices[i * 2 + 1].s, sizeof(cl_float) * 3);
+			out += sizeof(cl_float) * 6;
+		}
+		break;
+	case MESH_STL:
+		// facet normal from the winding, then the corners and an empty attribute
+		m_encoded.resize(50 * (size_t)faceCount);
+		out = m_encoded.data();
+		for (cl_uint i = 0; i < faceCount; ++i)
+		{
+			const cl_float* a = vertices[i * 6].s;
+			const cl_float* b = vertices[i * 6 + 2].s;
+			const cl_float* c = vertices[i * 6 + 4].s;
+			cl_float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			cl_float e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			cl_float n[3] = { e0[1] * e1[2] - e0[2] * e1[1], e0[2] * e1[0] - e0[0] * e1[2], e0[0] * e1[1] - e0[1] * e1[0] };
+			cl_float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length > 0)
+			{
+				n[0] /= length;
+				n[1] /= length;
+				n[2] /= length;
+			}
+
+			memcpy(out, n, sizeof(n));
+			memcpy(out + 12, a, sizeof(cl_float) * 3);
+			memcpy(out + 24, b, sizeof(cl_float) * 3);
+			memcpy(out + 36, c, sizeof(cl_float) * 3);
+			out[48] = 0;
+			out[49] = 0;
+			out += 50;
+		}
+		break;
+	case MESH_OBJ:
+	{
+		// corners, then a face referencing them by their 1-based index
+		m_encoded.resize(0);
+		char line[128];
+		for (cl_uint i = 0; i < faceCount * 3; ++i)
+		{
+			const cl_float* p = vertices[i * 2].s;
+			const cl_float* n = vertices[i * 2 + 1].s;
+			int length = sprintf(line, "v %g %g %g\nvn %g %g %g\n", p[0], p[1], p[2], n[0], n[1], n[2]);
+			m_encoded.insert(m_encoded.end(), line, line + length);
+		}
+		for (cl_uint i = 0; i < faceCount; ++i)
+		{
+			size_t first = (m_faceCount + i) * 3 + 1;
+			int length = sprintf(line, "f %zu//%zu %zu//%zu %zu//%zu\n", first, first, first + 1, first + 1, first + 2, first + 2);
+			m_encoded.insert(m_encoded.end(), line, line + length);
+		}
+		out = m_encoded.data() + m_encoded.size();
+		break;
+	}
+	case MESH_MCZ:
+		// each chunk is a block of its own, an empty one would end the file
+		m_encoded.resize(0);
+		if (faceCount > 0)
+			encodeMeshBlock(vertices, faceCount, m_encoded);
+		out = m_encoded.data() + m_encoded.size();
+		break;
+	}
+
+	size_t bytes = out - m_encoded.data();
+	if (bytes > 0 && fwrite(m_encoded.data(), 1, bytes, m_file) != bytes)
+		m_failed = true;
+	m_faceCount += faceCount;
+}
+
+MappedMeshFile::MappedMeshFile()
+	: m_vertices(0),
+	m_maxFaces(0)
+{
+	m_file.data = nullptr;
+	m_file.size = 0;
+}
+
+MappedMeshFile::~MappedMeshFile()
+{
+	if (isOpen())
+	{
+		if (m_vertices != 0)
+			clReleaseMemObject(m_vertices);
+		finishMappedFile(m_file, 0);
+	}
+}
+
+bool MappedMeshFile::open(cl_context context, const char* path, cl_uint maxFaces)
+{
+	// room for every vertex and the face list that follows them
+	size_t size = MAPPED_HEADER_BYTES + (FACE_BYTES + FACE_LIST_BYTES) * (size_t)maxFaces;
+	if (!createMappedFile(m_file, path, size))
+	{
+		printf("Failed to map %s for writing!\n", path);
+		return false;
+	}
+	m_maxFaces = maxFaces;
+
+	// header padded out with a comment line so it ends exactly at the page boundary
+	char* header = (char*)m_file.data;
+	int length = sprintf(header, "ply\nformat binary_little_endian 1.0\ncomment OpenCLMC\nelement vertex ");
+	m_countOffsets[0] = length;
+	length += sprintf(header + length, COUNT_FORMAT "\n"
+		"property float x\nproperty float y\nproperty float z\nproperty float w\n"
+		"property float nx\nproperty float ny\nproperty float nz\nproperty float nw\n"
+		"element face ", 0);
+	m_countOffsets[1] = length;
+	length += sprintf(header + length, COUNT_FORMAT "\nproperty list uchar uint vertex_indices\ncomment", 0);
+	const char end[] = "\nend_header\n";
+	memset(header + length, ' ', MAPPED_HEADER_BYTES - length - (sizeof(end) - 1));
+	memcpy(header + MAPPED_HEADER_BYTES - (sizeof(end) - 1), end, sizeof(end) - 1);
+
+	cl_int result = CL_SUCCESS;
+	m_vertices = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, FACE_BYTES * maxFaces,
+		header + MAPPED_HEADER_BYTES, &result);
+	CL_CHECK(result);
+	if (result != CL_SUCCESS)
+	{
+		m_vertices = 0;
+		finishMappedFile(m_file, 0);
+		return false;
+	}
+	return true;
+}
+
+bool MappedMeshFile::close(cl_command_queue queue, cl_uint faceCount)
+{
+	if (!isOpen())
+		return false;
+
+	if (faceCount > m_maxFaces)
+	{
+		printf("Mesh has %u faces but the file only holds %u, it will be truncated!\n", faceCount, m_maxFaces);
+		faceCount = m_maxFaces;
+	}
+
+	// mapping the buffer is what guarantees the host pointer holds the kernel's output.
+	// on cpu runtimes it is a no-op, elsewhere it is the one copy back.
+	cl_int result = CL_SUCCESS;
+	if (faceCount > 0)
+	{
+		void* mapped = clEnqueueMapBuffer(queue, m_vertices, CL_TRUE, CL_MAP_READ, 0, FACE_BYTES * faceCount, 0, nullptr, nullptr, &result);
+		CL_CHECK(result);
+		if (mapped != nullptr)
+			result |= clEnqueueUnmapMemObject(queue, m_vertices, mapped, 0, nullptr, nullptr);
+		result |= clFinish(queue);
+	}
+	clReleaseMemObject(m_vertices);
+	m_vertices = 0;
+
+	char* header = (char*)m_file.data;
+	char count[16];
+	sprintf(count, COUNT_FORMAT, faceCount * 3);
+	memcpy(header + m_countOffsets[0], count, 10);
+	sprintf(count, COUNT_FORMAT, faceCount);
+	memcpy(header + m_countOffsets[1], count, 10);
+
+	// faces index the soup in order, listed straight after the last vertex
+	char* out = header + MAPPED_HEADER_BYTES + FACE_BYTES * (size_t)faceCount;
+	for (cl_uint i = 0; i < faceCount; ++i)
+	{
+		cl_uint indices[3] = { i * 3, i * 3 + 1, i * 3 + 2 };
+		*out++ = 3;
+		memcpy(out, indices, sizeof(indices));
+		out += sizeof(indices);
+	}
+
+	bool ok = finishMappedFile(m_file, out - header) && result == CL_SUCCESS;
+	if (!ok)
+		printf("Failed writing mesh!\n");
+	return ok;
+}
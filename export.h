@@ -0,0 +1,111 @@
+#pragma once
+
+#include "clutil.h"
+#include "volume.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum MeshFormat
+{
+	MESH_PLY,	// binary little endian
+	MESH_STL,	// binary
+	MESH_OBJ,
+	MESH_MCZ,	// compressed blocks, see codec.h
+};
+
+// picks the format from the file extension
+bool meshFormatFromPath(const char* path, MeshFormat& format);
+
+// writes triangle soups (3 vertices per face, each a position and a normal float4) to a
+// file on a background thread. faces are read back from the device into pinned staging
+// chunks and written while extraction carries on, a mesh larger than the chunks simply
+// passes through them in pieces. counts in the header are patched on close.
+class MeshWriter
+{
+public:
+	MeshWriter();
+	~MeshWriter();
+
+	bool open(cl_context context, cl_command_queue queue, const char* path, MeshFormat format,
+		cl_uint chunkFaces = 64 * 1024, int chunkCount = 4);
+
+	// queues non-blocking reads of faceCount faces, from firstFace on, from a device
+	// buffer once the wait events complete. only blocks while every chunk is still
+	// waiting to be written.
+	bool write(cl_command_queue queue, cl_mem vertices, cl_uint faceCount,
+		cl_uint waitCount = 0, const cl_event* waitEvents = nullptr, cl_uint firstFace = 0);
+
+	// copies faces from host memory
+	void write(const cl_float4* vertices, cl_uint faceCount);
+
+	// waits for everything queued, finishes the file and releases the chunks
+	bool close();
+
+	bool isOpen() const { return m_file != nullptr; }
+
+private:
+	struct Chunk
+	{
+		cl_mem		staging;
+		cl_float4*	vertices;	// mapped pinned memory
+		cl_uint		faceCount;
+		cl_event	ready;		// read into the chunk, 0 for host copies
+	};
+
+	int acquireChunk();
+	void submitChunk(int chunk);
+	void writeChunks();
+	void writeHeader();
+	void writeFaces(const cl_float4* vertices, cl_uint faceCount);
+
+	FILE*					m_file;
+	MeshFormat				m_format;
+	cl_command_queue		m_queue;
+	cl_uint					m_chunkFaces;
+	std::vector<Chunk>		m_chunks;
+	std::deque<int>			m_free;
+	std::deque<int>			m_full;
+	std::mutex				m_mutex;
+	std::condition_variable	m_changed;
+	std::thread				m_thread;
+	bool					m_closing;
+	bool					m_failed;
+	size_t					m_faceCount;	// written so far, only touched by the writer thread
+	long					m_countOffsets[2];	// where the ply counts sit in the header
+	std::vector<char>		m_encoded;
+};
+
+// binary ply whose vertex block the device writes directly. the output buffer is made
+// with CL_MEM_USE_HOST_PTR over a shared mapping of the file, so on devices sharing
+// host memory (pocl and other cpu runtimes) kernelMC stores its vertices straight into
+// the page cache. elsewhere the runtime copies them back once when the buffer is mapped
+// on close. the header is padded to a page so the vertex block is suitably aligned.
+// vertices keep their w components (x y z w nx ny nz nw) to match the kernel's layout.
+class MappedMeshFile
+{
+public:
+	MappedMeshFile();
+	~MappedMeshFile();
+
+	// sizes the file for maxFaces, untouched pages stay sparse until close trims them
+	bool open(cl_context context, const char* path, cl_uint maxFaces);
+
+	// buffer for kernelMC's vertex output, valid until close
+	cl_mem vertices() const { return m_vertices; }
+
+	// syncs the vertices, patches the header counts, lists the faces and truncates.
+	// faceCount is capped at the capacity given to open.
+	bool close(cl_command_queue queue, cl_uint faceCount);
+
+	bool isOpen() const { return m_file.data != nullptr; }
+
+private:
+	MappedFile	m_file;
+	cl_mem		m_vertices;
+	cl_uint		m_maxFaces;
+	size_t		m_countOffsets[2];	// where the counts sit in the header
+};
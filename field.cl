@@ -0,0 +1,222 @@
+// scalar field sampling, shared by all extraction kernels
+//
+// the field source is chosen when the program is built:
+//   default        metaballs evaluated from a list of particles
+//   FIELD_VOLUME   trilinear lookup into a buffer of 8, 16 or 32-bit samples
+//   FIELD_BRICKED  with FIELD_VOLUME, the buffer holds the samples in Morton ordered
+//                  bricks instead of x-major
+//   FIELD_SPH      fluid particles (sph.cl), a smooth kernel summed over the particles
+//                  of the cells around the sample
+//   FIELD_IMAGE    with FIELD_VOLUME, the samples are an image3d_t read through the
+//                  texture units, which filter trilinearly for free
+//
+// FIELD_GRADIENT_STEP is the offset of the central differences taken for normals
+//
+// FIELD_PARAMS / FIELD_ARGS expand to the kernel parameters the source needs so
+// kernels can forward them without knowing which source is compiled in
+
+#if defined(FIELD_VOLUME) && defined(FIELD_IMAGE)
+
+// integer samples are stored in normalised formats, the texture units hand them back
+// in [0, 1] or [-1, 1] already. a_fieldScale is then (1, 0) unless the threshold is
+// meant in other units.
+#define FIELD_PARAMS	read_only image3d_t a_field, int4 a_fieldSize, float2 a_fieldScale
+#define FIELD_ARGS		a_field, a_fieldSize, a_fieldScale
+
+// hardware filtering weights have as little as 8 fractional bits, differences over a
+// hundredth of a sample would mostly measure the rounding
+#define FIELD_GRADIENT_STEP	0.25f
+
+// unnormalised coordinates, texel centres sit on the half sample
+constant sampler_t FIELD_NEAREST = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+constant sampler_t FIELD_LINEAR = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;
+
+float sampleCorner(float4 v, read_only image3d_t field, int4 size, float2 scale)
+{
+	int4 p = convert_int4(v);
+	p.w = 0;
+	return read_imagef(field, FIELD_NEAREST, p).x * scale.x + scale.y;
+}
+
+float sampleVolume(float4 v, read_only image3d_t field, int4 size, float2 scale)
+{
+	float4 p = (float4)(v.xyz + 0.5f, 0.0f);
+	return read_imagef(field, FIELD_LINEAR, p).x * scale.x + scale.y;
+}
+
+#elif defined(FIELD_VOLUME)
+
+// samples keep the type they were stored with (VOXEL_T = uchar, ushort, short, half
+// or float) and are normalised to float as they are read, a_fieldScale holds the
+// scale and bias that map them to the range the threshold is given in
+#ifndef VOXEL_T
+	#define VOXEL_T float
+#endif
+
+#ifdef VOXEL_HALF
+	#define loadVoxel(field, i)	vload_half(i, field)
+#else
+	#define loadVoxel(field, i)	convert_float(field[i])
+#endif
+
+#define FIELD_PARAMS	global const VOXEL_T* a_field, int4 a_fieldSize, float2 a_fieldScale
+#define FIELD_ARGS		a_field, a_fieldSize, a_fieldScale
+#define FIELD_GRADIENT_STEP	0.01f
+
+#ifdef FIELD_BRICKED
+
+// bricks of FIELD_BRICK^3 samples stored x-major, the samples within a brick in Morton
+// order. matches brickedIndex in volume.h.
+#define FIELD_BRICK_BITS	3
+#define FIELD_BRICK			(1 << FIELD_BRICK_BITS)
+
+// bits of v spread out to every third bit
+uint mortonSpread(uint v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+// offset of the sample at p in a bricked volume
+size_t fieldIndex(int4 p, int4 size)
+{
+	int4 bricks = (size + (int4)(FIELD_BRICK - 1)) >> FIELD_BRICK_BITS;
+	int4 brick = p >> FIELD_BRICK_BITS;
+	uint4 inner = convert_uint4(p & (int4)(FIELD_BRICK - 1));
+	size_t brickIndex = brick.x + bricks.x * ((size_t)brick.y + (size_t)bricks.y * brick.z);
+	uint morton = mortonSpread(inner.x) | (mortonSpread(inner.y) << 1) | (mortonSpread(inner.z) << 2);
+	return (brickIndex << (3 * FIELD_BRICK_BITS)) + morton;
+}
+
+#else
+
+// offset of the sample at p in an x-major volume
+size_t fieldIndex(int4 p, int4 size)
+{
+	return p.x + size.x * ((size_t)p.y + (size_t)size.y * p.z);
+}
+
+#endif
+
+float fieldSample(int4 p, global const VOXEL_T* field, int4 size, float2 scale)
+{
+	p = clamp(p, (int4)(0), size - (int4)(1));
+	return loadVoxel(field, fieldIndex(p, size)) * scale.x + scale.y;
+}
+
+// grid corners fall exactly on samples, skip the interpolation
+float sampleCorner(float4 v, global const VOXEL_T* field, int4 size, float2 scale)
+{
+	return fieldSample(convert_int4(v), field, size, scale);
+}
+
+float sampleVolume(float4 v, global const VOXEL_T* field, int4 size, float2 scale)
+{
+	float4 base = floor(v);
+	float4 t = v - base;
+	int4 p = convert_int4(base);
+
+	float c000 = fieldSample(p, field, size, scale);
+	float c100 = fieldSample(p + (int4)(1, 0, 0, 0), field, size, scale);
+	float c010 = fieldSample(p + (int4)(0, 1, 0, 0), field, size, scale);
+	float c110 = fieldSample(p + (int4)(1, 1, 0, 0), field, size, scale);
+	float c001 = fieldSample(p + (int4)(0, 0, 1, 0), field, size, scale);
+	float c101 = fieldSample(p + (int4)(1, 0, 1, 0), field, size, scale);
+	float c011 = fieldSample(p + (int4)(0, 1, 1, 0), field, size, scale);
+	float c111 = fieldSample(p + (int4)(1, 1, 1, 0), field, size, scale);
+
+	float c00 = mix(c000, c100, t.x);
+	float c10 = mix(c010, c110, t.x);
+	float c01 = mix(c001, c101, t.x);
+	float c11 = mix(c011, c111, t.x);
+
+	return mix(mix(c00, c10, t.y), mix(c01, c11, t.y), t.z);
+}
+
+#elif defined(FIELD_SPH)
+
+// particles are binned into cells of the smoothing radius, up to SPH_CELL_CAPACITY
+// each, by kernelSphBin. a sample only visits the 27 cells around it.
+#define SPH_CELL_CAPACITY	32
+
+#define FIELD_PARAMS	int a_particleCount, global const float4* a_particles, global const uint* a_cellCounts, \
+						global const uint* a_cellParticles, int4 a_cellGrid, float a_radius
+#define FIELD_ARGS		a_particleCount, a_particles, a_cellCounts, a_cellParticles, a_cellGrid, a_radius
+#define FIELD_GRADIENT_STEP	0.01f
+
+// cell holding p, clamped to the grid
+int4 sphCell(float4 p, float radius, int4 cellGrid)
+{
+	int4 cell = convert_int4(floor(p / radius));
+	return clamp(cell, (int4)(0), cellGrid - (int4)(1));
+}
+
+size_t sphCellIndex(int4 cell, int4 cellGrid)
+{
+	return cell.x + cellGrid.x * ((size_t)cell.y + (size_t)cellGrid.y * cell.z);
+}
+
+// every particle adds (1 - r^2 / radius^2)^3 within the radius, a particle on its own
+// peaks at 1 and the inside of the fluid sums to several
+float sampleVolume(float4 v, FIELD_PARAMS)
+{
+	float radius2 = a_radius * a_radius;
+	int4 centre = sphCell(v, a_radius, a_cellGrid);
+	int4 first = max(centre - (int4)(1), (int4)(0));
+	int4 last = min(centre + (int4)(1), a_cellGrid - (int4)(1));
+	float d = 0;
+	for (int z = first.z; z <= last.z; ++z)
+		for (int y = first.y; y <= last.y; ++y)
+			for (int x = first.x; x <= last.x; ++x)
+			{
+				size_t cell = sphCellIndex((int4)(x, y, z, 0), a_cellGrid);
+				uint count = min(a_cellCounts[cell], (uint)SPH_CELL_CAPACITY);
+				for (uint i = 0; i < count; ++i)
+				{
+					float4 vp = v - a_particles[ a_cellParticles[cell * SPH_CELL_CAPACITY + i] ];
+					float q = 1.0f - dot(vp.xyz, vp.xyz) / radius2;
+					if (q > 0)
+						d += q * q * q;
+				}
+			}
+	return d;
+}
+
+float sampleCorner(float4 v, FIELD_PARAMS)
+{
+	return sampleVolume(v, FIELD_ARGS);
+}
+
+#else
+
+#define FIELD_PARAMS	int a_particleCount, read_only global float4* a_particles
+#define FIELD_ARGS		a_particleCount, a_particles
+#define FIELD_GRADIENT_STEP	0.01f
+
+// example volume (metaballs for now)
+float sampleVolume(float4 v,
+	int particleCount, read_only global float4* particles)
+{
+	float4 vp;
+	float d = 0;
+
+	for (int i = 0; i < particleCount; ++i)
+	{
+		vp = v - particles[i];
+		d += 1.0 / dot(vp.xyz, vp.xyz);
+	}
+
+	return d;
+}
+
+float sampleCorner(float4 v,
+	int particleCount, read_only global float4* particles)
+{
+	return sampleVolume(v, particleCount, particles);
+}
+
+#endif
@@ -1,7 +1,28 @@
 #include "gl_core_4_4.h"
+#include "adaptive.h"
+#include "batch.h"
+#include "clutil.h"
+#include "codec.h"
+#include "decimate.h"
+#include "edges.h"
+#include "engine.h"
+#include "export.h"
+#include "nets.h"
+#include "server.h"
+#include "sph.h"
+#include "stream.h"
+#include "sweep.h"
+#include "trace.h"
+#include "tune.h"
+#include "upload.h"
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 #include <GLFW/glfw3.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
 
 #ifdef __APPLE__
 	#include <OpenCL/cl_gl_ext.h>
@@ -15,13 +36,13 @@
 #endif
 
 #define STRINGIFY(str) #str
-#define CL_CHECK(result) if (result != CL_SUCCESS) { printf("Error: %i\n", result); }
 
 struct GLData
 {
 	GLuint	program;
 	GLuint	vao;
 	GLuint	vbo;
+	GLuint	ibo;	// surface net faces, 0 when drawing a triangle soup
 };
 
 struct MCData
@@ -30,10 +51,28 @@ struct MCData
 	cl_float		threshold;
 	unsigned int	maxFaces;
 	cl_uint	faceCount;
+	cl_float4		origin;		// world transform the kernels apply to vertices, see volumeOrigin
+	cl_float4		spacing;
+};
+
+// nested isosurfaces marched in one pass by kernelMCLevels, the output is split into
+// an equal slice of faces per threshold
+#define MAX_LEVELS 16
+
+struct LevelData
+{
+	cl_uint		count;
+	cl_float	thresholds[MAX_LEVELS];
+	cl_uint		faceCounts[MAX_LEVELS];	// per level, capped to the slice once read
+	cl_mem		thresholdLink;
+	cl_mem		faceCountLink;
 };
 
 struct CLData
 {
+	// the engine owns the context, the compute queue and the built programs, the rest
+	// of the viewer's objects are made on them
+	MarchingCubesEngine*	engine;
 	cl_context			context;
 	cl_command_queue	queue;
 	cl_program			program;
@@ -41,16 +80,1027 @@ struct CLData
 
 	cl_mem				vboLink;
 	cl_mem				faceCountLink;
-	cl_mem				particleLink;
+
+	// the viewer's uploads and readbacks go through their own queue, which a device
+	// with a copy engine runs alongside the extraction. the metaballs alternate
+	// between two particle buffers so the next frame's can be uploaded into one while
+	// the other is marched. 0 outside the viewer.
+	cl_command_queue	transfer;
+	cl_mem				particleLinks[2];
+
+	// when decimating, kernelMC writes into the dense buffers and the decimated mesh
+	// goes where it would have written. decimate is nullptr when it is off.
+	const DecimateSettings*	decimate;
+	cl_mem				denseLink;
+	cl_mem				denseCountLink;
+
+	// octree extraction in place of kernelMC, nullptr when the grid is uniform
+	const AdaptiveSettings*	adaptive;
+
+	// surface nets in place of kernelMC. the net is drawn indexed through iboLink unless
+	// it is decimated, iboLink is 0 whenever the vbo holds a triangle soup.
+	bool				nets;
+	cl_mem				iboLink;
+
+	// kernelMC's triangles with each crossed edge's vertex computed once, indexed and
+	// drawn like a net
+	bool				sharedEdges;
+
+	// every threshold marched at once, nullptr for the single threshold in MCData.
+	// the march kernel is then kernelMCLevels rather than kernelMC.
+	LevelData*			levels;
 };
 
+static const char* marchKernelName(const CLData& clData)
+{
+	return clData.levels != nullptr ? "kernelMCLevels" : "kernelMC";
+}
+
+static void createLevelBuffers(CLData& clData)
+{
+	LevelData& levels = *clData.levels;
+	cl_int result = CL_SUCCESS;
+	levels.thresholdLink = clCreateBuffer(clData.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(cl_float) * levels.count, levels.thresholds, &result);
+	CL_CHECK(result);
+	levels.faceCountLink = clCreateBuffer(clData.context, CL_MEM_READ_WRITE, sizeof(cl_uint) * levels.count, nullptr, &result);
+	CL_CHECK(result);
+}
+
+static void releaseLevelBuffers(LevelData& levels)
+{
+	clReleaseMemObject(levels.thresholdLink);
+	clReleaseMemObject(levels.faceCountLink);
+}
+
+// faces the last march produced as ranges of the output, one per level (or just the
+// one). returns the number of ranges.
+static cl_uint faceRanges(const CLData& clData, const MCData& mcData, cl_uint* first, cl_uint* count)
+{
+	if (clData.levels == nullptr)
+	{
+		first[0] = 0;
+		count[0] = glm::min(mcData.faceCount, mcData.maxFaces);
+		return 1;
+	}
+	cl_uint levelFaces = mcData.maxFaces / clData.levels->count;
+	for (cl_uint level = 0; level < clData.levels->count; ++level)
+	{
+		first[level] = level * levelFaces;
+		count[level] = clData.levels->faceCounts[level];
+	}
+	return clData.levels->count;
+}
+
+// caps the level counts read back to their slices, mcData.faceCount gets the total
+static void capLevelFaceCounts(CLData& clData, MCData& mcData)
+{
+	LevelData& levels = *clData.levels;
+	cl_uint levelFaces = mcData.maxFaces / levels.count;
+	mcData.faceCount = 0;
+	for (cl_uint level = 0; level < levels.count; ++level)
+	{
+		levels.faceCounts[level] = glm::min(levels.faceCounts[level], levelFaces);
+		mcData.faceCount += levels.faceCounts[level];
+	}
+}
+
+// reads back how many faces the march (or decimation) made. blocking level counts are
+// capped right away, a non-blocking read's with capLevelFaceCounts once it is done.
+static cl_int readFaceCounts(CLData& clData, cl_command_queue queue, MCData& mcData, cl_bool blocking, cl_uint waitCount,
+	const cl_event* waitEvents, cl_event* event = nullptr)
+{
+	if (clData.levels == nullptr)
+		return clEnqueueReadBuffer(queue, clData.faceCountLink, blocking, 0, sizeof(cl_uint), &mcData.faceCount, waitCount, waitEvents, event);
+
+	LevelData& levels = *clData.levels;
+	cl_int result = clEnqueueReadBuffer(queue, levels.faceCountLink, blocking, 0, sizeof(cl_uint) * levels.count, levels.faceCounts,
+		waitCount, waitEvents, event);
+	if (blocking)
+		capLevelFaceCounts(clData, mcData);
+	return result;
+}
+
+// GL buffers the extraction writes into, returns how many there are
+static cl_uint sharedObjects(const CLData& clData, cl_mem* objects)
+{
+	objects[0] = clData.vboLink;
+	objects[1] = clData.iboLink;
+	return clData.iboLink != 0 ? 2 : 1;
+}
+
+// runs the extraction over the whole grid into output and count: the engine's kernelMC
+// (or kernelMCLevels, counting into the level buffer instead), the adaptive mesher or
+// the surface net (which must then have been created). a net goes to output and
+// indices as is, or is expanded into output when indices is 0.
+static cl_int enqueueExtraction(CLData& clData, cl_kernel kernel, AdaptiveMesher& mesher, SurfaceNets& nets, SharedEdges& edges, const FieldArgs& field,
+	MCData& mcData, cl_mem output, cl_mem indices, cl_mem count, cl_uint waitCount, const cl_event* waitEvents, cl_event* event)
+{
+	cl_int result = CL_SUCCESS;
+	if (clData.levels != nullptr)
+	{
+		LevelData& levels = *clData.levels;
+		return clData.engine->enqueueMarchLevels(kernel, field, mcData.gridSize, mcData.origin, mcData.spacing, levels.thresholdLink,
+			levels.count, mcData.maxFaces / levels.count, output, levels.faceCountLink, waitCount, waitEvents, event);
+	}
+	if (clData.nets)
+	{
+		result |= setFieldArgs(nets.vertices, NETS_VERTICES_FIELD_ARG, field);
+		result |= setFieldArgs(nets.faces, NETS_FACES_FIELD_ARG, field);
+		if (indices != 0)
+			result |= enqueueSurfaceNets(nets, clData.queue, mcData.threshold, mcData.origin, mcData.spacing, output, indices, count, waitCount, waitEvents, event);
+		else
+			result |= enqueueSurfaceNetsSoup(nets, clData.queue, mcData.threshold, mcData.origin, mcData.spacing, output, count, waitCount, waitEvents, event);
+		return result;
+	}
+	if (clData.sharedEdges)
+	{
+		result |= setFieldArgs(edges.vertices, EDGES_VERTICES_FIELD_ARG, field);
+		result |= setFieldArgs(edges.faces, EDGES_FACES_FIELD_ARG, field);
+		if (indices != 0)
+			result |= enqueueSharedEdges(edges, clData.queue, mcData.threshold, mcData.origin, mcData.spacing, output, indices, count, waitCount, waitEvents, event);
+		else
+			result |= enqueueSharedEdgesSoup(edges, clData.queue, mcData.threshold, mcData.origin, mcData.spacing, output, count, waitCount, waitEvents, event);
+		return result;
+	}
+	if (clData.adaptive != nullptr)
+	{
+		result |= setFieldArgs(mesher.error, ADAPTIVE_ERROR_FIELD_ARG, field);
+		result |= setFieldArgs(mesher.march, ADAPTIVE_MARCH_FIELD_ARG, field);
+		result |= marchAdaptive(mesher, clData.queue, *clData.adaptive, mcData.threshold, mcData.origin, mcData.spacing, (cl_int)mcData.maxFaces, count, output,
+			waitCount, waitEvents, event);
+		return result;
+	}
+
+	return clData.engine->enqueueMarch(kernel, field, mcData.gridSize, mcData.origin, mcData.spacing, mcData.threshold, mcData.maxFaces,
+		output, count, waitCount, waitEvents, event);
+}
+
+// scratch buffers for kernelMC's full output when it is decimated
+static void createDenseOutput(CLData& clData, cl_uint maxFaces)
+{
+	cl_int result = CL_SUCCESS;
+	clData.denseLink = clCreateBuffer(clData.context, CL_MEM_READ_WRITE, sizeof(cl_float4) * 6 * maxFaces, nullptr, &result);
+	CL_CHECK(result);
+	clData.denseCountLink = clCreateBuffer(clData.context, CL_MEM_READ_WRITE, sizeof(cl_uint), nullptr, &result);
+	CL_CHECK(result);
+}
+
+// decimates the dense buffers into output, counting into faceCountLink. event is the
+// march to wait for on the way in and the decimation's own event on the way out.
+static cl_int decimateMarch(CLData& clData, Decimator& decimator, const MCData& mcData, cl_mem output, cl_event* event)
+{
+	cl_event marchEvent = *event;
+	cl_int result = enqueueDecimate(decimator, clData.queue, *clData.decimate, mcData.gridSize, mcData.origin, mcData.spacing,
+		clData.denseLink, clData.denseCountLink, output, mcData.maxFaces, clData.faceCountLink,
+		marchEvent != 0 ? 1 : 0, marchEvent != 0 ? &marchEvent : nullptr, event);
+	if (marchEvent != 0)
+		clReleaseEvent(marchEvent);
+	return result;
+}
+
+// a grid position in the world space the kernels emit
+static glm::vec3 worldPoint(const MCData& mcData, glm::vec3 point)
+{
+	return point * glm::vec3(mcData.spacing.s[0], mcData.spacing.s[1], mcData.spacing.s[2]) +
+		glm::vec3(mcData.origin.s[0], mcData.origin.s[1], mcData.origin.s[2]);
+}
+
+static glm::vec3 cameraTarget(const MCData& mcData)
+{
+	return worldPoint(mcData, glm::vec3(mcData.gridSize[0] / 2, mcData.gridSize[1] / 2, mcData.gridSize[2] / 2));
+}
+
+// the camera circles the grid
+static glm::vec3 cameraEye(const MCData& mcData, float time)
+{
+	float radius = mcData.gridSize[0] * mcData.spacing.s[0];
+	return cameraTarget(mcData) + glm::vec3(sin(time) * radius, 0, cos(time) * radius);
+}
+
+// our sample volume is made of meta balls (they were placed based on a 128^3 grid)
+static void placeParticles(glm::vec4* particles, const size_t* gridSize, float time)
+{
+	float scale = gridSize[0] / (float)128;
+	particles[0] = glm::vec4(gridSize[0], gridSize[1], gridSize[2], 0)  * 0.5f;
+	particles[1] = glm::vec4(sin(time) * 32, cos(time * 0.5f) * 32, sin(time * 2) * 16, 0) * scale + particles[0];
+	particles[2] = glm::vec4(cos(-time * 0.25f) * 8, cos(time * 0.5f), cos(time) * 32, 0) * scale + particles[0];
+	particles[3] = glm::vec4(sin(time) * 32, cos(time * 0.5f) * 32, cos(-time * 2) * 16, 0) * scale + particles[0];
+	particles[4] = glm::vec4(sin(time) * 16, sin(time * 1.5f) * 16, sin(time * 2) * 32, 0) * scale + particles[0];
+	particles[5] = glm::vec4(cos(time * 0.3f) * 32, cos(time * 1.5f) * 32, sin(time * 2) * 32, 0) * scale + particles[0];
+	particles[6] = glm::vec4(sin(time) * 16, sin(time * 1.5f) * 16, sin(time * 2) * 32, 0) * scale + particles[0];
+	particles[7] = glm::vec4(sin(-time) * 32, sin(time * 1.5f) * 32, cos(time * 4) * 32, 0) * scale + particles[0];
+}
+
+struct StreamTarget
+{
+	MCData*		mcData;
+	MeshWriter*	writer;
+};
+
+// streamed triangles are exported in full and appended to the vbo until it is full
+static void appendToVBO(const cl_float4* vertices, cl_uint faceCount, void* userData)
+{
+	StreamTarget& target = *(StreamTarget*)userData;
+	MCData& mcData = *target.mcData;
+	if (target.writer->isOpen())
+		target.writer->write(vertices, faceCount);
+
+	if (mcData.faceCount + faceCount > mcData.maxFaces)
+		faceCount = mcData.maxFaces - mcData.faceCount;
+
+	glBufferSubData(GL_ARRAY_BUFFER, sizeof(cl_float4) * 6 * mcData.faceCount, sizeof(cl_float4) * 6 * faceCount, vertices);
+	mcData.faceCount += faceCount;
+}
+
+// hands the mesh in the vbo to the writer, an indexed mesh is expanded into a soup
+// first. only the readback is waited on, the file is written on the writer's thread.
+static void exportVBO(CLData& clData, MCData& mcData, SurfaceNets& nets, SharedEdges& edges, MeshWriter& writer)
+{
+	cl_uint faceCount = glm::min(mcData.faceCount, mcData.maxFaces);
+	cl_uint rangeFirst[MAX_LEVELS], rangeCount[MAX_LEVELS];
+	cl_uint rangeTotal = faceRanges(clData, mcData, rangeFirst, rangeCount);
+	cl_mem objects[2];
+	cl_uint objectCount = sharedObjects(clData, objects);
+	cl_int result = clEnqueueAcquireGLObjects(clData.queue, objectCount, objects, 0, 0, 0);
+	CL_CHECK(result);
+	if (clData.iboLink != 0 && faceCount > 0)
+	{
+		cl_mem soup = clCreateBuffer(clData.context, CL_MEM_READ_WRITE, sizeof(cl_float4) * 6 * faceCount, nullptr, &result);
+		CL_CHECK(result);
+		result = enqueueExpandFaces(clData.nets ? nets.expand : edges.expand, clData.queue, clData.vboLink, clData.iboLink, clData.faceCountLink, faceCount, soup, 0, nullptr, 0);
+		CL_CHECK(result);
+		writer.write(clData.queue, soup, faceCount);
+		clReleaseMemObject(soup);
+	}
+	else
+	{
+		for (cl_uint range = 0; range < rangeTotal; ++range)
+			writer.write(clData.queue, clData.vboLink, rangeCount[range], 0, nullptr, rangeFirst[range]);
+	}
+	result = clEnqueueReleaseGLObjects(clData.queue, objectCount, objects, 0, 0, 0);
+	CL_CHECK(result);
+	clFinish(clData.queue);
+}
+
+// marches a volume that fits in memory in one pass, the kernel reads the samples
+// straight out of the mapped file or out of a bricked or image copy, by storage
+static bool marchVolume(CLData& clData, cl_device_id device, MCData& mcData, Volume& volume, VolumeStorage storage)
+{
+	cl_int result = CL_SUCCESS;
+	cl_program program = clData.engine->program(volumeBuildOptions(volume, storage));
+	if (program == 0)
+		return false;
+
+	// everything starts out 0, a failed step skips the rest and the end releases
+	// whatever was created
+	cl_kernel kernel = clCreateKernel(program, marchKernelName(clData), &result);
+	CL_CHECK(result);
+	cl_mem fieldLink = kernel != 0 ? createVolumeField(clData.context, device, volume, storage, &result) : 0;
+	CL_CHECK(result);
+	bool created = fieldLink != 0;
+
+	Decimator decimator = {};
+	AdaptiveMesher mesher = {};
+	SurfaceNets nets = {};
+	SharedEdges edges = {};
+	created = created && (clData.decimate == nullptr || createDecimator(decimator, clData.context, program, mcData.maxFaces));
+	created = created && (clData.adaptive == nullptr || createAdaptiveMesher(mesher, clData.context, program, mcData.gridSize));
+	created = created && (!clData.nets || createSurfaceNets(nets, clData.context, program, mcData.gridSize, mcData.maxFaces));
+	created = created && (!clData.sharedEdges || createSharedEdges(edges, clData.context, program, mcData.gridSize, mcData.maxFaces));
+
+	if (created)
+	{
+		cl_mem marchOutput = clData.decimate != nullptr ? clData.denseLink : clData.vboLink;
+		cl_mem marchCount = clData.decimate != nullptr ? clData.denseCountLink : clData.faceCountLink;
+
+		cl_int4 fieldSize = { { (cl_int)volume.size[0], (cl_int)volume.size[1], (cl_int)volume.size[2], 1 } };
+		FieldArgs field = volumeFieldArgs(fieldLink, fieldSize, volumeNormalization(volume, storage));
+		mcData.faceCount = 0;
+
+		cl_mem objects[2];
+		cl_uint objectCount = sharedObjects(clData, objects);
+		result = clEnqueueAcquireGLObjects(clData.queue, objectCount, objects, 0, 0, 0);
+		result |= clEnqueueWriteBuffer(clData.queue, marchCount, CL_FALSE, 0, sizeof(cl_uint), &mcData.faceCount, 0, nullptr, 0);
+		result |= enqueueExtraction(clData, kernel, mesher, nets, edges, field, mcData, marchOutput, clData.iboLink, marchCount, 0, nullptr, 0);
+		if (clData.decimate != nullptr)
+		{
+			cl_event decimateEvent = 0;
+			result |= decimateMarch(clData, decimator, mcData, clData.vboLink, &decimateEvent);
+			clReleaseEvent(decimateEvent);
+		}
+		result |= clEnqueueReleaseGLObjects(clData.queue, objectCount, objects, 0, 0, 0);
+		result |= readFaceCounts(clData, clData.queue, mcData, CL_TRUE, 0, nullptr);
+		CL_CHECK(result);
+
+		if (mcData.faceCount > mcData.maxFaces)
+			mcData.faceCount = mcData.maxFaces;
+	}
+
+	releaseDecimator(decimator);
+	releaseAdaptiveMesher(mesher);
+	releaseSurfaceNets(nets);
+	releaseSharedEdges(edges);
+	releaseMemObject(fieldLink);
+	releaseKernel(kernel);
+	return created && result == CL_SUCCESS;
+}
+
+// streamed triangles only go to the file when there is no window
+static void appendToWriter(const cl_float4* vertices, cl_uint faceCount, void* userData)
+{
+	((MeshWriter*)userData)->write(vertices, faceCount);
+}
+
+// any device will do without a window, a cpu one when preferCPU is set and there is one
+static cl_device_id offlineDevice(bool preferCPU)
+{
+	cl_platform_id platform;
+	cl_int result = clGetPlatformIDs(1, &platform, 0);
+	CL_CHECK(result);
+
+	cl_device_id device = 0;
+	if (!preferCPU || clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &device, 0) != CL_SUCCESS)
+	{
+		result = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 1, &device, 0);
+		CL_CHECK(result);
+	}
+	if (result != CL_SUCCESS)
+		return 0;
+
+	char deviceName[256] = "";
+	clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(deviceName), deviceName, 0);
+	printf("Exporting with %s\n", deviceName);
+	return device;
+}
+
+// an engine on the offline device, properties are its queue's
+static bool initOfflineEngine(MarchingCubesEngine& engine, bool preferCPU, cl_command_queue_properties properties)
+{
+	cl_device_id device = offlineDevice(preferCPU);
+	if (device == 0)
+		return false;
+
+	cl_int result = CL_SUCCESS;
+	cl_context context = clCreateContext(nullptr, 1, &device, 0, 0, &result);
+	CL_CHECK(result);
+	if (context == 0)
+		return false;
+	bool initialised = engine.init(context, device, nullptr, properties);
+	clReleaseContext(context);
+	return initialised;
+}
+
+// exports one mesh without a window or GL. any device will do (a cpu one when
+// preferCPU is set), the volume, or the metaballs at time 0, is marched once.
+// in-core ply exports are marched straight into the mapped file, everything else
+// goes through a MeshWriter.
+static bool exportOffline(MCData& mcData, Volume* volume, bool stream, bool sweep, VolumeStorage storage, const StreamSettings& streamSettings,
+	const DecimateSettings* decimateSettings, const AdaptiveSettings* adaptiveSettings, bool nets, bool sharedEdges, LevelData* levels,
+	TuningDatabase& tuning, const char* exportPath, MeshFormat exportFormat, bool preferCPU)
+{
+	MarchingCubesEngine engine;
+	if (!initOfflineEngine(engine, preferCPU, tuning.tune ? CL_QUEUE_PROFILING_ENABLE : 0))
+		return false;
+	cl_device_id device = engine.device();
+	openTuning(tuning, device);
+	engine.setTuning(&tuning);
+
+	cl_int result = CL_SUCCESS;
+	CLData clData = {};
+	clData.engine = &engine;
+	clData.context = engine.context();
+	clData.queue = engine.queue();
+	clData.decimate = decimateSettings;
+	clData.adaptive = adaptiveSettings;
+	clData.nets = nets;
+	clData.sharedEdges = sharedEdges;
+	clData.levels = levels;
+
+	bool exported = false;
+	if (volume != nullptr && stream)
+	{
+		if (decimateSettings != nullptr || adaptiveSettings != nullptr || nets || sharedEdges || levels != nullptr)
+			printf("Streamed volumes are marched uniformly with kernelMC at one threshold and aren't decimated!\n");
+		MeshWriter writer;
+		if (writer.open(clData.context, clData.queue, exportPath, exportFormat))
+			exported = (sweep ? sweepVolume : streamVolume)(clData.context, device, clData.queue, *volume, streamSettings, appendToWriter, &writer);
+		exported = writer.close() && exported;
+	}
+	else
+	{
+		clData.program = engine.program(volume != nullptr ? volumeBuildOptions(*volume, storage) : nullptr);
+		if (clData.program != 0)
+		{
+			clData.kernel = clCreateKernel(clData.program, marchKernelName(clData), &result);
+			CL_CHECK(result);
+			if (levels != nullptr)
+				createLevelBuffers(clData);
+
+			// levels leave gaps between their slices, they are written range by range
+			MappedMeshFile mappedFile;
+			MeshWriter writer;
+			cl_mem output = 0;
+			bool mapped = exportFormat == MESH_PLY && levels == nullptr;
+			if (mapped)
+			{
+				if (mappedFile.open(clData.context, exportPath, mcData.maxFaces))
+					output = mappedFile.vertices();
+			}
+			else if (writer.open(clData.context, clData.queue, exportPath, exportFormat))
+			{
+				output = clCreateBuffer(clData.context, CL_MEM_WRITE_ONLY, sizeof(cl_float4) * 6 * mcData.maxFaces, nullptr, &result);
+				CL_CHECK(result);
+			}
+
+			Decimator decimator;
+			if (decimateSettings != nullptr)
+			{
+				createDenseOutput(clData, mcData.maxFaces);
+				if (!createDecimator(decimator, clData.context, clData.program, mcData.maxFaces))
+					output = 0;
+			}
+			AdaptiveMesher mesher;
+			if (adaptiveSettings != nullptr && !createAdaptiveMesher(mesher, clData.context, clData.program, mcData.gridSize))
+				output = 0;
+			SurfaceNets surfaceNets;
+			if (nets && !createSurfaceNets(surfaceNets, clData.context, clData.program, mcData.gridSize, mcData.maxFaces))
+				output = 0;
+			SharedEdges edges;
+			if (sharedEdges && !createSharedEdges(edges, clData.context, clData.program, mcData.gridSize, mcData.maxFaces))
+				output = 0;
+
+			if (output != 0)
+			{
+				static const cl_uint zero = 0;
+				clData.faceCountLink = clCreateBuffer(clData.context, CL_MEM_READ_WRITE, sizeof(cl_uint), nullptr, &result);
+				CL_CHECK(result);
+				cl_mem marchOutput = decimateSettings != nullptr ? clData.denseLink : output;
+				cl_mem marchCount = decimateSettings != nullptr ? clData.denseCountLink : clData.faceCountLink;
+				result = clEnqueueWriteBuffer(clData.queue, marchCount, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, nullptr, 0);
+
+				const int particleCount = 8;
+				glm::vec4 particles[particleCount];
+				FieldArgs field;
+				if (volume != nullptr)
+				{
+					cl_int4 fieldSize = { { (cl_int)volume->size[0], (cl_int)volume->size[1], (cl_int)volume->size[2], 1 } };
+					field = volumeFieldArgs(createVolumeField(clData.context, device, *volume, storage, &result), fieldSize,
+						volumeNormalization(*volume, storage));
+					CL_CHECK(result);
+				}
+				else
+				{
+					placeParticles(particles, mcData.gridSize, 0);
+					field = particleFieldArgs(clCreateBuffer(clData.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(glm::vec4) * particleCount,
+						particles, &result), particleCount);
+					CL_CHECK(result);
+				}
+
+				result |= enqueueExtraction(clData, clData.kernel, mesher, surfaceNets, edges, field, mcData, marchOutput, 0, marchCount, 0, nullptr, 0);
+				if (decimateSettings != nullptr)
+				{
+					cl_event decimateEvent = 0;
+					result |= decimateMarch(clData, decimator, mcData, output, &decimateEvent);
+					clReleaseEvent(decimateEvent);
+				}
+				result |= readFaceCounts(clData, clData.queue, mcData, CL_TRUE, 0, nullptr);
+				CL_CHECK(result);
+				printf("Marched %u faces\n", mcData.faceCount);
+
+				if (mapped)
+					exported = mappedFile.close(clData.queue, result == CL_SUCCESS ? mcData.faceCount : 0);
+				else
+				{
+					cl_uint rangeFirst[MAX_LEVELS], rangeCount[MAX_LEVELS];
+					cl_uint rangeTotal = faceRanges(clData, mcData, rangeFirst, rangeCount);
+					for (cl_uint range = 0; range < rangeTotal; ++range)
+						writer.write(clData.queue, output, rangeCount[range], 0, nullptr, rangeFirst[range]);
+					exported = writer.close();
+					clReleaseMemObject(output);
+				}
+				exported = exported && result == CL_SUCCESS;
+
+				clReleaseMemObject(field.field);
+				clReleaseMemObject(clData.faceCountLink);
+			}
+			if (decimateSettings != nullptr)
+			{
+				releaseDecimator(decimator);
+				clReleaseMemObject(clData.denseLink);
+				clReleaseMemObject(clData.denseCountLink);
+			}
+			if (adaptiveSettings != nullptr)
+				releaseAdaptiveMesher(mesher);
+			if (nets)
+				releaseSurfaceNets(surfaceNets);
+			if (sharedEdges)
+				releaseSharedEdges(edges);
+			if (levels != nullptr)
+				releaseLevelBuffers(*levels);
+			clReleaseKernel(clData.kernel);
+		}
+	}
+
+	engine.shutdown();
+	saveTuning(tuning);
+	return exported;
+}
+
+// marches an in-core volume with kernelMC from each storage the device can hold it in
+// and prints the kernel's time, a side by side of the layouts' cache behaviour. the
+// first march of each is a warm-up, the others are timed by profiling events.
+static bool benchmarkStorage(MCData& mcData, Volume& volume, int runs, bool preferCPU)
+{
+	static const char* STORAGE_NAMES[] = { "linear", "bricked", "image" };
+	MarchingCubesEngine engine;
+	if (!initOfflineEngine(engine, preferCPU, CL_QUEUE_PROFILING_ENABLE))
+		return false;
+	cl_device_id device = engine.device();
+
+	cl_int result = CL_SUCCESS;
+	CLData clData = {};
+	clData.engine = &engine;
+	clData.context = engine.context();
+	clData.queue = engine.queue();
+	clData.faceCountLink = clCreateBuffer(clData.context, CL_MEM_READ_WRITE, sizeof(cl_uint), nullptr, &result);
+	CL_CHECK(result);
+	cl_mem output = clCreateBuffer(clData.context, CL_MEM_WRITE_ONLY, sizeof(cl_float4) * 6 * mcData.maxFaces, nullptr, &result);
+	CL_CHECK(result);
+
+	double cubes = (double)mcData.gridSize[0] * mcData.gridSize[1] * mcData.gridSize[2];
+	bool benchmarked = result == CL_SUCCESS;
+	for (int storage = VOLUME_LINEAR; storage <= VOLUME_IMAGE && benchmarked; ++storage)
+	{
+		VolumeStorage volumeStorage = (VolumeStorage)storage;
+		cl_program program = engine.program(volumeBuildOptions(volume, volumeStorage));
+		if (program == 0)
+		{
+			benchmarked = false;
+			break;
+		}
+		cl_kernel kernel = clCreateKernel(program, "kernelMC", &result);
+		CL_CHECK(result);
+		cl_int4 fieldSize = { { (cl_int)volume.size[0], (cl_int)volume.size[1], (cl_int)volume.size[2], 1 } };
+		FieldArgs field = volumeFieldArgs(createVolumeField(clData.context, device, volume, volumeStorage, &result), fieldSize,
+			volumeNormalization(volume, volumeStorage));
+		if (field.field == 0)
+			printf("%-8s skipped\n", STORAGE_NAMES[storage]);
+		else
+		{
+			double best = -1, total = 0;
+			for (int run = 0; run <= runs && result == CL_SUCCESS; ++run)
+			{
+				cl_event event = 0;
+				result = engine.enqueueMarch(kernel, field, mcData.gridSize, mcData.origin, mcData.spacing, mcData.threshold, mcData.maxFaces,
+					output, clData.faceCountLink, 0, nullptr, &event);
+				result |= readFaceCounts(clData, clData.queue, mcData, CL_TRUE, 0, nullptr);
+				CL_CHECK(result);
+
+				cl_ulong begin = 0, end = 0;
+				clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(begin), &begin, nullptr);
+				clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+				clReleaseEvent(event);
+				double time = (end - begin) / 1.0e6;
+				if (run == 0)
+					continue;
+				total += time;
+				if (best < 0 || time < best)
+					best = time;
+			}
+			if (result == CL_SUCCESS && runs > 0)
+				printf("%-8s %9.3f ms best %9.3f ms mean %8.1f Mcubes/s %u faces\n", STORAGE_NAMES[storage], best, total / runs,
+					cubes / (best * 1000), mcData.faceCount);
+			benchmarked = result == CL_SUCCESS;
+			clReleaseMemObject(field.field);
+		}
+		clReleaseKernel(kernel);
+	}
+
+	releaseMemObject(output);
+	releaseMemObject(clData.faceCountLink);
+	return benchmarked;
+}
+
+// counts the integer conversions (%d or %i, with flags and a width) in a -batch export
+// path, -1 when it holds any other conversion. %% is a plain percent sign.
+static int indexConversions(const char* pattern)
+{
+	int conversions = 0;
+	for (const char* c = strchr(pattern, '%'); c != nullptr; c = strchr(c, '%'))
+	{
+		if (c[1] == '%')
+		{
+			c += 2;
+			continue;
+		}
+		c += 1 + strspn(c + 1, "-+ #0");
+		c += strspn(c, "0123456789");
+		if (*c != 'd' && *c != 'i')
+			return -1;
+		++conversions;
+		++c;
+	}
+	return conversions;
+}
+
+// exports a list of small volumes (one header path per line) without a window. the
+// volumes are marched in batches of one dispatch each, a batch fills up to the memory
+// budget in samples, and in vertices to the budget and the device's largest buffer.
+// exportPath can hold a printf pattern for the volume's index (mesh%04d.ply),
+// otherwise every mesh goes into the one file.
+static bool exportBatch(const char* listPath, const MCData& mcData, size_t memoryBudget, const char* exportPath,
+	MeshFormat exportFormat, bool preferCPU)
+{
+	// the path is handed to snprintf, it may only hold the index
+	int conversions = indexConversions(exportPath);
+	if (conversions < 0 || conversions > 1)
+	{
+		printf("%s can only hold one %%d for the volume's index!\n", exportPath);
+		return false;
+	}
+	bool perVolume = conversions == 1;
+
+	std::vector<std::string> paths;
+	FILE* list = fopen(listPath, "r");
+	if (list == nullptr)
+	{
+		printf("Failed to open batch list %s!\n", listPath);
+		return false;
+	}
+	char line[4096];
+	while (fgets(line, sizeof(line), list) != nullptr)
+	{
+		size_t length = strcspn(line, "\r\n");
+		line[length] = 0;
+		if (length > 0)
+			paths.push_back(line);
+	}
+	fclose(list);
+	if (paths.empty())
+		return false;
+
+	std::vector<Volume> volumes(paths.size());
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		if (!openVolume(volumes[i], paths[i].c_str()))
+		{
+			for (size_t j = 0; j < i; ++j)
+				closeVolume(volumes[j]);
+			return false;
+		}
+	}
+
+	MarchingCubesEngine engine;
+	bool exported = initOfflineEngine(engine, preferCPU, 0);
+	cl_int result = CL_SUCCESS;
+	cl_context context = engine.context();
+	cl_command_queue queue = engine.queue();
+	cl_program program = exported ? engine.program(volumeBuildOptions(volumes[0])) : 0;
+	exported = exported && program != 0;
+
+	Batch batch = {};
+	exported = exported && createBatch(batch, context, program, volumes[0].type);
+	size_t batchFaces = exported ? batchFaceBudget(engine.device(), memoryBudget) : 0;
+
+	MeshWriter writer;
+	if (exported && !perVolume)
+		exported = writer.open(context, queue, exportPath, exportFormat);
+
+	size_t totalFaces = 0;
+	size_t first = 0;
+	while (exported && first < volumes.size())
+	{
+		// at least one volume per batch, however large
+		size_t last = first;
+		clearBatch(batch);
+		while (last < volumes.size() &&
+			(last == first || (batch.samples.size() + volumeBytes(volumes[last]) <= memoryBudget && batch.faceCount + mcData.maxFaces <= batchFaces)))
+		{
+			if (!addToBatch(batch, volumes[last], mcData.threshold, mcData.maxFaces))
+				break;
+			++last;
+		}
+		if (last == first)
+		{
+			exported = false;
+			break;
+		}
+
+		// one dispatch and one wait for the whole batch
+		result = enqueueBatch(batch, queue, 0, nullptr, nullptr);
+		result |= clFinish(queue);
+		CL_CHECK(result);
+		exported = result == CL_SUCCESS;
+
+		for (size_t i = first; i < last && exported; ++i)
+		{
+			const BatchVolume& entry = batch.volumes[i - first];
+			cl_uint faceCount = glm::min(batch.faceCounts[i - first], entry.maxFaces);
+			totalFaces += faceCount;
+			if (perVolume)
+			{
+				char path[4096];
+				MeshWriter volumeWriter;
+				exported = snprintf(path, sizeof(path), exportPath, (int)i) < (int)sizeof(path) &&
+					volumeWriter.open(context, queue, path, exportFormat);
+				if (exported)
+					volumeWriter.write(queue, batch.vertices, faceCount, 0, nullptr, entry.faceOffset);
+				exported = volumeWriter.close() && exported;
+			}
+			else
+				writer.write(queue, batch.vertices, faceCount, 0, nullptr, entry.faceOffset);
+		}
+
+		// the next batch reuses the buffers, the single file's reads must be done first
+		clFinish(queue);
+		first = last;
+	}
+	if (writer.isOpen())
+		exported = writer.close() && exported;
+	printf("Marched %zu faces from %zu volumes\n", totalFaces, volumes.size());
+
+	if (batch.kernel != 0)
+		releaseBatch(batch);
+	engine.shutdown();
+	for (size_t i = 0; i < volumes.size(); ++i)
+		closeVolume(volumes[i]);
+	return exported;
+}
+
+// reads an .mcz file back block by block and reports what it holds. with an exportPath
+// the faces are expanded into a soup again and written there, an .mcz becomes a PLY, STL
+// or OBJ, or another .mcz that should hold the same faces.
+static bool decodeMesh(const char* decodePath, const char* exportPath, MeshFormat exportFormat, bool preferCPU)
+{
+	MeshDecoder decoder;
+	if (!decoder.open(decodePath))
+		return false;
+
+	MarchingCubesEngine engine;
+	MeshWriter writer;
+	if (exportPath != nullptr && (!initOfflineEngine(engine, preferCPU, 0) ||
+		!writer.open(engine.context(), engine.queue(), exportPath, exportFormat)))
+	{
+		engine.shutdown();
+		return false;
+	}
+
+	MeshBlock block;
+	std::vector<cl_float4> soup;
+	size_t blockCount = 0;
+	size_t vertexCount = 0;
+	size_t faceCount = 0;
+	while (decoder.next(block))
+	{
+		cl_uint blockFaces = (cl_uint)(block.indices.size() / 3);
+		++blockCount;
+		vertexCount += block.vertices.size() / 2;
+		faceCount += blockFaces;
+		if (writer.isOpen())
+		{
+			soup.resize(block.indices.size() * 2);
+			for (size_t i = 0; i < block.indices.size(); ++i)
+			{
+				soup[i * 2] = block.vertices[block.indices[i] * 2];
+				soup[i * 2 + 1] = block.vertices[block.indices[i] * 2 + 1];
+			}
+			writer.write(soup.data(), blockFaces);
+		}
+	}
+	bool decoded = !decoder.failed();
+	printf("%s: %zu blocks, %zu vertices, %zu faces%s\n", decodePath, blockCount, vertexCount, faceCount, decoded ? "" : " before it turned out corrupt");
+
+	if (writer.isOpen())
+		decoded = writer.close() && decoded;
+	engine.shutdown();
+	return decoded;
+}
+
 int main(int argc, char* argv[])
 {
-	MCData mcData = { { 64, 64, 64 }, 0.04f, 250000, 0 };
-	GLData glData = { 0 };
-	CLData clData;
+	MCData mcData = { { 64, 64, 64 }, 0.04f, 250000, 0, { { 0, 0, 0, 0 } }, { { 1, 1, 1, 1 } } };
+	GLData glData = {};
+	CLData clData = {};
 	const int particleCount = 8;
-	glm::vec4 particles[particleCount];
+
+	// optional volume, marched once at startup instead of animating the metaballs.
+	// it is streamed when it doesn't fit the memory budget (or -stream is given).
+	const char* volumePath = nullptr;
+	const char* batchPath = nullptr;
+	const char* servePath = nullptr;
+	const char* decodePath = nullptr;
+	size_t rawSize[3] = { 0, 0, 0 };
+	VoxelType rawType = VOXEL_FLOAT;
+	bool forceStream = false;
+	bool sweep = false;
+	VolumeStorage storage = VOLUME_LINEAR;
+	int benchmarkRuns = 0;
+	bool offline = false;
+	bool preferCPU = false;
+	const char* exportPath = nullptr;
+	MeshFormat exportFormat = MESH_PLY;
+	const char* tracePath = nullptr;
+	TuningDatabase tuning;
+	tuning.path = "tuning.json";
+	tuning.tune = false;
+	StreamSettings streamSettings = { 256 * 1024 * 1024, 0, 0 };
+	DecimateSettings decimateSettings = { 0, 0 };
+	AdaptiveSettings adaptiveSettings = { -1, { 0, 0, 0 }, 0 };
+	LevelData levels = {};
+	SphSettings sphSettings = { 0, 2, 0, 30000, 4, 50, 0.002f, 8 };
+	bool thresholdGiven = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-volume") == 0 && i + 1 < argc)
+		{
+			volumePath = argv[++i];
+			for (int axis = 0; axis < 3 && i + 1 < argc && isdigit(argv[i + 1][0]); ++axis)
+				rawSize[axis] = (size_t)atol(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-type") == 0 && i + 1 < argc)
+		{
+			if (!parseVoxelType(argv[++i], rawType))
+			{
+				printf("Unknown sample type %s!\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strcmp(argv[i], "-export") == 0 && i + 1 < argc)
+		{
+			exportPath = argv[++i];
+			if (!meshFormatFromPath(exportPath, exportFormat))
+			{
+				printf("Can't export to %s, use .ply, .stl, .obj or .mcz!\n", exportPath);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strcmp(argv[i], "-batch") == 0 && i + 1 < argc)
+			batchPath = argv[++i];
+		else if (strcmp(argv[i], "-serve") == 0 && i + 1 < argc)
+			servePath = argv[++i];
+		else if (strcmp(argv[i], "-decode") == 0 && i + 1 < argc)
+			decodePath = argv[++i];
+		else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc)
+			tracePath = argv[++i];
+		else if (strcmp(argv[i], "-tune") == 0)
+			tuning.tune = true;
+		else if (strcmp(argv[i], "-tuning") == 0 && i + 1 < argc)
+			tuning.path = argv[++i];
+		else if (strcmp(argv[i], "-stream") == 0)
+			forceStream = true;
+		else if (strcmp(argv[i], "-sweep") == 0)
+			sweep = forceStream = true;
+		else if (strcmp(argv[i], "-image") == 0)
+			storage = VOLUME_IMAGE;
+		else if (strcmp(argv[i], "-bricked") == 0)
+			storage = VOLUME_BRICKED;
+		else if (strcmp(argv[i], "-benchmark") == 0 && i + 1 < argc)
+			benchmarkRuns = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-offline") == 0)
+			offline = true;
+		else if (strcmp(argv[i], "-cpu") == 0)
+			preferCPU = true;
+		else if (strcmp(argv[i], "-maxfaces") == 0 && i + 1 < argc)
+			mcData.maxFaces = (unsigned int)atol(argv[++i]);
+		else if (strcmp(argv[i], "-decimate") == 0 && i + 1 < argc)
+			decimateSettings.targetFaces = (cl_uint)atol(argv[++i]);
+		else if (strcmp(argv[i], "-tolerance") == 0 && i + 1 < argc)
+			decimateSettings.tolerance = (cl_float)atof(argv[++i]);
+		else if (strcmp(argv[i], "-adaptive") == 0 && i + 1 < argc)
+			adaptiveSettings.tolerance = (cl_float)atof(argv[++i]);
+		else if (strcmp(argv[i], "-focus") == 0 && i + 1 < argc)
+			adaptiveSettings.focusDistance = (cl_float)atof(argv[++i]);
+		else if (strcmp(argv[i], "-nets") == 0)
+			clData.nets = true;
+		else if (strcmp(argv[i], "-edges") == 0)
+			clData.sharedEdges = true;
+		else if (strcmp(argv[i], "-levels") == 0 && i + 1 < argc)
+		{
+			// comma separated thresholds
+			const char* list = argv[++i];
+			char* end = nullptr;
+			levels.count = 0;
+			while (levels.count < MAX_LEVELS)
+			{
+				levels.thresholds[levels.count++] = (cl_float)strtod(list, &end);
+				if (*end != ',')
+					break;
+				list = end + 1;
+			}
+		}
+		else if (strcmp(argv[i], "-threshold") == 0 && i + 1 < argc)
+		{
+			mcData.threshold = (cl_float)atof(argv[++i]);
+			thresholdGiven = true;
+		}
+		else if (strcmp(argv[i], "-sph") == 0 && i + 1 < argc)
+			sphSettings.particleCount = (cl_uint)atol(argv[++i]);
+		else if (strcmp(argv[i], "-budget") == 0 && i + 1 < argc)
+			streamSettings.memoryBudget = (size_t)atol(argv[++i]) * 1024 * 1024;
+		else if (strcmp(argv[i], "-brick") == 0 && i + 1 < argc)
+			streamSettings.brickSize = (size_t)atol(argv[++i]);
+	}
+	bool sph = sphSettings.particleCount > 0;
+	if (sph && (volumePath != nullptr || offline || batchPath != nullptr))
+	{
+		printf("The fluid is only simulated in the viewer without a volume, ignoring -sph!\n");
+		sph = false;
+	}
+	// the fluid's field sums to about 5 inside it and 1 around a lone particle
+	if (sph && !thresholdGiven)
+		mcData.threshold = 1.0f;
+	streamSettings.threshold = mcData.threshold;
+	bool decimate = decimateSettings.targetFaces > 0 || decimateSettings.tolerance > 0;
+	clData.decimate = decimate ? &decimateSettings : nullptr;
+	bool adaptive = adaptiveSettings.tolerance >= 0;
+	if (clData.nets && clData.sharedEdges)
+	{
+		printf("Surface nets place their own vertices, ignoring -edges!\n");
+		clData.sharedEdges = false;
+	}
+	if (adaptive && (clData.nets || clData.sharedEdges))
+	{
+		printf("Surface nets and shared edges aren't adaptive, ignoring -adaptive!\n");
+		adaptive = false;
+	}
+	clData.adaptive = adaptive ? &adaptiveSettings : nullptr;
+	if (levels.count > 0)
+	{
+		if (decimate || adaptive || clData.nets || clData.sharedEdges)
+		{
+			printf("Multiple thresholds are marched with kernelMC, ignoring -decimate, -adaptive, -nets and -edges!\n");
+			decimate = adaptive = clData.nets = clData.sharedEdges = false;
+			clData.decimate = nullptr;
+			clData.adaptive = nullptr;
+		}
+		clData.levels = &levels;
+	}
+
+	// reads a compressed mesh back, no window and no march
+	if (decodePath != nullptr)
+		exit(decodeMesh(decodePath, exportPath, exportFormat, preferCPU) ? EXIT_SUCCESS : EXIT_FAILURE);
+
+	// extraction daemon, no window. clients bring their own volumes and particles.
+	if (servePath != nullptr)
+	{
+		MarchingCubesEngine engine;
+		if (!(preferCPU && engine.init(CL_DEVICE_TYPE_CPU)) && !engine.init())
+			exit(EXIT_FAILURE);
+		openTuning(tuning, engine.device());
+		engine.setTuning(&tuning);
+		ExtractionServer server(engine);
+		if (!server.listen(servePath))
+			exit(EXIT_FAILURE);
+		printf("Serving extractions on %s\n", servePath);
+		server.run();
+		saveTuning(tuning);
+		exit(EXIT_SUCCESS);
+	}
+
+	Volume volume;
+	if (volumePath != nullptr)
+	{
+		bool opened = rawSize[2] != 0 ?
+			openRawVolume(volume, volumePath, rawSize[0], rawSize[1], rawSize[2], rawType) :
+			openVolume(volume, volumePath);
+		if (!opened)
+			exit(EXIT_FAILURE);
+		for (int axis = 0; axis < 3; ++axis)
+			mcData.gridSize[axis] = volume.size[axis] - 1;
+		mcData.origin = volumeOrigin(volume);
+		mcData.spacing = volumeSpacing(volume);
+	}
+
+	if (benchmarkRuns > 0)
+	{
+		if (volumePath == nullptr)
+		{
+			printf("-benchmark needs a -volume!\n");
+			exit(EXIT_FAILURE);
+		}
+		bool benchmarked = benchmarkStorage(mcData, volume, benchmarkRuns, preferCPU);
+		closeVolume(volume);
+		exit(benchmarked ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	// batch export, no window
+	if (offline || batchPath != nullptr)
+	{
+		if (exportPath == nullptr)
+		{
+			printf("-offline and -batch need an -export file!\n");
+			exit(EXIT_FAILURE);
+		}
+		if (batchPath != nullptr)
+			exit(exportBatch(batchPath, mcData, streamSettings.memoryBudget, exportPath, exportFormat, preferCPU) ? EXIT_SUCCESS : EXIT_FAILURE);
+
+		bool stream = volumePath != nullptr && (forceStream || volumeBytes(volume) > streamSettings.memoryBudget);
+		bool exported = exportOffline(mcData, volumePath != nullptr ? &volume : nullptr, stream, sweep, storage, streamSettings,
+			clData.decimate, clData.adaptive, clData.nets, clData.sharedEdges, clData.levels, tuning, exportPath, exportFormat, preferCPU);
+		if (volumePath != nullptr)
+			closeVolume(volume);
+		exit(exported ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
 
 	// window creation and OpenGL initialisaion
 	if (!glfwInit())
@@ -130,6 +1180,14 @@ int main(int argc, char* argv[])
     glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4) * 2, 0);
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 4, GL_FLOAT, GL_TRUE, sizeof(glm::vec4) * 2, ((char*)0) + sizeof(glm::vec4));
+
+	// surface nets and shared edges are drawn indexed, the element buffer belongs to the vao
+	if ((clData.nets || clData.sharedEdges) && !decimate)
+	{
+		glGenBuffers(1, &glData.ibo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glData.ibo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * 3 * mcData.maxFaces, 0, GL_STATIC_DRAW);
+	}
     glBindVertexArray(0);
 
 	glBindVertexArray(0);
@@ -161,6 +1219,8 @@ int main(int argc, char* argv[])
 		glm::vec4(mcData.gridSize[0], mcData.gridSize[1], 0, 1),						glm::vec4(1),
 		glm::vec4(mcData.gridSize[0], mcData.gridSize[1], mcData.gridSize[2], 1),		glm::vec4(1)
 	};
+	for (int i = 0; i < 48; i += 2)
+		lines[i] = glm::vec4(worldPoint(mcData, glm::vec3(lines[i])), 1);
 
 	GLuint boxVBO, boxVAO;
 	glGenBuffers(1, &boxVBO);
@@ -197,37 +1257,13 @@ int main(int argc, char* argv[])
     // find a device that supports GL interop
     cl_uint glDevice = 0;
     bool glDeviceFound = false;
-    for (cl_uint i = 0 ; i < numDevices ; ++i)
+    for (cl_uint i = 0 ; i < numDevices && !glDeviceFound ; ++i)
     {
-        size_t extensionSize = 0;
-        result = clGetDeviceInfo(devices[i], CL_DEVICE_EXTENSIONS, 0, nullptr, &extensionSize);
-        CL_CHECK(result);
-        
-        if (result == CL_SUCCESS)
+        if (hasExtension(devices[i], "cl_khr_gl_sharing") ||
+            hasExtension(devices[i], "cl_APPLE_gl_sharing"))
         {
-            char* extensions = new char[extensionSize];
-            result = clGetDeviceInfo(devices[i], CL_DEVICE_EXTENSIONS, extensionSize, extensions, &extensionSize);
-            CL_CHECK(result);
-
-            std::string devString(extensions);
-            delete[] extensions;
-            
-            size_t oldPos = 0;
-            size_t spacePos = devString.find(' ', oldPos);
-            while (spacePos != devString.npos)
-            {
-                if (strcmp("cl_khr_gl_sharing", devString.substr(oldPos, spacePos - oldPos).c_str()) == 0 ||
-                	strcmp("cl_APPLE_gl_sharing", devString.substr(oldPos, spacePos - oldPos).c_str()) == 0)
-                {
-                    glDevice = i;
-                    glDeviceFound = true;
-                    break;
-                }
-                do {
-                    oldPos = spacePos + 1;
-                    spacePos = devString.find(' ', oldPos);
-                } while (spacePos == oldPos);
-            }
+            glDevice = i;
+            glDeviceFound = true;
         }
     }
     
@@ -258,148 +1294,353 @@ int main(int argc, char* argv[])
     };
 #endif
     
-    clData.context = clCreateContext(contextProperties, numDevices, devices, 0, 0, &result);
-    CL_CHECK(result);
-
-    clData.queue = clCreateCommandQueue(clData.context, devices[glDevice], 0, &result);
+    cl_context context = clCreateContext(contextProperties, numDevices, devices, 0, 0, &result);
     CL_CHECK(result);
 
-	// load kernel code
-	FILE* file = fopen("./mc.cl", "rb");
-	if (file == nullptr)
-	{
-		printf("Failed to load kernel file mc.cl!\n");
+	// tracing reads the commands' timestamps back. the engine runs the extraction on the
+	// GL sharing context.
+	Tracer tracer;
+	if (tracePath != nullptr && !tracer.open(tracePath))
 		exit(EXIT_FAILURE);
-	}
-	fseek(file, 0, SEEK_END);
-	size_t size = ftell(file);
-	fseek(file, 0, SEEK_SET);
-	char* kernelSource = new char[size];
-	fread(kernelSource, sizeof(char), size, file);
-	fclose(file);
+	MarchingCubesEngine engine;
+	bool initialised = context != 0 &&
+		engine.init(context, devices[glDevice], nullptr, tracer.isOpen() || tuning.tune ? CL_QUEUE_PROFILING_ENABLE : 0);
+	if (context != 0)
+		clReleaseContext(context);
+	if (!initialised)
+		exit(EXIT_FAILURE);
+	openTuning(tuning, devices[glDevice]);
+	engine.setTuning(&tuning);
+	clData.engine = &engine;
+	clData.context = engine.context();
+	clData.queue = engine.queue();
+	clData.transfer = clCreateCommandQueue(clData.context, devices[glDevice],
+		tracer.isOpen() ? CL_QUEUE_PROFILING_ENABLE : 0, &result);
+	CL_CHECK(result);
 
 	// build program and extract kernel
-	clData.program = clCreateProgramWithSource(clData.context, 1, (const char**)&kernelSource, &size, &result);
-	delete[] kernelSource;
-	CL_CHECK(result);
-	result = clBuildProgram(clData.program, 1, &devices[glDevice], 0, 0, 0);
-	if (result != CL_SUCCESS)
+	clData.program = engine.program(sph ? "-D FIELD_SPH" : nullptr);
+	if (clData.program == 0)
 	{
-		size_t len = 0;
-		clGetProgramBuildInfo(clData.program, devices[glDevice], CL_PROGRAM_BUILD_LOG, 0, 0, &len);
-		char* log = new char[len];
-		clGetProgramBuildInfo(clData.program, devices[glDevice], CL_PROGRAM_BUILD_LOG, len, log, 0);
-		printf("Kernel error:\n%s\n", log);
-		delete[] log;
-
-		clReleaseProgram(clData.program);
-		clReleaseCommandQueue(clData.queue);
-		clReleaseContext(clData.context);
+		clReleaseCommandQueue(clData.transfer);
+		engine.shutdown();
 
 		exit(EXIT_FAILURE);
 	}
-	CL_CHECK(result);
-	clData.kernel = clCreateKernel(clData.program, "kernelMC", &result);
+	clData.kernel = clCreateKernel(clData.program, marchKernelName(clData), &result);
 	CL_CHECK(result);
 
 	// cl mem objects
 	clData.vboLink = clCreateFromGLBuffer(clData.context, CL_MEM_WRITE_ONLY, glData.vbo, &result);
 	CL_CHECK(result);
+	if (glData.ibo != 0)
+	{
+		clData.iboLink = clCreateFromGLBuffer(clData.context, CL_MEM_WRITE_ONLY, glData.ibo, &result);
+		CL_CHECK(result);
+	}
 	clData.faceCountLink = clCreateBuffer(clData.context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, sizeof(cl_uint), &mcData.faceCount, &result);
 	CL_CHECK(result);
-	clData.particleLink = clCreateBuffer(clData.context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(glm::vec4) * particleCount, particles, &result);
-	CL_CHECK(result);
+	for (int i = 0; i < 2; ++i)
+	{
+		clData.particleLinks[i] = clCreateBuffer(clData.context, CL_MEM_READ_ONLY, sizeof(glm::vec4) * particleCount, nullptr, &result);
+		CL_CHECK(result);
+	}
+	UploadRing particleRing;
+	bool animate = volumePath == nullptr && !sph;
+	if (animate && !createUploadRing(particleRing, clData.context, clData.transfer, sizeof(glm::vec4) * particleCount))
+		exit(EXIT_FAILURE);
+	if (clData.levels != nullptr)
+		createLevelBuffers(clData);
+
+	Decimator decimator = {};
+	if (decimate)
+	{
+		createDenseOutput(clData, mcData.maxFaces);
+		if (!createDecimator(decimator, clData.context, clData.program, mcData.maxFaces))
+			exit(EXIT_FAILURE);
+	}
+	AdaptiveMesher mesher;
+	if (adaptive && volumePath == nullptr && !createAdaptiveMesher(mesher, clData.context, clData.program, mcData.gridSize))
+		exit(EXIT_FAILURE);
+	SurfaceNets nets;
+	if (clData.nets && !createSurfaceNets(nets, clData.context, clData.program, mcData.gridSize, mcData.maxFaces))
+		exit(EXIT_FAILURE);
+	SharedEdges edges;
+	if (clData.sharedEdges && !createSharedEdges(edges, clData.context, clData.program, mcData.gridSize, mcData.maxFaces))
+		exit(EXIT_FAILURE);
+	SphSimulation fluid;
+	if (sph && !createSphSimulation(fluid, clData.context, clData.queue, clData.program, mcData.gridSize, sphSettings))
+		exit(EXIT_FAILURE);
+
+	MeshWriter writer;
+	if (exportPath != nullptr && !writer.open(clData.context, clData.queue, exportPath, exportFormat))
+		exit(EXIT_FAILURE);
+
+	// march the whole volume up front, the loop then only draws it
+	if (volumePath != nullptr)
+	{
+		bool marched = false;
+		if (forceStream || volumeBytes(volume) > streamSettings.memoryBudget)
+		{
+			if (decimate || adaptive || clData.nets || clData.sharedEdges || clData.levels != nullptr)
+				printf("Streamed volumes are marched uniformly with kernelMC at one threshold and aren't decimated!\n");
+			clData.levels = nullptr;
+
+			// bricks arrive as triangle soups
+			if (clData.iboLink != 0)
+			{
+				clReleaseMemObject(clData.iboLink);
+				clData.iboLink = 0;
+			}
+			StreamTarget target = { &mcData, &writer };
+			glBindBuffer(GL_ARRAY_BUFFER, glData.vbo);
+			marched = (sweep ? sweepVolume : streamVolume)(clData.context, devices[glDevice], clData.queue, volume, streamSettings, appendToVBO, &target);
+		}
+		else
+		{
+			marched = marchVolume(clData, devices[glDevice], mcData, volume, storage);
+			if (marched && writer.isOpen())
+				exportVBO(clData, mcData, nets, edges, writer);
+		}
+		closeVolume(volume);
+		writer.close();
+		if (!marched)
+			exit(EXIT_FAILURE);
+	}
 	
+	// the draws are timed by a query read back a frame later, once they are done
+	GLuint drawQuery = 0;
+	bool drawQueried = false;
+	double drawIssued = 0;
+	if (tracer.isOpen())
+		glGenQueries(1, &drawQuery);
+
+	// the first frame's particles, later frames' go up during the frame before
+	unsigned int frame = 0;
+	float lastTime = (float)glfwGetTime();
+	cl_event particleUpload = 0;
+	if (animate)
+	{
+		placeParticles((glm::vec4*)nextUploadSlot(particleRing), mcData.gridSize, lastTime);
+		result = enqueueUpload(particleRing, clData.transfer, clData.particleLinks[0], sizeof(glm::vec4) * particleCount, 0, nullptr, &particleUpload);
+		CL_CHECK(result);
+		clFlush(clData.transfer);
+	}
+
 	// loop
+	bool frameExported = false;
 	while (!glfwWindowShouldClose(window) && 
 		   !glfwGetKey(window, GLFW_KEY_ESCAPE)) 
 	{
 		float time = (float)glfwGetTime();
+		double frameStart = tracer.now();
 
-		// our sample volume is made of meta balls (they were placed based on a 128^3 grid)
-		float scale = mcData.gridSize[0] / (float)128;
-		particles[0] = glm::vec4(mcData.gridSize[0], mcData.gridSize[1], mcData.gridSize[2], 0)  * 0.5f;
-		particles[1] = glm::vec4(sin(time) * 32, cos(time * 0.5f) * 32, sin(time * 2) * 16, 0) * scale + particles[0];
-		particles[2] = glm::vec4(cos(-time * 0.25f) * 8, cos(time * 0.5f), cos(time) * 32, 0) * scale + particles[0];
-		particles[3] = glm::vec4(sin(time) * 32, cos(time * 0.5f) * 32, cos(-time * 2) * 16, 0) * scale + particles[0];
-		particles[4] = glm::vec4(sin(time) * 16, sin(time * 1.5f) * 16, sin(time * 2) * 32, 0) * scale + particles[0];
-		particles[5] = glm::vec4(cos(time * 0.3f) * 32, cos(time * 1.5f) * 32, sin(time * 2) * 32, 0) * scale + particles[0];
-		particles[6] = glm::vec4(sin(time) * 16, sin(time * 1.5f) * 16, sin(time * 2) * 32, 0) * scale + particles[0];
-		particles[7] = glm::vec4(sin(-time) * 32, sin(time * 1.5f) * 32, cos(time * 4) * 32, 0) * scale + particles[0];
-
-		// ensure GL is complete
-		glFinish();
-
-		// reset CL and acquire mem objects
-		mcData.faceCount = 0;
-		cl_event writeEvents[3] = { 0, 0, 0 };
+		// animate the metaballs or the fluid, a volume was already marched
+		if (volumePath == nullptr)
+		{
+			// ensure GL is complete
+			double waitStart = tracer.now();
+			glFinish();
+			tracer.hostSpan("glFinish", waitStart, tracer.now());
 
-		cl_int result = clEnqueueAcquireGLObjects(clData.queue, 1, &clData.vboLink, 0, 0, &writeEvents[0]);
-		CL_CHECK(result);
-		result = clEnqueueWriteBuffer(clData.queue, clData.faceCountLink, CL_FALSE, 0, sizeof(unsigned int), &mcData.faceCount, 0, nullptr, &writeEvents[1]);
-		CL_CHECK(result);
-		result = clEnqueueWriteBuffer(clData.queue, clData.particleLink, CL_FALSE, 0, sizeof(glm::vec4) * particleCount, particles, 0, nullptr, &writeEvents[2]);
-		CL_CHECK(result);
+			// reset CL and acquire mem objects
+			mcData.faceCount = 0;
+			cl_event writeEvents[3] = { 0, 0, 0 };
 
-		result = clSetKernelArg(clData.kernel, 0, sizeof(cl_int), &mcData.maxFaces);
-		result |= clSetKernelArg(clData.kernel, 1, sizeof(cl_mem), &clData.faceCountLink);
-		result |= clSetKernelArg(clData.kernel, 2, sizeof(cl_mem), &clData.vboLink);
-		result |= clSetKernelArg(clData.kernel, 3, sizeof(cl_float), &mcData.threshold);
-		result |= clSetKernelArg(clData.kernel, 4, sizeof(cl_int), &particleCount);
-		result |= clSetKernelArg(clData.kernel, 5, sizeof(cl_mem), &clData.particleLink);
-		CL_CHECK(result);
+			cl_mem objects[2];
+			cl_uint objectCount = sharedObjects(clData, objects);
+			cl_int result = clEnqueueAcquireGLObjects(clData.queue, objectCount, objects, 0, 0, &writeEvents[0]);
+			CL_CHECK(result);
+			tracer.command("acquire", writeEvents[0]);
+			cl_mem marchOutput = decimate ? clData.denseLink : clData.vboLink;
+			cl_mem marchCount = decimate ? clData.denseCountLink : clData.faceCountLink;
+			result = clEnqueueWriteBuffer(clData.queue, marchCount, CL_FALSE, 0, sizeof(unsigned int), &mcData.faceCount, 0, nullptr, &writeEvents[1]);
+			CL_CHECK(result);
+			tracer.command("write count", writeEvents[1]);
+			if (sph)
+			{
+				// the fluid moves on the device, nothing is uploaded
+				result = enqueueSphStep(fluid, clData.queue, 0, nullptr, &writeEvents[2]);
+				CL_CHECK(result);
+				tracer.command("sph step", writeEvents[2]);
+			}
+			else
+			{
+				// enqueued on the transfer queue during the last frame
+				writeEvents[2] = particleUpload;
+				particleUpload = 0;
+				tracer.command("upload particles", writeEvents[2]);
+			}
 
-		// march dem cubes!
-		cl_event processEvent = 0;
-		result = clEnqueueNDRangeKernel(clData.queue, clData.kernel, 3, 0, mcData.gridSize, 0, 3, writeEvents, &processEvent);
-		CL_CHECK(result);
+			// the octree refines towards the camera, it measures in cubes
+			glm::vec3 eye = (cameraEye(mcData, time) - worldPoint(mcData, glm::vec3(0))) /
+				glm::vec3(mcData.spacing.s[0], mcData.spacing.s[1], mcData.spacing.s[2]);
+			adaptiveSettings.eye[0] = eye.x;
+			adaptiveSettings.eye[1] = eye.y;
+			adaptiveSettings.eye[2] = eye.z;
 
-		// give GL the vertex data back
-		result = clEnqueueReleaseGLObjects(clData.queue, 1, &clData.vboLink, 1, &processEvent, 0);
-		CL_CHECK(result);
+			// march dem cubes!
+			FieldArgs field = sph ? sphFieldArgs(fluid) : particleFieldArgs(clData.particleLinks[frame & 1], particleCount);
+			cl_event processEvent = 0;
+			result = enqueueExtraction(clData, clData.kernel, mesher, nets, edges, field, mcData, marchOutput, clData.iboLink, marchCount,
+				3, writeEvents, &processEvent);
+			CL_CHECK(result);
+			tracer.command(clData.nets ? "surface nets" : clData.sharedEdges ? "shared edges" : (clData.adaptive != nullptr ? "kernelMCAdaptive" : marchKernelName(clData)), processEvent);
 
-		// read how many triangles to draw
-		result = clEnqueueReadBuffer(clData.queue, clData.faceCountLink, CL_FALSE, 0, sizeof(unsigned int), &mcData.faceCount, 1, &processEvent, 0);
-		CL_CHECK(result);
+			// thin the mesh out before GL gets it
+			if (decimate)
+			{
+				result = decimateMarch(clData, decimator, mcData, clData.vboLink, &processEvent);
+				CL_CHECK(result);
+				tracer.command("decimate", processEvent);
+			}
+
+			// the next frame's particles, placed for when it is expected to start, go into
+			// the other buffer while this frame's are marched. its last march is done.
+			if (animate)
+			{
+				placeParticles((glm::vec4*)nextUploadSlot(particleRing), mcData.gridSize, time + (time - lastTime));
+				result = enqueueUpload(particleRing, clData.transfer, clData.particleLinks[(frame + 1) & 1], sizeof(glm::vec4) * particleCount,
+					0, nullptr, &particleUpload);
+				CL_CHECK(result);
+				clFlush(clData.transfer);
+			}
 
-		// wait until cl has finished before we draw
-		clFinish(clData.queue);
+			// give GL the vertex data back
+			cl_event releaseEvent = 0, readEvent = 0;
+			result = clEnqueueReleaseGLObjects(clData.queue, objectCount, objects, 1, &processEvent, &releaseEvent);
+			CL_CHECK(result);
+			tracer.command("release", releaseEvent);
+
+			// the transfer queue waits on this frame's commands, they have to be submitted
+			clFlush(clData.queue);
+
+			// read how many triangles to draw
+			result = readFaceCounts(clData, clData.transfer, mcData, CL_FALSE, 1, &processEvent, &readEvent);
+			CL_CHECK(result);
+			tracer.command("read count", readEvent);
+
+			// wait until cl has finished this frame before we draw, the next frame's upload
+			// carries on
+			double finishStart = tracer.now();
+			cl_event frameEvents[2] = { releaseEvent, readEvent };
+			clWaitForEvents(2, frameEvents);
+			tracer.hostSpan("clWaitForEvents", finishStart, tracer.now());
+			if (clData.levels != nullptr)
+				capLevelFaceCounts(clData, mcData);
+			tracer.flush();
+			for (int i = 0; i < 3; ++i)
+				if (writeEvents[i] != 0)
+					clReleaseEvent(writeEvents[i]);
+			if (releaseEvent != 0)
+				clReleaseEvent(releaseEvent);
+			if (readEvent != 0)
+				clReleaseEvent(readEvent);
+
+			// the first frame is exported, the writer finishes the file in the background
+			if (writer.isOpen() && !frameExported)
+			{
+				exportVBO(clData, mcData, nets, edges, writer);
+				frameExported = true;
+			}
+			lastTime = time;
+			++frame;
+		}
 
 		// draw
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		// target center of grid and spin the camera
-		glm::vec3 target(mcData.gridSize[0] / 2, mcData.gridSize[1] / 2, mcData.gridSize[2] / 2);
-		glm::vec3 eye(sin(time) * mcData.gridSize[0], 0, cos(time) * mcData.gridSize[0]);
-		glm::mat4 pvm = glm::perspective(glm::radians(90.0f), 16 / 9.f, 0.1f, 2000.f) * glm::lookAt(target + eye, target, glm::vec3(0, 1, 0));
+		glm::mat4 pvm = glm::perspective(glm::radians(90.0f), 16 / 9.f, 0.1f, 2000.f) *
+			glm::lookAt(cameraEye(mcData, time), cameraTarget(mcData), glm::vec3(0, 1, 0));
 
 		glUniformMatrix4fv(pvmUniform, 1, GL_FALSE, glm::value_ptr(pvm));
 
+		// last frame's draws are long done
+		if (drawQueried)
+		{
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(drawQuery, GL_QUERY_RESULT, &elapsed);
+			tracer.gpuSpan("draw", drawIssued, elapsed);
+			drawQueried = false;
+		}
+		if (drawQuery != 0)
+		{
+			drawIssued = tracer.now();
+			glBeginQuery(GL_TIME_ELAPSED, drawQuery);
+		}
+
 		// draw blob
 		glBindVertexArray(glData.vao);
-		glDrawArrays(GL_TRIANGLES, 0, glm::min(mcData.faceCount, mcData.maxFaces) * 3);
+		if (clData.iboLink != 0)
+			glDrawElements(GL_TRIANGLES, glm::min(mcData.faceCount, mcData.maxFaces) * 3, GL_UNSIGNED_INT, 0);
+		else
+		{
+			// one slice per level
+			cl_uint rangeFirst[MAX_LEVELS], rangeCount[MAX_LEVELS];
+			cl_uint rangeTotal = faceRanges(clData, mcData, rangeFirst, rangeCount);
+			for (cl_uint range = 0; range < rangeTotal; ++range)
+				glDrawArrays(GL_TRIANGLES, rangeFirst[range] * 3, rangeCount[range] * 3);
+		}
 		
 		// white box around grid
 		glBindVertexArray(boxVAO);
 		glDrawArrays(GL_LINES, 0, 48);
+		if (drawQuery != 0)
+		{
+			glEndQuery(GL_TIME_ELAPSED);
+			drawQueried = true;
+		}
 
 		// present
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+		tracer.hostSpan("frame", frameStart, tracer.now());
 	}
 
 	// cleanup cl
+	writer.close();
+	tracer.close();
+	if (drawQuery != 0)
+		glDeleteQueries(1, &drawQuery);
 	clFinish(clData.queue);
+	clFinish(clData.transfer);
+	if (decimate)
+	{
+		releaseDecimator(decimator);
+		clReleaseMemObject(clData.denseLink);
+		clReleaseMemObject(clData.denseCountLink);
+	}
+	if (adaptive && volumePath == nullptr)
+		releaseAdaptiveMesher(mesher);
+	if (clData.nets)
+		releaseSurfaceNets(nets);
+	if (clData.sharedEdges)
+		releaseSharedEdges(edges);
+	if (sph)
+		releaseSphSimulation(fluid);
+	if (particleUpload != 0)
+		clReleaseEvent(particleUpload);
+	if (animate)
+		releaseUploadRing(particleRing, clData.transfer);
+	clReleaseMemObject(clData.particleLinks[0]);
+	clReleaseMemObject(clData.particleLinks[1]);
+	if (clData.iboLink != 0)
+		clReleaseMemObject(clData.iboLink);
+	if (levels.count > 0)
+		releaseLevelBuffers(levels);
 	clReleaseMemObject(clData.vboLink);
 	clReleaseMemObject(clData.faceCountLink);
 	clReleaseKernel(clData.kernel);
-	clReleaseProgram(clData.program);
-	clReleaseCommandQueue(clData.queue);
-	clReleaseContext(clData.context);
+	clReleaseCommandQueue(clData.transfer);
+	engine.shutdown();
+	saveTuning(tuning);
 	delete[] devices;
 
 	// cleanup gl
 	glDeleteBuffers(1, &glData.vbo);
+	if (glData.ibo != 0)
+		glDeleteBuffers(1, &glData.ibo);
 	glDeleteVertexArrays(1, &glData.vao);
 	glDeleteProgram(glData.program);
 	glfwTerminate();
@@ -20,6 +20,15 @@ constant float4 EDGE_DIRECTIONS[12] =
 	{ 0.0f, 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f }
 };
 
+// lattice edge of each cube edge, for passes that share edges between cubes: the
+// corner it starts from (x, y, z) and its axis (w)
+constant int4 LATTICE_EDGES[12] =
+{
+	{ 0, 0, 0, 0 }, { 1, 0, 0, 1 }, { 0, 1, 0, 0 }, { 0, 0, 0, 1 },
+	{ 0, 0, 1, 0 }, { 1, 0, 1, 1 }, { 0, 1, 1, 0 }, { 0, 0, 1, 1 },
+	{ 0, 0, 0, 2 }, { 1, 0, 0, 2 }, { 1, 1, 0, 2 }, { 0, 1, 0, 2 }
+};
+
 constant int EDGE_FLAGS[256] =
 {
 	0x000, 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c, 0x80c, 0x905, 0xa0f, 0xb06, 0xc0a, 0xd03, 0xe09, 0xf00, 
@@ -300,55 +309,106 @@ constant int TRIANGLE_TABLE[256][16] =
 	{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}
 };
 
-// example volume (metaballs for now)
-float sampleVolume(float4 v, 
-	int particleCount, read_only global float4* particles)
+// bit per corner at or below the threshold, indexes EDGE_FLAGS and TRIANGLE_TABLE
+int cubeFlags(const float* cornerVolumes, float threshold)
 {
-	float4 vp;
-	float d = 0;
-	
-	for (int i = 0; i < particleCount; ++i)
-	{
-		vp = v - particles[i];
-		d += 1.0 / dot(vp.xyz, vp.xyz);
-	} 
+	int flagIndex = 0;
+	for (int i = 0; i < 8; ++i)
+		if (cornerVolumes[i] <= threshold)
+			flagIndex |= (1 << i);
+	return flagIndex;
+}
+
+// where the surface crosses an edge of a cube with the given edge length
+float4 edgeVertex(float4 cubeCorner, float size, const float* cornerVolumes, int edgeIndex, float threshold)
+{
+	float offset;
+	float delta = cornerVolumes[ EDGE_INDICES[ edgeIndex ][1] ] - cornerVolumes[ EDGE_INDICES[ edgeIndex ][0] ];
+	if (delta == 0.0)
+		offset = 0.5;
+	else
+		offset = (threshold - cornerVolumes[ EDGE_INDICES[ edgeIndex ][0] ]) / delta;
 
-	return d;
+	float4 position = cubeCorner + (CUBE_CORNERS[ EDGE_INDICES[ edgeIndex ][0] ] + EDGE_DIRECTIONS[ edgeIndex ] * offset) * size;
+	position.w = 1.0f;
+	return position;
 }
 
-kernel void kernelMC(int a_maxFaces,
-					 write_only global uint* a_faceCount, // atomic index into vertices
-					 write_only global float4* a_vertices,
-					 float a_threshold,
-					 int a_particleCount,
-					 read_only global float4* a_particles)
+// surface normal from the field's central differences
+float4 fieldNormal(float4 position, FIELD_PARAMS)
 {
-	// lower corner
-	float4 cubeCorner = (float4)(get_global_id(0), get_global_id(1), get_global_id(2), 0.0f);
+	const float d = FIELD_GRADIENT_STEP;
+	float4 normal;
+	normal.x = sampleVolume(position - (float4)(d, 0, 0, 0), FIELD_ARGS) -
+		sampleVolume(position + (float4)(d, 0, 0, 0), FIELD_ARGS);
+	normal.y = sampleVolume(position - (float4)(0, d, 0, 0), FIELD_ARGS) -
+		sampleVolume(position + (float4)(0, d, 0, 0), FIELD_ARGS);
+	normal.z = sampleVolume(position - (float4)(0, 0, d, 0), FIELD_ARGS) -
+		sampleVolume(position + (float4)(0, 0, d, 0), FIELD_ARGS);
+	normal.w = 0;
 
-	// store a local copy of the cube's corner volumes
-	float cornerVolumes[8];	
-	cornerVolumes[0] = sampleVolume(cubeCorner + CUBE_CORNERS[0], a_particleCount, a_particles);
-	cornerVolumes[1] = sampleVolume(cubeCorner + CUBE_CORNERS[1], a_particleCount, a_particles);
-	cornerVolumes[2] = sampleVolume(cubeCorner + CUBE_CORNERS[2], a_particleCount, a_particles);
-	cornerVolumes[3] = sampleVolume(cubeCorner + CUBE_CORNERS[3], a_particleCount, a_particles);
-	cornerVolumes[4] = sampleVolume(cubeCorner + CUBE_CORNERS[4], a_particleCount, a_particles);
-	cornerVolumes[5] = sampleVolume(cubeCorner + CUBE_CORNERS[5], a_particleCount, a_particles);
-	cornerVolumes[6] = sampleVolume(cubeCorner + CUBE_CORNERS[6], a_particleCount, a_particles);
-	cornerVolumes[7] = sampleVolume(cubeCorner + CUBE_CORNERS[7], a_particleCount, a_particles);
-	
-	// find which corners are inside/outside the volume
-	int flagIndex = 0;	
-	if (cornerVolumes[ 0 ] <= a_threshold)	flagIndex = (1 << 0);
-	if (cornerVolumes[ 1 ] <= a_threshold)	flagIndex |= (1 << 1);
-	if (cornerVolumes[ 2 ] <= a_threshold)	flagIndex |= (1 << 2);
-	if (cornerVolumes[ 3 ] <= a_threshold)	flagIndex |= (1 << 3);
-	if (cornerVolumes[ 4 ] <= a_threshold)	flagIndex |= (1 << 4);
-	if (cornerVolumes[ 5 ] <= a_threshold)	flagIndex |= (1 << 5);
-	if (cornerVolumes[ 6 ] <= a_threshold)	flagIndex |= (1 << 6);
-	if (cornerVolumes[ 7 ] <= a_threshold)	flagIndex |= (1 << 7);
+	if ( dot(normal,normal) > 0 )
+		normal = normalize(normal);
+	return normal;
+}
 
-	float offset, delta;
+// grid to world space: spacing scales the grid (w = 1, positions keep theirs) and
+// origin is where grid position 0 lands. the field is always sampled on the grid.
+float4 worldPosition(float4 position, float4 origin, float4 spacing)
+{
+	return position * spacing + origin;
+}
+
+// normals scale inversely to stay perpendicular to a stretched surface
+float4 worldNormal(float4 normal, float4 spacing)
+{
+	normal /= spacing;
+	if (dot(normal, normal) > 0)
+		normal = normalize(normal);
+	return normal;
+}
+
+// sub-groups, where the device has them, let a whole sub-group reserve its faces with
+// one atomic. define MC_NO_SUBGROUPS when building to always use one atomic per cube.
+#if !defined(MC_NO_SUBGROUPS) && (defined(cl_khr_subgroups) || defined(cl_intel_subgroups))
+#ifdef cl_khr_subgroups
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif
+#define MC_SUBGROUPS
+#endif
+
+// triangles in a cube of this configuration, up to five
+int cubeFaces(int flagIndex)
+{
+	int faces = 0;
+	while (faces < 5 && TRIANGLE_TABLE[ flagIndex ][ 3 * faces ] >= 0)
+		++faces;
+	return faces;
+}
+
+// reserves faces on the counter and returns the first. with sub-groups the lanes'
+// offsets come from an exclusive scan and only the first lane touches the counter,
+// its result is broadcast to the rest. every lane of the sub-group must call it (with
+// 0 faces if need be) on the same counter.
+uint reserveFaces(global uint* faceCount, uint faces)
+{
+#ifdef MC_SUBGROUPS
+	uint offset = sub_group_scan_exclusive_add(faces);
+	uint total = sub_group_reduce_add(faces);
+	uint first = 0;
+	if (get_sub_group_local_id() == 0 && total > 0)
+		first = atomic_add(faceCount, total);
+	return sub_group_broadcast(first, 0) + offset;
+#else
+	return faces > 0 ? atomic_add(faceCount, faces) : 0;
+#endif
+}
+
+// writes the cube's triangles from firstFace on, those past maxFaces are dropped.
+// vertices are written in world space, see worldPosition.
+void emitCube(float4 cubeCorner, const float* cornerVolumes, int flagIndex, float threshold, float4 origin, float4 spacing,
+			  uint firstFace, int maxFaces, global float4* vertices, FIELD_PARAMS)
+{
 	float4 edgePosition[12];
 	float4 edgeNormal[12];
 
@@ -357,26 +417,12 @@ kernel void kernelMC(int a_maxFaces,
 	{
 		// test for intersection along an edge
 		if (EDGE_FLAGS[ flagIndex ] & (1<<edgeIndex))
-		{			
-			delta = cornerVolumes[ EDGE_INDICES[ edgeIndex ][1] ] - cornerVolumes[ EDGE_INDICES[ edgeIndex ][0] ];
-			if (delta == 0.0)
-				offset = 0.5;
-			else
-				offset = (a_threshold - cornerVolumes[ EDGE_INDICES[ edgeIndex ][0] ]) / delta;
-
-			edgePosition[ edgeIndex ] = cubeCorner + (CUBE_CORNERS[ EDGE_INDICES[ edgeIndex ][0] ] + EDGE_DIRECTIONS[ edgeIndex ] * offset);
+		{
+			float4 position = edgeVertex(cubeCorner, 1.0f, cornerVolumes, edgeIndex, threshold);
+			edgePosition[ edgeIndex ] = worldPosition(position, origin, spacing);
 
 			// calculate normal
-			edgeNormal[edgeIndex].x = sampleVolume(edgePosition[edgeIndex] - (float4)(0.01f, 0, 0, 0), a_particleCount, a_particles) -
-				sampleVolume(edgePosition[edgeIndex] + (float4)(0.01f, 0, 0, 0), a_particleCount, a_particles);
-			edgeNormal[edgeIndex].y = sampleVolume(edgePosition[edgeIndex] - (float4)(0, 0.01f, 0, 0), a_particleCount, a_particles) -
-				sampleVolume(edgePosition[edgeIndex] + (float4)(0, 0.01f, 0, 0), a_particleCount, a_particles);
-			edgeNormal[edgeIndex].z = sampleVolume(edgePosition[edgeIndex] - (float4)(0, 0, 0.01f, 0), a_particleCount, a_particles) -
-				sampleVolume(edgePosition[edgeIndex] + (float4)(0, 0, 0.01f, 0), a_particleCount, a_particles);
-			edgeNormal[edgeIndex].w = 0;
-
-			if ( dot(edgeNormal[ edgeIndex ],edgeNormal[ edgeIndex ]) > 0 )
-				edgeNormal[ edgeIndex ] = normalize(edgeNormal[ edgeIndex ]);
+			edgeNormal[ edgeIndex ] = worldNormal(fieldNormal(position, FIELD_ARGS), spacing);
 		}
 	}
 
@@ -387,18 +433,82 @@ kernel void kernelMC(int a_maxFaces,
 		if (TRIANGLE_TABLE[ flagIndex ][ 3 * triangleIndex ] < 0)
 			break;
 
-		// using an atomic to index into the write_only array of vertices
-		uint startVertex = atomic_inc(a_faceCount);
-
-		if (startVertex >= a_maxFaces)
+		uint startVertex = firstFace + triangleIndex;
+		if (startVertex >= maxFaces)
 			break;
 
 		for ( int triangleVertex = 0 ; triangleVertex < 3 ; ++triangleVertex )
 		{
 			// write out 2 float4's for each vertex (position + normal)
 			int vertexIndex = TRIANGLE_TABLE[ flagIndex ][3 * triangleIndex + triangleVertex];
-			a_vertices[startVertex * 6 + triangleVertex * 2] = edgePosition[ vertexIndex ];
-			a_vertices[startVertex * 6 + triangleVertex * 2 + 1] = edgeNormal[ vertexIndex ];
+			vertices[startVertex * 6 + triangleVertex * 2] = edgePosition[ vertexIndex ];
+			vertices[startVertex * 6 + triangleVertex * 2 + 1] = edgeNormal[ vertexIndex ];
 		}
-	}	
-}
\ No newline at end of file
+	}
+}
+
+// emits the triangles of one cube for one threshold, up to five. cornerVolumes are the
+// cube's samples, they can be classified against any number of thresholds. the faces
+// are reserved with reserveFaces, so every lane of the sub-group must get here and
+// count into the same faceCount.
+void marchCube(float4 cubeCorner, const float* cornerVolumes, float threshold, float4 origin, float4 spacing,
+			   int maxFaces, global uint* faceCount, global float4* vertices, FIELD_PARAMS)
+{
+	// find which corners are inside/outside the volume
+	int flagIndex = cubeFlags(cornerVolumes, threshold);
+
+	// one reservation for the whole cube rather than an atomic per triangle
+	uint firstFace = reserveFaces(faceCount, cubeFaces(flagIndex));
+	emitCube(cubeCorner, cornerVolumes, flagIndex, threshold, origin, spacing, firstFace, maxFaces, vertices, FIELD_ARGS);
+}
+
+// the cube's corner volumes, corners fall on lattice points
+void sampleCube(float4 cubeCorner, float* cornerVolumes, FIELD_PARAMS)
+{
+	for (int i = 0; i < 8; ++i)
+		cornerVolumes[i] = sampleCorner(cubeCorner + CUBE_CORNERS[i], FIELD_ARGS);
+}
+
+// vertices come out in world space: a_spacing (w = 1) is the distance between samples
+// per axis and a_origin is the world position of the grid's first corner, for a brick
+// that is where the brick sits within the volume. field parameters follow as declared
+// by field.cl
+kernel void kernelMC(int a_maxFaces,
+					 write_only global uint* a_faceCount, // atomic index into vertices
+					 write_only global float4* a_vertices,
+					 float a_threshold,
+					 float4 a_origin,
+					 float4 a_spacing,
+					 FIELD_PARAMS)
+{
+	// lower corner
+	float4 cubeCorner = (float4)(get_global_id(0), get_global_id(1), get_global_id(2), 0.0f);
+
+	// store a local copy of the cube's corner volumes
+	float cornerVolumes[8];
+	sampleCube(cubeCorner, cornerVolumes, FIELD_ARGS);
+
+	marchCube(cubeCorner, cornerVolumes, a_threshold, a_origin, a_spacing, a_maxFaces, a_faceCount, a_vertices, FIELD_ARGS);
+}
+
+// nested isosurfaces in one pass: the corners are sampled once and the cube is marched
+// against every threshold. level i counts into a_faceCounts[i] and writes faces
+// [i * a_maxLevelFaces, (i + 1) * a_maxLevelFaces) of a_vertices.
+kernel void kernelMCLevels(int a_maxLevelFaces,
+						   global uint* a_faceCounts,
+						   global float4* a_vertices,
+						   constant float* a_thresholds,
+						   int a_levelCount,
+						   float4 a_origin,
+						   float4 a_spacing,
+						   FIELD_PARAMS)
+{
+	float4 cubeCorner = (float4)(get_global_id(0), get_global_id(1), get_global_id(2), 0.0f);
+
+	float cornerVolumes[8];
+	sampleCube(cubeCorner, cornerVolumes, FIELD_ARGS);
+
+	for (int level = 0; level < a_levelCount; ++level)
+		marchCube(cubeCorner, cornerVolumes, a_thresholds[level], a_origin, a_spacing, a_maxLevelFaces, a_faceCounts + level,
+			a_vertices + (size_t)level * a_maxLevelFaces * 6, FIELD_ARGS);
+}
@@ -0,0 +1,145 @@
+// surface nets
+//
+// every cell the surface passes through gets a single vertex, placed at the mean of
+// the points where the surface crosses the cell's edges. every crossed lattice edge
+// then joins the four cells around it with a quad (split in two triangles). vertices
+// are shared by the quads around them, so the mesh comes out indexed and with roughly
+// half the triangles marching cubes makes for the same grid.
+//
+// the corners, edge crossings and normals come from the helpers in mc.cl, so the net
+// samples the field exactly where kernelMC would.
+
+#define NETS_NO_VERTEX	(-1)
+
+size_t netsCellIndex(int4 cell, int4 gridSize)
+{
+	return cell.x + gridSize.x * ((size_t)cell.y + (size_t)gridSize.y * cell.z);
+}
+
+int4 netsAxis(int axis)
+{
+	return (int4)(axis == 0, axis == 1, axis == 2, 0);
+}
+
+// one work-item per cell, gives the active ones a vertex. a_cellVertices receives the
+// vertex of every cell, NETS_NO_VERTEX for cells the surface misses (or when
+// a_maxVertices is exceeded, the faces using those cells are then dropped). vertices
+// are placed in world space like kernelMC's.
+kernel void kernelNetsVertices(float a_threshold,
+							   int a_maxVertices,
+							   global uint* a_vertexCount,
+							   global float4* a_vertices,
+							   global int* a_cellVertices,
+							   float4 a_origin,
+							   float4 a_spacing,
+							   FIELD_PARAMS)
+{
+	int4 cell = (int4)(get_global_id(0), get_global_id(1), get_global_id(2), 0);
+	int4 gridSize = (int4)(get_global_size(0), get_global_size(1), get_global_size(2), 1);
+	float4 cubeCorner = convert_float4(cell);
+
+	float cornerVolumes[8];
+	for (int i = 0; i < 8; ++i)
+		cornerVolumes[i] = sampleCorner(cubeCorner + CUBE_CORNERS[i], FIELD_ARGS);
+
+	int edges = EDGE_FLAGS[ cubeFlags(cornerVolumes, a_threshold) ];
+	int vertex = NETS_NO_VERTEX;
+	if (edges != 0)
+	{
+		// every crossing has w = 1, so does their mean
+		float4 position = (float4)(0);
+		int crossings = 0;
+		for (int edgeIndex = 0; edgeIndex < 12; ++edgeIndex)
+		{
+			if (edges & (1 << edgeIndex))
+			{
+				position += edgeVertex(cubeCorner, 1.0f, cornerVolumes, edgeIndex, a_threshold);
+				++crossings;
+			}
+		}
+		position /= crossings;
+
+		uint index = atomic_inc(a_vertexCount);
+		if (index < a_maxVertices)
+		{
+			vertex = index;
+			a_vertices[index * 2] = worldPosition(position, a_origin, a_spacing);
+			a_vertices[index * 2 + 1] = worldNormal(fieldNormal(position, FIELD_ARGS), a_spacing);
+		}
+	}
+	a_cellVertices[ netsCellIndex(cell, gridSize) ] = vertex;
+}
+
+// one work-item per cell, each owns the three lattice edges leaving its lower corner
+// and emits a quad for every one of them the surface crosses. the quad is wound so
+// its normal follows the falling field, like the normals (and kernelMC's triangles).
+// a_faceCount counts triangles and, like kernelMC's, may end up past a_maxFaces.
+kernel void kernelNetsFaces(float a_threshold,
+							int a_maxFaces,
+							global uint* a_faceCount,
+							global uint* a_indices,
+							global const int* a_cellVertices,
+							FIELD_PARAMS)
+{
+	int4 cell = (int4)(get_global_id(0), get_global_id(1), get_global_id(2), 0);
+	int4 gridSize = (int4)(get_global_size(0), get_global_size(1), get_global_size(2), 1);
+	float4 corner = convert_float4(cell);
+	float cornerVolume = sampleCorner(corner, FIELD_ARGS);
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		// the four cells around the edge, counter-clockwise seen from the edge's far end
+		int4 u = netsAxis((axis + 1) % 3);
+		int4 v = netsAxis((axis + 2) % 3);
+		int4 first = cell - u - v;
+		if (first.x < 0 || first.y < 0 || first.z < 0)
+			continue;
+
+		float endVolume = sampleCorner(corner + convert_float4(netsAxis(axis)), FIELD_ARGS);
+		if ((cornerVolume <= a_threshold) == (endVolume <= a_threshold))
+			continue;
+
+		int quad[4];
+		quad[0] = a_cellVertices[ netsCellIndex(first, gridSize) ];
+		quad[1] = a_cellVertices[ netsCellIndex(cell - v, gridSize) ];
+		quad[2] = a_cellVertices[ netsCellIndex(cell, gridSize) ];
+		quad[3] = a_cellVertices[ netsCellIndex(cell - u, gridSize) ];
+		if (quad[0] == NETS_NO_VERTEX || quad[1] == NETS_NO_VERTEX || quad[2] == NETS_NO_VERTEX || quad[3] == NETS_NO_VERTEX)
+			continue;
+
+		// that order faces along the axis, flip it when the field rises along the edge
+		if (endVolume > cornerVolume)
+		{
+			int swap = quad[1];
+			quad[1] = quad[3];
+			quad[3] = swap;
+		}
+
+		uint startFace = atomic_add(a_faceCount, 2);
+		if (startFace + 2 > a_maxFaces)
+			continue;
+
+		vstore3((uint3)(quad[0], quad[1], quad[2]), startFace, a_indices);
+		vstore3((uint3)(quad[0], quad[2], quad[3]), startFace + 1, a_indices);
+	}
+}
+
+// turns indexed faces back into kernelMC's layout (a position and a normal per corner)
+// for the consumers that want a triangle soup. one work-item per face of capacity.
+kernel void kernelNetsExpand(global const float4* a_vertices,
+							 global const uint* a_indices,
+							 global const uint* a_faceCount,
+							 uint a_maxFaces,
+							 global float4* a_output)
+{
+	uint face = get_global_id(0);
+	if (face >= min(*a_faceCount, a_maxFaces))
+		return;
+
+	for (int corner = 0; corner < 3; ++corner)
+	{
+		uint vertex = a_indices[face * 3 + corner];
+		a_output[face * 6 + corner * 2] = a_vertices[vertex * 2];
+		a_output[face * 6 + corner * 2 + 1] = a_vertices[vertex * 2 + 1];
+	}
+}
@@ -0,0 +1,107 @@
+#include "nets.h"
+
+bool createSurfaceNets(SurfaceNets& nets, cl_context context, cl_program program, const size_t* gridSize, cl_uint maxFaces)
+{
+	cl_int result = CL_SUCCESS;
+	nets.vertices = clCreateKernel(program, "kernelNetsVertices", &result);
+	CL_CHECK(result);
+	nets.faces = clCreateKernel(program, "kernelNetsFaces", &result);
+	CL_CHECK(result);
+	nets.expand = clCreateKernel(program, "kernelNetsExpand", &result);
+	CL_CHECK(result);
+
+	for (int axis = 0; axis < 3; ++axis)
+		nets.gridSize[axis] = gridSize[axis];
+	nets.maxVertices = maxFaces;
+	nets.maxFaces = maxFaces;
+
+	size_t cellCount = gridSize[0] * gridSize[1] * gridSize[2];
+	nets.cellVertices = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_int) * cellCount, nullptr, &result);
+	CL_CHECK(result);
+	nets.vertexCount = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), nullptr, &result);
+	CL_CHECK(result);
+	nets.meshVertices = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_float4) * 2 * nets.maxVertices, nullptr, &result);
+	CL_CHECK(result);
+	nets.meshIndices = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * 3 * maxFaces, nullptr, &result);
+	CL_CHECK(result);
+
+	bool created = nets.vertices != 0 && nets.faces != 0 && nets.expand != 0 && nets.cellVertices != 0 &&
+		nets.vertexCount != 0 && nets.meshVertices != 0 && nets.meshIndices != 0;
+	if (!created)
+		releaseSurfaceNets(nets);
+	return created;
+}
+
+void releaseSurfaceNets(SurfaceNets& nets)
+{
+	releaseMemObject(nets.meshIndices);
+	releaseMemObject(nets.meshVertices);
+	releaseMemObject(nets.vertexCount);
+	releaseMemObject(nets.cellVertices);
+	releaseKernel(nets.expand);
+	releaseKernel(nets.faces);
+	releaseKernel(nets.vertices);
+}
+
+cl_int enqueueSurfaceNets(SurfaceNets& nets, cl_command_queue queue, cl_float threshold,
+	cl_float4 origin, cl_float4 spacing, cl_mem vertices, cl_mem indices, cl_mem faceCount,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event)
+{
+	static const cl_uint zero = 0;
+	cl_int maxVertices = (cl_int)nets.maxVertices;
+	cl_int maxFaces = (cl_int)nets.maxFaces;
+
+	cl_int result = clSetKernelArg(nets.vertices, 0, sizeof(cl_float), &threshold);
+	result |= clSetKernelArg(nets.vertices, 1, sizeof(cl_int), &maxVertices);
+	result |= clSetKernelArg(nets.vertices, 2, sizeof(cl_mem), &nets.vertexCount);
+	result |= clSetKernelArg(nets.vertices, 3, sizeof(cl_mem), &vertices);
+	result |= clSetKernelArg(nets.vertices, 4, sizeof(cl_mem), &nets.cellVertices);
+	result |= clSetKernelArg(nets.vertices, 5, sizeof(cl_float4), &origin);
+	result |= clSetKernelArg(nets.vertices, 6, sizeof(cl_float4), &spacing);
+
+	result |= clSetKernelArg(nets.faces, 0, sizeof(cl_float), &threshold);
+	result |= clSetKernelArg(nets.faces, 1, sizeof(cl_int), &maxFaces);
+	result |= clSetKernelArg(nets.faces, 2, sizeof(cl_mem), &faceCount);
+	result |= clSetKernelArg(nets.faces, 3, sizeof(cl_mem), &indices);
+	result |= clSetKernelArg(nets.faces, 4, sizeof(cl_mem), &nets.cellVertices);
+	CL_CHECK(result);
+
+	// in order queue, only the first command needs the caller's events. every cell has
+	// its vertex before any face looks it up.
+	result = clEnqueueWriteBuffer(queue, nets.vertexCount, CL_FALSE, 0, sizeof(cl_uint), &zero, waitCount, waitEvents, 0);
+	result |= clEnqueueNDRangeKernel(queue, nets.vertices, 3, 0, nets.gridSize, 0, 0, nullptr, 0);
+	result |= clEnqueueNDRangeKernel(queue, nets.faces, 3, 0, nets.gridSize, 0, 0, nullptr, event);
+	CL_CHECK(result);
+	return result;
+}
+
+cl_int enqueueSurfaceNetsSoup(SurfaceNets& nets, cl_command_queue queue, cl_float threshold,
+	cl_float4 origin, cl_float4 spacing, cl_mem output, cl_mem faceCount,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event)
+{
+	cl_int result = enqueueSurfaceNets(nets, queue, threshold, origin, spacing, nets.meshVertices, nets.meshIndices, faceCount,
+		waitCount, waitEvents, 0);
+	result |= enqueueExpandFaces(nets.expand, queue, nets.meshVertices, nets.meshIndices, faceCount, nets.maxFaces, output,
+		0, nullptr, event);
+	return result;
+}
+
+cl_int enqueueExpandFaces(cl_kernel expand, cl_command_queue queue, cl_mem vertices, cl_mem indices,
+	cl_mem faceCount, cl_uint maxFaces, cl_mem output,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event)
+{
+	// the face count is only known on the device, the launch covers the capacity
+	size_t faceSize = maxFaces;
+	cl_int result = clSetKernelArg(expand, 0, sizeof(cl_mem), &vertices);
+	result |= clSetKernelArg(expand, 1, sizeof(cl_mem), &indices);
+	result |= clSetKernelArg(expand, 2, sizeof(cl_mem), &faceCount);
+	result |= clSetKernelArg(expand, 3, sizeof(cl_uint), &maxFaces);
+	result |= clSetKernelArg(expand, 4, sizeof(cl_mem), &output);
+	CL_CHECK(result);
+
+	if (faceSize == 0)
+		return clEnqueueMarkerWithWaitList(queue, waitCount, waitEvents, event);
+	result = clEnqueueNDRangeKernel(queue, expand, 1, 0, &faceSize, 0, waitCount, waitEvents, event);
+	CL_CHECK(result);
+	return result;
+}
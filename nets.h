@@ -0,0 +1,52 @@
+#pragma once
+
+#include "clutil.h"
+
+// surface nets extraction, an alternative to kernelMC that places one vertex per cell
+// the surface crosses and joins them with quads. the mesh is indexed, vertices are a
+// position and a normal float4 like kernelMC's and faces are three uint indices.
+struct SurfaceNets
+{
+	cl_kernel	vertices;
+	cl_kernel	faces;
+	cl_kernel	expand;
+
+	cl_mem		cellVertices;	// vertex of every cell
+	cl_mem		vertexCount;
+	cl_mem		meshVertices;	// scratch mesh for enqueueSurfaceNetsSoup
+	cl_mem		meshIndices;
+
+	size_t		gridSize[3];
+	cl_uint		maxVertices;
+	cl_uint		maxFaces;
+};
+
+// kernel arguments from this index on are the field's, see setFieldArgs
+#define NETS_VERTICES_FIELD_ARG 7
+#define NETS_FACES_FIELD_ARG 5
+
+// sizes the net for a grid and meshes of up to maxFaces triangles (and as many
+// vertices, a closed net has about half that), the kernels come from a program made
+// by buildProgram
+bool createSurfaceNets(SurfaceNets& nets, cl_context context, cl_program program, const size_t* gridSize, cl_uint maxFaces);
+void releaseSurfaceNets(SurfaceNets& nets);
+
+// extracts the net into vertices and indices (a GL element buffer works), counting
+// triangles into faceCount which the caller zeroes as it would for kernelMC. the field
+// arguments must already be set on the vertices and faces kernels. vertices are
+// placed in the world space of origin and spacing, see volumeOrigin.
+cl_int enqueueSurfaceNets(SurfaceNets& nets, cl_command_queue queue, cl_float threshold,
+	cl_float4 origin, cl_float4 spacing, cl_mem vertices, cl_mem indices, cl_mem faceCount,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event);
+
+// extracts the net into the scratch mesh and expands it into a triangle soup laid out
+// like kernelMC's output, for the decimator and the exporters
+cl_int enqueueSurfaceNetsSoup(SurfaceNets& nets, cl_command_queue queue, cl_float threshold,
+	cl_float4 origin, cl_float4 spacing, cl_mem output, cl_mem faceCount,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event);
+
+// expands up to maxFaces indexed faces (faceCount is read on the device) into a soup
+// with kernelNetsExpand, which works for any indexed mesh of the program
+cl_int enqueueExpandFaces(cl_kernel expand, cl_command_queue queue, cl_mem vertices, cl_mem indices,
+	cl_mem faceCount, cl_uint maxFaces, cl_mem output,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event);
@@ -0,0 +1,485 @@
+#include "server.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include <string.h>
+#include <thread>
+
+// volumes up to this size wait for others to share a dispatch with
+#define SERVER_BATCH_VOLUME_BYTES (16 * 1024 * 1024)
+
+// samples a batch packs at most
+#define SERVER_BATCH_BYTES (256 * 1024 * 1024)
+
+#define SERVER_DEFAULT_FACES (256 * 1024)
+
+// a request's maxFaces is clamped to this, and to what a batch's vertices can hold
+#define SERVER_MAX_FACES (4 * 1024 * 1024)
+
+// bytes a batch's vertex buffer may take, batches stop growing when their slices reach it
+#define SERVER_BATCH_VERTEX_BYTES (512 * 1024 * 1024)
+
+// payloads past this are refused. a payload is read whole before it is queued, so this
+// is what a single request can make a connection allocate.
+#define SERVER_MAX_PAYLOAD (64u * 1024 * 1024)
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static_assert(sizeof(ServerRequest) == 44 && sizeof(ServerResponse) == 12, "the socket protocol has no padding");
+
+struct ExtractionServer::Connection
+{
+	explicit Connection(int socket) : socket(socket) {}
+	~Connection()
+	{
+#ifndef _WIN32
+		close(socket);
+#endif
+	}
+
+	int			socket;
+};
+
+struct ExtractionServer::Job
+{
+	Job() : opened(false) {}
+	~Job()
+	{
+		field.reset();
+		if (opened)
+			closeVolume(volume);
+	}
+
+	std::shared_ptr<Connection>		connection;
+	ServerRequest					request;
+	Volume							volume;
+	bool							opened;
+	std::unique_ptr<FieldSource>	field;
+};
+
+struct ExtractionServer::Answer
+{
+	std::shared_ptr<Connection>	connection;
+	ServerResponse				response;
+	std::vector<cl_float4>		vertices;
+};
+
+ExtractionServer::ExtractionServer(MarchingCubesEngine& engine)
+	: m_engine(engine),
+	m_socket(-1),
+	m_running(false),
+	m_draining(false),
+	m_answering(true)
+{
+	m_batchFaces = batchFaceBudget(engine.device(), SERVER_BATCH_VERTEX_BYTES);
+	m_maxFaces = m_batchFaces < SERVER_MAX_FACES ? (cl_uint)m_batchFaces : SERVER_MAX_FACES;
+}
+
+cl_uint ExtractionServer::jobFaces(const Job* job) const
+{
+	cl_uint faces = job->request.maxFaces > 0 ? job->request.maxFaces : SERVER_DEFAULT_FACES;
+	return faces < m_maxFaces ? faces : m_maxFaces;
+}
+
+ExtractionServer::~ExtractionServer()
+{
+#ifndef _WIN32
+	if (m_socket >= 0)
+	{
+		close(m_socket);
+		unlink(m_path.c_str());
+	}
+#endif
+	for (std::map<int, BatchProgram>::iterator it = m_batches.begin(); it != m_batches.end(); ++it)
+	{
+		releaseBatch(it->second.batch);
+		clReleaseProgram(it->second.program);
+	}
+	for (size_t i = 0; i < m_answers.size(); ++i)
+		delete m_answers[i];
+}
+
+void ExtractionServer::respond(Job* job, bool ok, std::vector<cl_float4> vertices)
+{
+	Answer* answer = new Answer();
+	answer->connection = job->connection;
+	answer->response.id = job->request.id;
+	answer->response.ok = ok ? 1u : 0u;
+	answer->response.faceCount = ok ? (cl_uint)(vertices.size() / 6) : 0;
+	if (ok)
+		answer->vertices.swap(vertices);
+
+	std::lock_guard<std::mutex> lock(m_answerMutex);
+	m_answers.push_back(answer);
+	m_answered.notify_one();
+}
+
+#ifdef _WIN32
+
+bool ExtractionServer::listen(const char*)
+{
+	printf("The extraction server needs Unix domain sockets!\n");
+	return false;
+}
+
+void ExtractionServer::run() {}
+void ExtractionServer::stop() {}
+void ExtractionServer::serveConnection(std::shared_ptr<Connection>) {}
+void ExtractionServer::sendAnswers() {}
+
+#else
+
+bool ExtractionServer::listen(const char* path)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		printf("Socket path %s is too long!\n", path);
+		return false;
+	}
+	strcpy(address.sun_path, path);
+
+	m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_socket < 0)
+	{
+		printf("Failed to create a socket: %s\n", strerror(errno));
+		return false;
+	}
+
+	// only a socket left by an earlier server is replaced, never some other file
+	struct stat existing;
+	if (stat(path, &existing) == 0)
+	{
+		if (!S_ISSOCK(existing.st_mode))
+		{
+			printf("%s exists and is not a socket!\n", path);
+			close(m_socket);
+			m_socket = -1;
+			return false;
+		}
+		unlink(path);
+	}
+	if (bind(m_socket, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(m_socket, 64) != 0)
+	{
+		printf("Failed to listen on %s: %s\n", path, strerror(errno));
+		close(m_socket);
+		m_socket = -1;
+		return false;
+	}
+	m_path = path;
+	m_running = true;
+	return true;
+}
+
+void ExtractionServer::run()
+{
+	std::thread dispatcher(&ExtractionServer::dispatch, this);
+	std::thread sender(&ExtractionServer::sendAnswers, this);
+	while (m_running)
+	{
+		int client = accept(m_socket, nullptr, nullptr);
+		if (client < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+
+		std::shared_ptr<Connection> connection = std::make_shared<Connection>(client);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_connections.push_back(connection);
+		std::thread(&ExtractionServer::serveConnection, this, connection).detach();
+	}
+
+	// readers are woken by stop, the dispatcher answers what they queued
+	stop();
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_readersDone.wait(lock, [this]() { return m_connections.empty(); });
+		m_draining = true;
+		m_queued.notify_all();
+	}
+	dispatcher.join();
+	m_engine.wait();
+
+	// every job has been answered, the sender empties its queue and returns
+	{
+		std::lock_guard<std::mutex> lock(m_answerMutex);
+		m_answering = false;
+		m_answered.notify_all();
+	}
+	sender.join();
+}
+
+void ExtractionServer::stop()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_running = false;
+	if (m_socket >= 0)
+		shutdown(m_socket, SHUT_RDWR);
+	for (size_t i = 0; i < m_connections.size(); ++i)
+		shutdown(m_connections[i]->socket, SHUT_RD);
+	m_queued.notify_all();
+}
+
+static bool receiveAll(int socket, void* data, size_t size)
+{
+	char* bytes = (char*)data;
+	while (size > 0)
+	{
+		ssize_t received = recv(socket, bytes, size, 0);
+		if (received < 0 && errno == EINTR)
+			continue;
+		if (received <= 0)
+			return false;
+		bytes += received;
+		size -= received;
+	}
+	return true;
+}
+
+static bool sendAll(int socket, const void* data, size_t size)
+{
+	const char* bytes = (const char*)data;
+	while (size > 0)
+	{
+		ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return false;
+		bytes += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+// writes the answers out in the order they were queued. a client that stops reading
+// only holds up this thread, a send to a client that hung up fails and is dropped.
+void ExtractionServer::sendAnswers()
+{
+	for (;;)
+	{
+		std::unique_ptr<Answer> answer;
+		{
+			std::unique_lock<std::mutex> lock(m_answerMutex);
+			m_answered.wait(lock, [this]() { return !m_answering || !m_answers.empty(); });
+			if (m_answers.empty())
+				break;
+			answer.reset(m_answers.front());
+			m_answers.pop_front();
+		}
+
+		int socket = answer->connection->socket;
+		if (sendAll(socket, &answer->response, sizeof(answer->response)) && answer->response.faceCount > 0)
+			sendAll(socket, answer->vertices.data(), sizeof(cl_float4) * 6 * answer->response.faceCount);
+	}
+}
+
+// reads requests until the client hangs up, volumes are opened here so the
+// dispatcher only marches
+void ExtractionServer::serveConnection(std::shared_ptr<Connection> connection)
+{
+	for (;;)
+	{
+		std::unique_ptr<Job> job(new Job());
+		job->connection = connection;
+		ServerRequest& request = job->request;
+		if (!receiveAll(connection->socket, &request, sizeof(request)) || request.magic != SERVER_MAGIC ||
+			request.payload > SERVER_MAX_PAYLOAD)
+			break;
+		std::vector<char> payload(request.payload);
+		if (!receiveAll(connection->socket, payload.data(), payload.size()))
+			break;
+
+		bool valid = request.priority < SERVER_PRIORITY_COUNT;
+		if (valid && request.kind == SERVER_VOLUME)
+		{
+			// a raw volume's type and sizes come from the client, openRawVolume checks
+			// the sizes against the file
+			if (request.size[2] != 0 && (request.type > VOXEL_FLOAT || request.size[0] == 0 || request.size[1] == 0))
+			{
+				respond(job.get(), false);
+				continue;
+			}
+			std::string path(payload.begin(), payload.end());
+			job->opened = request.size[2] != 0 ?
+				openRawVolume(job->volume, path.c_str(), request.size[0], request.size[1], request.size[2], (VoxelType)request.type) :
+				openVolume(job->volume, path.c_str());
+			valid = job->opened;
+		}
+		else if (valid && request.kind == SERVER_PARTICLES)
+		{
+			valid = payload.size() % sizeof(cl_float4) == 0 && request.size[0] > 0 && request.size[1] > 0 && request.size[2] > 0;
+			if (valid)
+			{
+				ParticleSource* particles = new ParticleSource(request.size[0], request.size[1], request.size[2]);
+				particles->particles.resize(payload.size() / sizeof(cl_float4));
+				memcpy(particles->particles.data(), payload.data(), payload.size());
+				job->field.reset(particles);
+			}
+		}
+		else
+			valid = false;
+
+		if (!valid)
+		{
+			respond(job.get(), false);
+			continue;
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queues[request.priority].push_back(job.release());
+		m_queued.notify_one();
+	}
+
+	// jobs still hold the connection until they are answered
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (size_t i = 0; i < m_connections.size(); ++i)
+		if (m_connections[i] == connection)
+		{
+			m_connections.erase(m_connections.begin() + i);
+			break;
+		}
+	m_readersDone.notify_all();
+}
+
+#endif
+
+static bool batchable(const Volume& volume)
+{
+	return volumeBytes(volume) <= SERVER_BATCH_VOLUME_BYTES;
+}
+
+// one thread owns the engine and the batches. a small volume takes the others of its
+// sample type waiting at its priority into its batch.
+void ExtractionServer::dispatch()
+{
+	for (;;)
+	{
+		std::vector<Job*> jobs;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_queued.wait(lock, [this]() { return m_draining || !m_queues[SERVER_INTERACTIVE].empty() || !m_queues[SERVER_BULK].empty(); });
+			std::deque<Job*>& queue = m_queues[!m_queues[SERVER_INTERACTIVE].empty() ? SERVER_INTERACTIVE : SERVER_BULK];
+			if (queue.empty())
+				break;
+
+			jobs.push_back(queue.front());
+			queue.pop_front();
+			if (jobs[0]->opened && batchable(jobs[0]->volume))
+			{
+				// the slices' vertices have to fit one buffer as well as the samples
+				size_t bytes = volumeBytes(jobs[0]->volume);
+				size_t faces = jobFaces(jobs[0]);
+				for (std::deque<Job*>::iterator it = queue.begin(); it != queue.end();)
+				{
+					Job* other = *it;
+					if (other->opened && batchable(other->volume) && other->volume.type == jobs[0]->volume.type &&
+						bytes + volumeBytes(other->volume) <= SERVER_BATCH_BYTES && faces + jobFaces(other) <= m_batchFaces)
+					{
+						bytes += volumeBytes(other->volume);
+						faces += jobFaces(other);
+						jobs.push_back(other);
+						it = queue.erase(it);
+					}
+					else
+						++it;
+				}
+			}
+		}
+
+		if (jobs[0]->opened && batchable(jobs[0]->volume))
+			marchBatch(jobs);
+		else
+			submitJob(jobs[0]);
+	}
+}
+
+void ExtractionServer::submitJob(Job* job)
+{
+	if (job->opened)
+		job->field.reset(new VolumeSource(job->volume));
+	m_engine.setMaxFaces(jobFaces(job));
+	m_engine.submit(*job->field, job->request.threshold, [this, job](MarchResult& result)
+	{
+		// runs on the OpenCL runtime's thread, the sender does the writing
+		respond(job, result.ok, std::move(result.vertices));
+		delete job;
+	});
+}
+
+void ExtractionServer::marchBatch(std::vector<Job*>& jobs)
+{
+	// the program for the sample type is built by the first batch of it
+	const Volume& first = jobs[0]->volume;
+	std::map<int, BatchProgram>::iterator entry = m_batches.find(first.type);
+	if (entry == m_batches.end())
+	{
+		BatchProgram batchProgram = {};
+		batchProgram.program = buildProgram(m_engine.context(), m_engine.device(), volumeBuildOptions(first), m_engine.kernelPath());
+		if (batchProgram.program != 0 && !createBatch(batchProgram.batch, m_engine.context(), batchProgram.program, first.type))
+		{
+			clReleaseProgram(batchProgram.program);
+			batchProgram.program = 0;
+		}
+		if (batchProgram.program != 0)
+			entry = m_batches.insert(std::make_pair((int)first.type, batchProgram)).first;
+	}
+
+	std::vector<Job*> batched;
+	if (entry != m_batches.end())
+	{
+		Batch& batch = entry->second.batch;
+		clearBatch(batch);
+		for (size_t i = 0; i < jobs.size(); ++i)
+		{
+			if (addToBatch(batch, jobs[i]->volume, jobs[i]->request.threshold, jobFaces(jobs[i])))
+				batched.push_back(jobs[i]);
+			else
+			{
+				respond(jobs[i], false);
+				delete jobs[i];
+			}
+		}
+
+		// one dispatch for the lot, each volume's slice is read back for its client
+		cl_event marched = 0;
+		cl_int result = enqueueBatch(batch, m_engine.queue(), 0, nullptr, &marched);
+		CL_CHECK(result);
+		if (result == CL_SUCCESS)
+		{
+			result = clWaitForEvents(1, &marched);
+			clReleaseEvent(marched);
+		}
+
+		for (size_t i = 0; i < batched.size(); ++i)
+		{
+			const BatchVolume& volume = batch.volumes[i];
+			cl_uint faceCount = result == CL_SUCCESS ? (batch.faceCounts[i] < volume.maxFaces ? batch.faceCounts[i] : volume.maxFaces) : 0;
+			std::vector<cl_float4> vertices((size_t)faceCount * 6);
+			cl_int read = result;
+			if (faceCount > 0)
+				read = clEnqueueReadBuffer(m_engine.queue(), batch.vertices, CL_TRUE, sizeof(cl_float4) * 6 * volume.faceOffset,
+					sizeof(cl_float4) * 6 * faceCount, vertices.data(), 0, nullptr, 0);
+			respond(batched[i], read == CL_SUCCESS, std::move(vertices));
+			delete batched[i];
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < jobs.size(); ++i)
+		{
+			respond(jobs[i], false);
+			delete jobs[i];
+		}
+	}
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "batch.h"
+#include "engine.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+
+// a long running extraction service on a Unix domain socket. the engine keeps its
+// context, programs and buffers warm between jobs, so clients only pay for the march.
+// small volumes waiting together are marched in one kernelMCBatch dispatch, anything
+// else through the engine's asynchronous submit. interactive requests are always taken
+// before bulk ones. not available on Windows.
+
+enum ServerJobKind
+{
+	SERVER_VOLUME,		// payload is the path of a volume the server can open
+	SERVER_PARTICLES,	// payload is the particles' float4s
+};
+
+enum ServerPriority
+{
+	SERVER_INTERACTIVE,
+	SERVER_BULK,
+	SERVER_PRIORITY_COUNT
+};
+
+#define SERVER_MAGIC 0x3158434d	// "MCX1"
+
+// a request as sent over the socket, in host byte order and followed by payload bytes
+struct ServerRequest
+{
+	cl_uint		magic;
+	cl_uint		id;			// echoed in the response, requests may be answered out of order
+	cl_uint		kind;
+	cl_uint		priority;
+	cl_float	threshold;
+	cl_uint		maxFaces;	// 0 for the server's default, clamped to the server's maximum
+	cl_uint		size[3];	// a raw volume's samples (0 to read its header), or the particles' grid in cubes
+	cl_uint		type;		// a raw volume's VoxelType
+	cl_uint		payload;
+};
+
+// the answer, followed by faceCount * 3 vertices of a position and a normal float4
+struct ServerResponse
+{
+	cl_uint		id;
+	cl_uint		ok;
+	cl_uint		faceCount;
+};
+
+class ExtractionServer
+{
+public:
+	// the engine must be initialised and is only used by the server from then on
+	explicit ExtractionServer(MarchingCubesEngine& engine);
+	~ExtractionServer();
+
+	// binds the socket, a stale socket left at path is replaced but any other file is refused
+	bool listen(const char* path);
+
+	// accepts clients and serves their requests until stop
+	void run();
+
+	// from any thread, run returns once every queued request has been answered
+	void stop();
+
+private:
+	struct Connection;
+	struct Job;
+	struct Answer;
+
+	// a batch per sample type, built and grown once
+	struct BatchProgram
+	{
+		cl_program	program;
+		Batch		batch;
+	};
+
+	void serveConnection(std::shared_ptr<Connection> connection);
+	void dispatch();
+	void marchBatch(std::vector<Job*>& jobs);
+	void submitJob(Job* job);
+	void sendAnswers();
+
+	// the job's maxFaces, or the default, clamped to what the server allows
+	cl_uint jobFaces(const Job* job) const;
+
+	// queues the answer to a job for the sender, from any thread
+	void respond(Job* job, bool ok, std::vector<cl_float4> vertices = std::vector<cl_float4>());
+
+	MarchingCubesEngine&	m_engine;
+	std::string				m_path;
+	int						m_socket;
+	std::atomic<bool>		m_running;
+	size_t					m_batchFaces;	// the most faces a batch's slices add up to
+	cl_uint					m_maxFaces;		// the most faces a request gets
+
+	// the queues and the connections being read, each by a detached thread of its own
+	std::mutex				m_mutex;
+	std::condition_variable	m_queued;
+	std::condition_variable	m_readersDone;
+	std::deque<Job*>		m_queues[SERVER_PRIORITY_COUNT];
+	std::vector<std::shared_ptr<Connection> >	m_connections;
+	bool					m_draining;		// no more requests will be queued
+
+	std::map<int, BatchProgram>	m_batches;	// by VoxelType, used by the dispatcher only
+
+	// answers waiting for the sender thread, the only one writing to the sockets so a
+	// slow client never stalls the dispatcher or the engine's callbacks
+	std::mutex				m_answerMutex;
+	std::condition_variable	m_answered;
+	std::deque<Answer*>		m_answers;
+	bool					m_answering;	// false once nothing more will be answered
+};
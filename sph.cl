@@ -0,0 +1,148 @@
+// smoothed particle hydrodynamics, the fluid whose particles the FIELD_SPH field
+// samples. distances are in cubes and every particle weighs 1. a step is:
+//   kernelSphDensity    density and pressure of every particle from its neighbours
+//   kernelSphForces     pressure, viscosity and gravity into an acceleration
+//   kernelSphIntegrate  moves the particles and bounces them off the grid's box
+//   kernelSphClear/Bin  bins the moved particles into cells for the next step and
+//                       the field
+// neighbours are the particles of the 27 cells around a particle's, see field.cl.
+
+#ifdef FIELD_SPH
+
+// speed kept by a particle bouncing off the box
+#define SPH_WALL_DAMPING 0.5f
+
+#define SPH_PI 3.14159265f
+
+// cells within one radius of p
+void sphNeighbourCells(float4 p, float radius, int4 cellGrid, int4* first, int4* last)
+{
+	int4 centre = sphCell(p, radius, cellGrid);
+	*first = max(centre - (int4)(1), (int4)(0));
+	*last = min(centre + (int4)(1), cellGrid - (int4)(1));
+}
+
+kernel void kernelSphClear(global uint* a_cellCounts)
+{
+	a_cellCounts[get_global_id(0)] = 0;
+}
+
+// one work-item per particle, a cell's particles past SPH_CELL_CAPACITY are left out
+// of it until they spread out
+kernel void kernelSphBin(global const float4* a_particles,
+						 global uint* a_cellCounts,
+						 global uint* a_cellParticles,
+						 int4 a_cellGrid,
+						 float a_radius)
+{
+	uint particle = get_global_id(0);
+	size_t cell = sphCellIndex(sphCell(a_particles[particle], a_radius, a_cellGrid), a_cellGrid);
+	uint slot = atomic_inc(&a_cellCounts[cell]);
+	if (slot < SPH_CELL_CAPACITY)
+		a_cellParticles[cell * SPH_CELL_CAPACITY + slot] = particle;
+}
+
+// density (poly6 kernel) and pressure of every particle. the fluid doesn't pull
+// itself together, pressure below the rest density is 0.
+kernel void kernelSphDensity(global float2* a_densities,
+							 float a_restDensity,
+							 float a_stiffness,
+							 FIELD_PARAMS)
+{
+	uint particle = get_global_id(0);
+	float4 p = a_particles[particle];
+	float radius2 = a_radius * a_radius;
+	float poly6 = 315.0f / (64.0f * SPH_PI * pown(a_radius, 9));
+
+	int4 first, last;
+	sphNeighbourCells(p, a_radius, a_cellGrid, &first, &last);
+	float density = 0;
+	for (int z = first.z; z <= last.z; ++z)
+		for (int y = first.y; y <= last.y; ++y)
+			for (int x = first.x; x <= last.x; ++x)
+			{
+				size_t cell = sphCellIndex((int4)(x, y, z, 0), a_cellGrid);
+				uint count = min(a_cellCounts[cell], (uint)SPH_CELL_CAPACITY);
+				for (uint i = 0; i < count; ++i)
+				{
+					float4 d = p - a_particles[ a_cellParticles[cell * SPH_CELL_CAPACITY + i] ];
+					float q = radius2 - dot(d.xyz, d.xyz);
+					if (q > 0)
+						density += q * q * q;
+				}
+			}
+	density *= poly6;
+	a_densities[particle] = (float2)(density, a_stiffness * max(density - a_restDensity, 0.0f));
+}
+
+// acceleration of every particle: the pressure gradient (spiky kernel), viscosity
+// (its laplacian kernel) and gravity down y
+kernel void kernelSphForces(global float4* a_accelerations,
+							global const float4* a_velocities,
+							global const float2* a_densities,
+							float a_viscosity,
+							float a_gravity,
+							FIELD_PARAMS)
+{
+	uint particle = get_global_id(0);
+	float4 p = a_particles[particle];
+	float4 v = a_velocities[particle];
+	float2 own = a_densities[particle];
+	float spiky = 45.0f / (SPH_PI * pown(a_radius, 6));
+
+	int4 first, last;
+	sphNeighbourCells(p, a_radius, a_cellGrid, &first, &last);
+	float4 pressure = (float4)(0);
+	float4 viscosity = (float4)(0);
+	for (int z = first.z; z <= last.z; ++z)
+		for (int y = first.y; y <= last.y; ++y)
+			for (int x = first.x; x <= last.x; ++x)
+			{
+				size_t cell = sphCellIndex((int4)(x, y, z, 0), a_cellGrid);
+				uint count = min(a_cellCounts[cell], (uint)SPH_CELL_CAPACITY);
+				for (uint i = 0; i < count; ++i)
+				{
+					uint other = a_cellParticles[cell * SPH_CELL_CAPACITY + i];
+					float4 d = p - a_particles[other];
+					d.w = 0;
+					float r = length(d);
+					if (other == particle || r >= a_radius)
+						continue;
+
+					float2 density = a_densities[other];
+					float falloff = a_radius - r;
+					if (r > 0)
+						pressure += d / r * ((own.y + density.y) / (2 * density.x) * falloff * falloff);
+					viscosity += (a_velocities[other] - v) / density.x * falloff;
+				}
+			}
+
+	float4 acceleration = (pressure + viscosity * a_viscosity) * spiky / own.x;
+	acceleration.y -= a_gravity;
+	acceleration.w = 0;
+	a_accelerations[particle] = acceleration;
+}
+
+// semi-implicit Euler, a particle leaving the box [0, size] is put back on its wall
+// with its speed into the wall reversed and damped
+kernel void kernelSphIntegrate(global float4* a_particles,
+							   global float4* a_velocities,
+							   global const float4* a_accelerations,
+							   float a_timeStep,
+							   float4 a_size)
+{
+	uint particle = get_global_id(0);
+	float4 v = a_velocities[particle] + a_accelerations[particle] * a_timeStep;
+	float4 p = a_particles[particle] + v * a_timeStep;
+
+	int4 outside = isless(p, (float4)(0)) | isgreater(p, a_size);
+	p = clamp(p, (float4)(0), a_size);
+	v = select(v, -v * SPH_WALL_DAMPING, outside);
+
+	p.w = 0;
+	v.w = 0;
+	a_particles[particle] = p;
+	a_velocities[particle] = v;
+}
+
+#endif
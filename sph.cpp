@@ -0,0 +1,175 @@
+#include "sph.h"
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+// kernel arguments from this index on are the field's, see setFieldArgs
+#define SPH_DENSITY_FIELD_ARG 3
+#define SPH_FORCES_FIELD_ARG 5
+
+// particles start this many to a radius
+#define SPH_LATTICE 2
+
+// poly6 density of a particle inside a lattice of the spacing, which the fluid settles
+// close to
+static cl_float latticeDensity(cl_float radius, cl_float spacing)
+{
+	int reach = (int)(radius / spacing);
+	double density = 0;
+	for (int z = -reach; z <= reach; ++z)
+		for (int y = -reach; y <= reach; ++y)
+			for (int x = -reach; x <= reach; ++x)
+			{
+				double q = radius * radius - (x * x + y * y + z * z) * spacing * spacing;
+				if (q > 0)
+					density += q * q * q;
+			}
+	return (cl_float)(density * 315 / (64 * 3.14159265 * pow(radius, 9)));
+}
+
+bool createSphSimulation(SphSimulation& sim, cl_context context, cl_command_queue queue, cl_program program,
+	const size_t* gridSize, const SphSettings& settings)
+{
+	cl_int result = CL_SUCCESS;
+	sim.clear = clCreateKernel(program, "kernelSphClear", &result);
+	CL_CHECK(result);
+	sim.bin = clCreateKernel(program, "kernelSphBin", &result);
+	CL_CHECK(result);
+	sim.density = clCreateKernel(program, "kernelSphDensity", &result);
+	CL_CHECK(result);
+	sim.forces = clCreateKernel(program, "kernelSphForces", &result);
+	CL_CHECK(result);
+	sim.integrate = clCreateKernel(program, "kernelSphIntegrate", &result);
+	CL_CHECK(result);
+	if (sim.clear == 0 || sim.bin == 0 || sim.density == 0 || sim.forces == 0 || sim.integrate == 0)
+		return false;
+
+	// the block fills half the grid's width and its whole depth, and as much of its
+	// height as the particles need. alternate layers sit a little apart along x so
+	// that the columns topple.
+	sim.settings = settings;
+	cl_float spacing = settings.radius / SPH_LATTICE;
+	size_t width = (size_t)std::max(1.0f, gridSize[0] * 0.5f / spacing);
+	size_t depth = (size_t)std::max(1.0f, gridSize[2] / spacing);
+	size_t height = (size_t)std::max(1.0f, gridSize[1] / spacing);
+	if (sim.settings.particleCount > width * depth * height)
+	{
+		sim.settings.particleCount = (cl_uint)(width * depth * height);
+		printf("Only %u particles fit the grid!\n", sim.settings.particleCount);
+	}
+	if (sim.settings.restDensity <= 0)
+		sim.settings.restDensity = latticeDensity(settings.radius, spacing);
+
+	std::vector<cl_float4> particles(sim.settings.particleCount);
+	for (size_t i = 0; i < particles.size(); ++i)
+	{
+		size_t layer = i / (width * depth);
+		cl_float4 p = { { (i % width + 0.5f + (layer & 1) * 0.25f) * spacing, (layer + 0.5f) * spacing,
+			(i / width % depth + 0.5f) * spacing, 0 } };
+		particles[i] = p;
+	}
+	std::vector<cl_float4> zeros(particles.size());
+
+	for (int axis = 0; axis < 3; ++axis)
+		sim.cellGrid.s[axis] = (cl_int)ceil(gridSize[axis] / settings.radius) + 1;
+	sim.cellGrid.s[3] = 1;
+	sim.cellCount = (size_t)sim.cellGrid.s[0] * sim.cellGrid.s[1] * sim.cellGrid.s[2];
+
+	size_t count = particles.size();
+	sim.particles = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_float4) * count, particles.data(), &result);
+	CL_CHECK(result);
+	sim.velocities = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_float4) * count, zeros.data(), &result);
+	CL_CHECK(result);
+	sim.densities = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_float2) * count, nullptr, &result);
+	CL_CHECK(result);
+	sim.accelerations = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_float4) * count, nullptr, &result);
+	CL_CHECK(result);
+	sim.cellCounts = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * sim.cellCount, nullptr, &result);
+	CL_CHECK(result);
+	sim.cellParticles = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * SPH_CELL_CAPACITY * sim.cellCount, nullptr, &result);
+	CL_CHECK(result);
+	if (sim.particles == 0 || sim.velocities == 0 || sim.densities == 0 || sim.accelerations == 0 ||
+		sim.cellCounts == 0 || sim.cellParticles == 0)
+		return false;
+
+	// the arguments never change, a step only enqueues
+	FieldArgs field = sphFieldArgs(sim);
+	cl_float4 size = { { (cl_float)gridSize[0], (cl_float)gridSize[1], (cl_float)gridSize[2], 0 } };
+	result = clSetKernelArg(sim.clear, 0, sizeof(cl_mem), &sim.cellCounts);
+
+	result |= clSetKernelArg(sim.bin, 0, sizeof(cl_mem), &sim.particles);
+	result |= clSetKernelArg(sim.bin, 1, sizeof(cl_mem), &sim.cellCounts);
+	result |= clSetKernelArg(sim.bin, 2, sizeof(cl_mem), &sim.cellParticles);
+	result |= clSetKernelArg(sim.bin, 3, sizeof(cl_int4), &sim.cellGrid);
+	result |= clSetKernelArg(sim.bin, 4, sizeof(cl_float), &sim.settings.radius);
+
+	result |= clSetKernelArg(sim.density, 0, sizeof(cl_mem), &sim.densities);
+	result |= clSetKernelArg(sim.density, 1, sizeof(cl_float), &sim.settings.restDensity);
+	result |= clSetKernelArg(sim.density, 2, sizeof(cl_float), &sim.settings.stiffness);
+	result |= setFieldArgs(sim.density, SPH_DENSITY_FIELD_ARG, field);
+
+	result |= clSetKernelArg(sim.forces, 0, sizeof(cl_mem), &sim.accelerations);
+	result |= clSetKernelArg(sim.forces, 1, sizeof(cl_mem), &sim.velocities);
+	result |= clSetKernelArg(sim.forces, 2, sizeof(cl_mem), &sim.densities);
+	result |= clSetKernelArg(sim.forces, 3, sizeof(cl_float), &sim.settings.viscosity);
+	result |= clSetKernelArg(sim.forces, 4, sizeof(cl_float), &sim.settings.gravity);
+	result |= setFieldArgs(sim.forces, SPH_FORCES_FIELD_ARG, field);
+
+	result |= clSetKernelArg(sim.integrate, 0, sizeof(cl_mem), &sim.particles);
+	result |= clSetKernelArg(sim.integrate, 1, sizeof(cl_mem), &sim.velocities);
+	result |= clSetKernelArg(sim.integrate, 2, sizeof(cl_mem), &sim.accelerations);
+	result |= clSetKernelArg(sim.integrate, 3, sizeof(cl_float), &sim.settings.timeStep);
+	result |= clSetKernelArg(sim.integrate, 4, sizeof(cl_float4), &size);
+	CL_CHECK(result);
+
+	// the first step's densities need the starting bins
+	result = clEnqueueNDRangeKernel(queue, sim.clear, 1, 0, &sim.cellCount, 0, 0, nullptr, 0);
+	result |= clEnqueueNDRangeKernel(queue, sim.bin, 1, 0, &count, 0, 0, nullptr, 0);
+	CL_CHECK(result);
+	return result == CL_SUCCESS;
+}
+
+void releaseSphSimulation(SphSimulation& sim)
+{
+	clReleaseMemObject(sim.cellParticles);
+	clReleaseMemObject(sim.cellCounts);
+	clReleaseMemObject(sim.accelerations);
+	clReleaseMemObject(sim.densities);
+	clReleaseMemObject(sim.velocities);
+	clReleaseMemObject(sim.particles);
+	clReleaseKernel(sim.integrate);
+	clReleaseKernel(sim.forces);
+	clReleaseKernel(sim.density);
+	clReleaseKernel(sim.bin);
+	clReleaseKernel(sim.clear);
+}
+
+cl_int enqueueSphStep(SphSimulation& sim, cl_command_queue queue, cl_uint waitCount, const cl_event* waitEvents, cl_event* event)
+{
+	// in order queue, only the first command needs the caller's events. the bins are
+	// rebuilt after every move so the field always sees them match the particles.
+	size_t count = sim.settings.particleCount;
+	cl_int result = CL_SUCCESS;
+	for (cl_uint step = 0; step < sim.settings.substeps; ++step)
+	{
+		bool last = step + 1 == sim.settings.substeps;
+		result |= clEnqueueNDRangeKernel(queue, sim.density, 1, 0, &count, 0, step == 0 ? waitCount : 0, step == 0 ? waitEvents : nullptr, 0);
+		result |= clEnqueueNDRangeKernel(queue, sim.forces, 1, 0, &count, 0, 0, nullptr, 0);
+		result |= clEnqueueNDRangeKernel(queue, sim.integrate, 1, 0, &count, 0, 0, nullptr, 0);
+		result |= clEnqueueNDRangeKernel(queue, sim.clear, 1, 0, &sim.cellCount, 0, 0, nullptr, 0);
+		result |= clEnqueueNDRangeKernel(queue, sim.bin, 1, 0, &count, 0, 0, nullptr, last ? event : 0);
+	}
+	CL_CHECK(result);
+	return result;
+}
+
+FieldArgs sphFieldArgs(const SphSimulation& sim)
+{
+	FieldArgs args = particleFieldArgs(sim.particles, (cl_int)sim.settings.particleCount);
+	args.cellCounts = sim.cellCounts;
+	args.cellParticles = sim.cellParticles;
+	args.cellGrid = sim.cellGrid;
+	args.radius = sim.settings.radius;
+	return args;
+}
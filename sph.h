@@ -0,0 +1,55 @@
+#pragma once
+
+#include "clutil.h"
+
+// a fluid simulated on the device (sph.cl) for the FIELD_SPH field. the particles
+// never leave the device: every step updates them in place and bins them for the
+// field, so the extraction on the same queue reads them as they are. distances are in
+// cubes of the grid and times in seconds.
+struct SphSettings
+{
+	cl_uint		particleCount;
+	cl_float	radius;			// smoothing radius
+	cl_float	restDensity;	// 0 for the density of the starting lattice
+	cl_float	stiffness;		// pressure per density above the rest density
+	cl_float	viscosity;
+	cl_float	gravity;		// down y
+	cl_float	timeStep;
+	cl_uint		substeps;		// time steps per enqueueSphStep, at least 1
+};
+
+// particles a cell holds, as in field.cl
+#define SPH_CELL_CAPACITY 32
+
+struct SphSimulation
+{
+	cl_kernel	clear;
+	cl_kernel	bin;
+	cl_kernel	density;
+	cl_kernel	forces;
+	cl_kernel	integrate;
+
+	cl_mem		particles;		// position float4s, the field's
+	cl_mem		velocities;
+	cl_mem		densities;		// density and pressure float2s
+	cl_mem		accelerations;
+	cl_mem		cellCounts;		// particles binned into cells of the radius
+	cl_mem		cellParticles;
+
+	SphSettings	settings;
+	cl_int4		cellGrid;
+	size_t		cellCount;
+};
+
+// places the particles in a block against one wall of the grid, a dam about to break,
+// and bins them. the kernels come from a program built with -D FIELD_SPH.
+bool createSphSimulation(SphSimulation& sim, cl_context context, cl_command_queue queue, cl_program program,
+	const size_t* gridSize, const SphSettings& settings);
+void releaseSphSimulation(SphSimulation& sim);
+
+// advances the fluid by settings.substeps time steps, the first command waits for the
+// events. whatever marches the field after it on the in order queue sees the result.
+cl_int enqueueSphStep(SphSimulation& sim, cl_command_queue queue, cl_uint waitCount, const cl_event* waitEvents, cl_event* event);
+
+// the field arguments of the particles for setFieldArgs
+FieldArgs sphFieldArgs(const SphSimulation& sim);
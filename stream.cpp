@@ -0,0 +1,309 @@
+#include "stream.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string.h>
+
+struct Brick
+{
+	size_t	origin[3];	// first sample, in volume coordinates
+	size_t	cubes[3];	// cubes along each axis, samples are cubes + 1
+};
+
+// pinned host memory a brick is copied into before upload.
+// one slot is filled by the prefetch thread while the other one marches.
+struct BrickSlot
+{
+	cl_mem	staging;
+	char*	samples;
+	Brick	brick;
+	bool	full;
+};
+
+struct Prefetcher
+{
+	std::mutex				mutex;
+	std::condition_variable	changed;
+	BrickSlot				slots[2];
+	bool					cancelled;
+};
+
+struct StreamData
+{
+	cl_command_queue	queue;
+	cl_kernel			kernel;
+	cl_mem				fieldLink;
+	cl_mem				faceCountLink;
+	cl_mem				vertexLink;
+
+	cl_uint				maxFaces;
+	cl_float			threshold;
+	std::vector<cl_float4>	vertices;	// readback of a single region
+
+	StreamSink			sink;
+	void*				userData;
+	size_t				totalFaces;
+};
+
+static size_t brickBytes(size_t cubes, size_t voxelBytes)
+{
+	return (cubes + 1) * (cubes + 1) * (cubes + 1) * voxelBytes;
+}
+
+// copies the samples of a brick out of the mapped volume. this is where the file is
+// actually read, page faults happen here on the prefetch thread.
+static void copyBrick(Volume& volume, const Brick& brick, char* samples)
+{
+	size_t rowBytes = (brick.cubes[0] + 1) * volume.voxelBytes;
+	for (size_t z = 0; z <= brick.cubes[2]; ++z)
+	{
+		for (size_t y = 0; y <= brick.cubes[1]; ++y)
+		{
+			memcpy(samples, volumeSample(volume, brick.origin[0], brick.origin[1] + y, brick.origin[2] + z), rowBytes);
+			samples += rowBytes;
+		}
+	}
+
+	// the rows of this brick are done with, don't let them pile up in the working set
+	const char* first = volumeSample(volume, brick.origin[0], brick.origin[1], brick.origin[2]);
+	const char* last = volumeSample(volume, brick.origin[0], brick.origin[1] + brick.cubes[1], brick.origin[2] + brick.cubes[2]) + rowBytes;
+	releaseMappedRange(volume.file, first - volume.file.data, last - first);
+}
+
+static void prefetchBricks(Prefetcher* prefetcher, Volume* volume, const std::vector<Brick>* bricks)
+{
+	for (size_t i = 0; i < bricks->size(); ++i)
+	{
+		BrickSlot& slot = prefetcher->slots[i % 2];
+		{
+			std::unique_lock<std::mutex> lock(prefetcher->mutex);
+			while (slot.full && !prefetcher->cancelled)
+				prefetcher->changed.wait(lock);
+			if (prefetcher->cancelled)
+				return;
+		}
+
+		copyBrick(*volume, (*bricks)[i], slot.samples);
+
+		std::lock_guard<std::mutex> lock(prefetcher->mutex);
+		slot.brick = (*bricks)[i];
+		slot.full = true;
+		prefetcher->changed.notify_all();
+	}
+}
+
+// marches a region of the uploaded brick. if the region produces more faces than the
+// output buffer holds it is split in half and each half is marched again, so the
+// output buffer never has to grow.
+static bool marchRegion(StreamData& stream, const size_t offset[3], const size_t size[3])
+{
+	static const cl_uint zero = 0;
+	cl_uint faceCount = 0;
+	cl_int result = clEnqueueWriteBuffer(stream.queue, stream.faceCountLink, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, nullptr, nullptr);
+	CL_CHECK(result);
+	result |= clEnqueueNDRangeKernel(stream.queue, stream.kernel, 3, offset, size, 0, 0, nullptr, nullptr);
+	CL_CHECK(result);
+	result |= clEnqueueReadBuffer(stream.queue, stream.faceCountLink, CL_TRUE, 0, sizeof(cl_uint), &faceCount, 0, nullptr, nullptr);
+	CL_CHECK(result);
+	if (result != CL_SUCCESS)
+		return false;
+
+	if (faceCount > stream.maxFaces)
+	{
+		int axis = 0;
+		if (size[1] > size[axis]) axis = 1;
+		if (size[2] > size[axis]) axis = 2;
+
+		size_t lowerSize[3] = { size[0], size[1], size[2] };
+		size_t upperSize[3] = { size[0], size[1], size[2] };
+		size_t upperOffset[3] = { offset[0], offset[1], offset[2] };
+		lowerSize[axis] = size[axis] / 2;
+		upperSize[axis] = size[axis] - lowerSize[axis];
+		upperOffset[axis] += lowerSize[axis];
+
+		return marchRegion(stream, offset, lowerSize) &&
+			marchRegion(stream, upperOffset, upperSize);
+	}
+
+	if (faceCount > 0)
+	{
+		result = clEnqueueReadBuffer(stream.queue, stream.vertexLink, CL_TRUE, 0, sizeof(cl_float4) * 6 * faceCount, stream.vertices.data(), 0, nullptr, nullptr);
+		CL_CHECK(result);
+		if (result != CL_SUCCESS)
+			return false;
+
+		stream.sink(stream.vertices.data(), faceCount, stream.userData);
+		stream.totalFaces += faceCount;
+	}
+	return true;
+}
+
+bool streamVolume(cl_context context, cl_device_id device, cl_command_queue queue,
+	Volume& volume, const StreamSettings& settings, StreamSink sink, void* userData)
+{
+	// the budget holds two staging bricks and the device copy of a brick, whatever is
+	// left over goes to the device output buffer and its host readback
+	size_t brickSize = settings.brickSize;
+	if (brickSize == 0)
+	{
+		brickSize = 512;
+		while (brickSize > 8 && brickBytes(brickSize, volume.voxelBytes) * 3 > settings.memoryBudget / 2)
+			brickSize /= 2;
+	}
+
+	cl_ulong maxAlloc = 0;
+	clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxAlloc, 0);
+
+	size_t fieldBytes = brickBytes(brickSize, volume.voxelBytes);
+	size_t outputBytes = settings.memoryBudget > fieldBytes * 3 ? (settings.memoryBudget - fieldBytes * 3) / 2 : 0;
+	if (outputBytes > maxAlloc)
+		outputBytes = (size_t)maxAlloc;
+
+	StreamData stream;
+	stream.queue = queue;
+	stream.maxFaces = (cl_uint)(outputBytes / (sizeof(cl_float4) * 6));
+	stream.threshold = settings.threshold;
+	stream.sink = sink;
+	stream.userData = userData;
+	stream.totalFaces = 0;
+
+	// a single cube can emit 5 faces, anything less can't make progress
+	if (stream.maxFaces < 5 || fieldBytes > maxAlloc)
+	{
+		printf("Stream budget of %zu bytes is too small for %zu^3 bricks!\n", settings.memoryBudget, brickSize);
+		return false;
+	}
+	printf("Streaming %zu^3 bricks, %u faces per pass\n", brickSize, stream.maxFaces);
+
+	// split the volume into bricks, neighbouring bricks share a layer of samples
+	std::vector<Brick> bricks;
+	size_t cubes[3] = { volume.size[0] - 1, volume.size[1] - 1, volume.size[2] - 1 };
+	for (size_t z = 0; z < cubes[2]; z += brickSize)
+	{
+		for (size_t y = 0; y < cubes[1]; y += brickSize)
+		{
+			for (size_t x = 0; x < cubes[0]; x += brickSize)
+			{
+				Brick brick = { { x, y, z }, { 0, 0, 0 } };
+				for (int axis = 0; axis < 3; ++axis)
+					brick.cubes[axis] = cubes[axis] - brick.origin[axis] < brickSize ? cubes[axis] - brick.origin[axis] : brickSize;
+				bricks.push_back(brick);
+			}
+		}
+	}
+
+	// device resources
+	cl_int result = CL_SUCCESS;
+	cl_program program = buildProgram(context, device, volumeBuildOptions(volume));
+	if (program == 0)
+		return false;
+	stream.kernel = clCreateKernel(program, "kernelMC", &result);
+	CL_CHECK(result);
+	stream.fieldLink = clCreateBuffer(context, CL_MEM_READ_ONLY, fieldBytes, nullptr, &result);
+	CL_CHECK(result);
+	stream.faceCountLink = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), nullptr, &result);
+	CL_CHECK(result);
+	stream.vertexLink = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_float4) * 6 * stream.maxFaces, nullptr, &result);
+	CL_CHECK(result);
+	stream.vertices.resize(6 * (size_t)stream.maxFaces);
+
+	Prefetcher prefetcher;
+	prefetcher.cancelled = false;
+	for (int i = 0; i < 2; ++i)
+	{
+		BrickSlot& slot = prefetcher.slots[i];
+		slot.staging = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, fieldBytes, nullptr, &result);
+		CL_CHECK(result);
+		slot.samples = (char*)clEnqueueMapBuffer(queue, slot.staging, CL_TRUE, CL_MAP_WRITE, 0, fieldBytes, 0, nullptr, nullptr, &result);
+		CL_CHECK(result);
+		slot.full = false;
+	}
+
+	bool ok = stream.kernel != 0 && stream.fieldLink != 0 && stream.vertexLink != 0 &&
+		prefetcher.slots[0].samples != nullptr && prefetcher.slots[1].samples != nullptr;
+
+	std::thread prefetchThread;
+	if (ok)
+		prefetchThread = std::thread(prefetchBricks, &prefetcher, &volume, &bricks);
+
+	cl_float2 fieldScale = volumeNormalization(volume);
+	cl_float4 worldOrigin = volumeOrigin(volume);
+	cl_float4 spacing = volumeSpacing(volume);
+	for (size_t i = 0; i < bricks.size() && ok; ++i)
+	{
+		BrickSlot& slot = prefetcher.slots[i % 2];
+		{
+			std::unique_lock<std::mutex> lock(prefetcher.mutex);
+			while (!slot.full)
+				prefetcher.changed.wait(lock);
+		}
+
+		Brick brick = slot.brick;
+		cl_int4 fieldSize = { { (cl_int)brick.cubes[0] + 1, (cl_int)brick.cubes[1] + 1, (cl_int)brick.cubes[2] + 1, 1 } };
+		// the brick's first sample in world space, its vertices land where the whole volume's would
+		cl_float4 origin = worldOrigin;
+		for (int axis = 0; axis < 3; ++axis)
+			origin.s[axis] += brick.origin[axis] * spacing.s[axis];
+		size_t sampleBytes = volume.voxelBytes * fieldSize.x * fieldSize.y * fieldSize.z;
+
+		cl_event writeEvent = 0;
+		result = clEnqueueWriteBuffer(queue, stream.fieldLink, CL_FALSE, 0, sampleBytes, slot.samples, 0, nullptr, &writeEvent);
+		CL_CHECK(result);
+
+		result |= clSetKernelArg(stream.kernel, 0, sizeof(cl_int), &stream.maxFaces);
+		result |= clSetKernelArg(stream.kernel, 1, sizeof(cl_mem), &stream.faceCountLink);
+		result |= clSetKernelArg(stream.kernel, 2, sizeof(cl_mem), &stream.vertexLink);
+		result |= clSetKernelArg(stream.kernel, 3, sizeof(cl_float), &stream.threshold);
+		result |= clSetKernelArg(stream.kernel, 4, sizeof(cl_float4), &origin);
+		result |= clSetKernelArg(stream.kernel, 5, sizeof(cl_float4), &spacing);
+		result |= clSetKernelArg(stream.kernel, 6, sizeof(cl_mem), &stream.fieldLink);
+		result |= clSetKernelArg(stream.kernel, 7, sizeof(cl_int4), &fieldSize);
+		result |= clSetKernelArg(stream.kernel, 8, sizeof(cl_float2), &fieldScale);
+		CL_CHECK(result);
+
+		// once the upload is done the slot can take the brick after next
+		if (writeEvent != 0)
+		{
+			clWaitForEvents(1, &writeEvent);
+			clReleaseEvent(writeEvent);
+		}
+		{
+			std::lock_guard<std::mutex> lock(prefetcher.mutex);
+			slot.full = false;
+			prefetcher.changed.notify_all();
+		}
+
+		size_t offset[3] = { 0, 0, 0 };
+		ok = result == CL_SUCCESS && marchRegion(stream, offset, brick.cubes);
+	}
+
+	if (prefetchThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(prefetcher.mutex);
+			prefetcher.cancelled = true;
+			prefetcher.changed.notify_all();
+		}
+		prefetchThread.join();
+	}
+
+	printf("Streamed %zu bricks, %zu faces\n", bricks.size(), stream.totalFaces);
+
+	// cleanup
+	for (int i = 0; i < 2; ++i)
+	{
+		if (prefetcher.slots[i].samples != nullptr)
+			clEnqueueUnmapMemObject(queue, prefetcher.slots[i].staging, prefetcher.slots[i].samples, 0, nullptr, nullptr);
+		clReleaseMemObject(prefetcher.slots[i].staging);
+	}
+	clFinish(queue);
+	clReleaseMemObject(stream.vertexLink);
+	clReleaseMemObject(stream.faceCountLink);
+	clReleaseMemObject(stream.fieldLink);
+	clReleaseKernel(stream.kernel);
+	clReleaseProgram(program);
+
+	return ok;
+}
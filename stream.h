@@ -0,0 +1,21 @@
+#pragma once
+
+#include "clutil.h"
+#include "volume.h"
+
+// out-of-core extraction: walks a volume brick by brick with a one sample overlap,
+// prefetching the next brick on a background thread while the current one marches.
+// every brick's triangles are read back and handed to the sink, so host and device
+// memory stay within the budget no matter how large the volume is.
+struct StreamSettings
+{
+	size_t		memoryBudget;	// bytes of host + device memory the stream may hold
+	size_t		brickSize;		// cubes per brick axis, 0 derives it from the budget
+	cl_float	threshold;
+};
+
+// receives 3 vertices per face, each as a position and a normal float4
+typedef void (*StreamSink)(const cl_float4* vertices, cl_uint faceCount, void* userData);
+
+bool streamVolume(cl_context context, cl_device_id device, cl_command_queue queue,
+	Volume& volume, const StreamSettings& settings, StreamSink sink, void* userData);
@@ -0,0 +1,154 @@
+// slab sweep extraction of volumes too large for the device
+//
+// the volume is marched one layer of cubes at a time along z. the device holds a ring
+// of SWEEP_SLICES sample slices: the layer's two and one either side of them for the
+// normals' central differences. every crossed lattice edge gets its vertex (position
+// and normal) computed once into an edge cache, the cubes on either side of it, in
+// this layer or the next, copy it from there:
+//   planes   x and y edges of the last two slices, two slots used in turn
+//   columns  z edges between the layer's slices
+// kernelSweepEdges fills the caches for a slice and kernelSweepFaces writes the
+// triangles of a layer from them.
+
+#if defined(FIELD_VOLUME) && !defined(FIELD_BRICKED) && !defined(FIELD_IMAGE)
+
+#define SWEEP_SLICES 4
+
+// sample at p, clamped to the volume (size). slice z sits in slot z % SWEEP_SLICES of
+// the ring and must be one of the slices it holds.
+float sweepSample(int4 p, global const VOXEL_T* ring, int4 size, float2 scale)
+{
+	p = clamp(p, (int4)(0), size - (int4)(1));
+	size_t slice = (size_t)size.x * size.y;
+	return loadVoxel(ring, (p.z % SWEEP_SLICES) * slice + p.x + (size_t)size.x * p.y) * scale.x + scale.y;
+}
+
+float sweepSampleVolume(float4 v, global const VOXEL_T* ring, int4 size, float2 scale)
+{
+	float4 base = floor(v);
+	float4 t = v - base;
+	int4 p = convert_int4(base);
+
+	float c000 = sweepSample(p, ring, size, scale);
+	float c100 = sweepSample(p + (int4)(1, 0, 0, 0), ring, size, scale);
+	float c010 = sweepSample(p + (int4)(0, 1, 0, 0), ring, size, scale);
+	float c110 = sweepSample(p + (int4)(1, 1, 0, 0), ring, size, scale);
+	float c001 = sweepSample(p + (int4)(0, 0, 1, 0), ring, size, scale);
+	float c101 = sweepSample(p + (int4)(1, 0, 1, 0), ring, size, scale);
+	float c011 = sweepSample(p + (int4)(0, 1, 1, 0), ring, size, scale);
+	float c111 = sweepSample(p + (int4)(1, 1, 1, 0), ring, size, scale);
+
+	float c00 = mix(c000, c100, t.x);
+	float c10 = mix(c010, c110, t.x);
+	float c01 = mix(c001, c101, t.x);
+	float c11 = mix(c011, c111, t.x);
+
+	return mix(mix(c00, c10, t.y), mix(c01, c11, t.y), t.z);
+}
+
+// fieldNormal through the ring
+float4 sweepNormal(float4 position, global const VOXEL_T* ring, int4 size, float2 scale)
+{
+	const float d = FIELD_GRADIENT_STEP;
+	float4 normal;
+	normal.x = sweepSampleVolume(position - (float4)(d, 0, 0, 0), ring, size, scale) -
+		sweepSampleVolume(position + (float4)(d, 0, 0, 0), ring, size, scale);
+	normal.y = sweepSampleVolume(position - (float4)(0, d, 0, 0), ring, size, scale) -
+		sweepSampleVolume(position + (float4)(0, d, 0, 0), ring, size, scale);
+	normal.z = sweepSampleVolume(position - (float4)(0, 0, d, 0), ring, size, scale) -
+		sweepSampleVolume(position + (float4)(0, 0, d, 0), ring, size, scale);
+	normal.w = 0;
+
+	if (dot(normal, normal) > 0)
+		normal = normalize(normal);
+	return normal;
+}
+
+// caches the vertex of the lattice edge from p along axis, if the surface crosses it.
+// an edge that isn't crossed is never read, it is left as it was.
+void sweepEdge(int4 p, int axis, float threshold, float4 origin, float4 spacing, global float4* cache,
+			   global const VOXEL_T* ring, int4 size, float2 scale)
+{
+	int4 step = (int4)(axis == 0, axis == 1, axis == 2, 0);
+	float v0 = sweepSample(p, ring, size, scale);
+	float v1 = sweepSample(p + step, ring, size, scale);
+	if ((v0 <= threshold) == (v1 <= threshold))
+		return;
+
+	float4 position = convert_float4(p) + convert_float4(step) * ((threshold - v0) / (v1 - v0));
+	position.w = 1.0f;
+	cache[0] = worldPosition(position, origin, spacing);
+	cache[1] = worldNormal(sweepNormal(position, ring, size, scale), spacing);
+}
+
+// one work-item per sample of slice a_slice: the x and y edges leaving it within the
+// slice go to the slice's plane slot, the z edge arriving at it from the slice below
+// to the columns. the ring must hold slices a_slice - 2 to a_slice + 1 (those that
+// exist).
+kernel void kernelSweepEdges(int a_slice,
+							 float a_threshold,
+							 float4 a_origin,
+							 float4 a_spacing,
+							 global float4* a_planes,
+							 global float4* a_columns,
+							 global const VOXEL_T* a_ring,
+							 int4 a_fieldSize,
+							 float2 a_fieldScale)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	size_t sample = x + (size_t)a_fieldSize.x * y;
+	size_t slice = (size_t)a_fieldSize.x * a_fieldSize.y;
+	global float4* plane = a_planes + (a_slice & 1) * slice * 4;
+	int4 p = (int4)(x, y, a_slice, 0);
+
+	if (x + 1 < a_fieldSize.x)
+		sweepEdge(p, 0, a_threshold, a_origin, a_spacing, plane + sample * 4, a_ring, a_fieldSize, a_fieldScale);
+	if (y + 1 < a_fieldSize.y)
+		sweepEdge(p, 1, a_threshold, a_origin, a_spacing, plane + sample * 4 + 2, a_ring, a_fieldSize, a_fieldScale);
+	if (a_slice > 0)
+		sweepEdge(p - (int4)(0, 0, 1, 0), 2, a_threshold, a_origin, a_spacing, a_columns + sample * 2, a_ring, a_fieldSize, a_fieldScale);
+}
+
+// one work-item per cube of layer a_layer (between slices a_layer and a_layer + 1),
+// whose edges must have been cached. faces are reserved like kernelMC's.
+kernel void kernelSweepFaces(int a_layer,
+							 int a_maxFaces,
+							 global uint* a_faceCount,
+							 global float4* a_vertices,
+							 float a_threshold,
+							 global const float4* a_planes,
+							 global const float4* a_columns,
+							 global const VOXEL_T* a_ring,
+							 int4 a_fieldSize,
+							 float2 a_fieldScale)
+{
+	int4 cube = (int4)(get_global_id(0), get_global_id(1), a_layer, 0);
+	float cornerVolumes[8];
+	for (int i = 0; i < 8; ++i)
+		cornerVolumes[i] = sweepSample(cube + convert_int4(CUBE_CORNERS[i]) * (int4)(1, 1, 1, 0), a_ring, a_fieldSize, a_fieldScale);
+
+	int flagIndex = cubeFlags(cornerVolumes, a_threshold);
+	int faces = cubeFaces(flagIndex);
+	uint firstFace = reserveFaces(a_faceCount, faces);
+
+	size_t slice = (size_t)a_fieldSize.x * a_fieldSize.y;
+	for (int triangleIndex = 0; triangleIndex < faces; ++triangleIndex)
+	{
+		uint face = firstFace + triangleIndex;
+		if (face >= a_maxFaces)
+			break;
+
+		for (int triangleVertex = 0; triangleVertex < 3; ++triangleVertex)
+		{
+			int4 edge = LATTICE_EDGES[ TRIANGLE_TABLE[ flagIndex ][ 3 * triangleIndex + triangleVertex ] ];
+			size_t sample = cube.x + edge.x + (size_t)a_fieldSize.x * (cube.y + edge.y);
+			global const float4* cached = edge.w == 2 ? a_columns + sample * 2 :
+				a_planes + ((a_layer + edge.z) & 1) * slice * 4 + sample * 4 + edge.w * 2;
+			a_vertices[face * 6 + triangleVertex * 2] = cached[0];
+			a_vertices[face * 6 + triangleVertex * 2 + 1] = cached[1];
+		}
+	}
+}
+
+#endif
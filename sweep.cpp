@@ -0,0 +1,193 @@
+#include "sweep.h"
+
+#include <vector>
+
+// slices of samples the device holds, matches SWEEP_SLICES in sweep.cl
+#define SWEEP_SLICES 4
+
+struct SweepData
+{
+	cl_command_queue	queue;
+	cl_kernel			faces;
+	cl_mem				faceCountLink;
+	cl_mem				vertexLink;
+
+	cl_uint				maxFaces;
+	std::vector<cl_float4>	vertices;	// readback of a single pass
+
+	StreamSink			sink;
+	void*				userData;
+	size_t				totalFaces;
+};
+
+// writes the faces of rows [first, first + count) of a layer, whose arguments are set.
+// rows that make more faces than the output holds are split in half and written again.
+static bool sweepRows(SweepData& sweep, size_t cubesX, size_t first, size_t count)
+{
+	static const cl_uint zero = 0;
+	cl_uint faceCount = 0;
+	size_t offset[2] = { 0, first };
+	size_t size[2] = { cubesX, count };
+	cl_int result = clEnqueueWriteBuffer(sweep.queue, sweep.faceCountLink, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, nullptr, nullptr);
+	result |= clEnqueueNDRangeKernel(sweep.queue, sweep.faces, 2, offset, size, 0, 0, nullptr, nullptr);
+	result |= clEnqueueReadBuffer(sweep.queue, sweep.faceCountLink, CL_TRUE, 0, sizeof(cl_uint), &faceCount, 0, nullptr, nullptr);
+	CL_CHECK(result);
+	if (result != CL_SUCCESS)
+		return false;
+
+	if (faceCount > sweep.maxFaces && count > 1)
+		return sweepRows(sweep, cubesX, first, count / 2) &&
+			sweepRows(sweep, cubesX, first + count / 2, count - count / 2);
+	if (faceCount > sweep.maxFaces)
+	{
+		printf("A row of %zu cubes makes %u faces, more than the %u the budget holds!\n", cubesX, faceCount, sweep.maxFaces);
+		return false;
+	}
+
+	if (faceCount > 0)
+	{
+		result = clEnqueueReadBuffer(sweep.queue, sweep.vertexLink, CL_TRUE, 0, sizeof(cl_float4) * 6 * faceCount, sweep.vertices.data(), 0, nullptr, nullptr);
+		CL_CHECK(result);
+		if (result != CL_SUCCESS)
+			return false;
+
+		sweep.sink(sweep.vertices.data(), faceCount, sweep.userData);
+		sweep.totalFaces += faceCount;
+	}
+	return true;
+}
+
+bool sweepVolume(cl_context context, cl_device_id device, cl_command_queue queue,
+	Volume& volume, const StreamSettings& settings, StreamSink sink, void* userData)
+{
+	// the ring of slices and the caches (a position and normal for the x and y edges of
+	// two slices and the z edges of a layer) are fixed, the rest of the budget goes to
+	// the output and its host readback
+	size_t sliceSamples = volume.size[0] * volume.size[1];
+	size_t sliceBytes = sliceSamples * volume.voxelBytes;
+	size_t ringBytes = sliceBytes * SWEEP_SLICES;
+	size_t planeBytes = sizeof(cl_float4) * 4 * sliceSamples * 2;
+	size_t columnBytes = sizeof(cl_float4) * 2 * sliceSamples;
+	size_t fixedBytes = ringBytes + planeBytes + columnBytes;
+
+	cl_ulong maxAlloc = 0;
+	clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxAlloc, 0);
+	size_t outputBytes = settings.memoryBudget > fixedBytes ? (settings.memoryBudget - fixedBytes) / 2 : 0;
+	if (outputBytes > maxAlloc)
+		outputBytes = (size_t)maxAlloc;
+
+	SweepData sweep;
+	sweep.queue = queue;
+	sweep.maxFaces = (cl_uint)(outputBytes / (sizeof(cl_float4) * 6));
+	sweep.sink = sink;
+	sweep.userData = userData;
+	sweep.totalFaces = 0;
+
+	// a row of cubes can emit 5 faces each, anything less can't make progress
+	size_t cubesX = volume.size[0] - 1;
+	size_t cubesY = volume.size[1] - 1;
+	if (sweep.maxFaces < 5 * cubesX || planeBytes > maxAlloc)
+	{
+		printf("Sweep budget of %zu bytes is too small for %zu x %zu slices!\n", settings.memoryBudget, volume.size[0], volume.size[1]);
+		return false;
+	}
+	printf("Sweeping %zu x %zu slices, %u faces per pass\n", volume.size[0], volume.size[1], sweep.maxFaces);
+
+	// device resources
+	cl_int result = CL_SUCCESS;
+	cl_program program = buildProgram(context, device, volumeBuildOptions(volume));
+	if (program == 0)
+		return false;
+	cl_kernel edges = clCreateKernel(program, "kernelSweepEdges", &result);
+	CL_CHECK(result);
+	sweep.faces = clCreateKernel(program, "kernelSweepFaces", &result);
+	CL_CHECK(result);
+	cl_mem ringLink = clCreateBuffer(context, CL_MEM_READ_ONLY, ringBytes, nullptr, &result);
+	CL_CHECK(result);
+	cl_mem planeLink = clCreateBuffer(context, CL_MEM_READ_WRITE, planeBytes, nullptr, &result);
+	CL_CHECK(result);
+	cl_mem columnLink = clCreateBuffer(context, CL_MEM_READ_WRITE, columnBytes, nullptr, &result);
+	CL_CHECK(result);
+	sweep.faceCountLink = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), nullptr, &result);
+	CL_CHECK(result);
+	sweep.vertexLink = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_float4) * 6 * sweep.maxFaces, nullptr, &result);
+	CL_CHECK(result);
+	sweep.vertices.resize(6 * (size_t)sweep.maxFaces);
+
+	bool ok = edges != 0 && sweep.faces != 0 && ringLink != 0 && planeLink != 0 && columnLink != 0 && sweep.vertexLink != 0;
+
+	cl_float threshold = settings.threshold;
+	cl_float2 fieldScale = volumeNormalization(volume);
+	cl_float4 origin = volumeOrigin(volume);
+	cl_float4 spacing = volumeSpacing(volume);
+	cl_int4 fieldSize = { { (cl_int)volume.size[0], (cl_int)volume.size[1], (cl_int)volume.size[2], 1 } };
+	cl_int maxFaces = (cl_int)sweep.maxFaces;
+
+	result = clSetKernelArg(edges, 1, sizeof(cl_float), &threshold);
+	result |= clSetKernelArg(edges, 2, sizeof(cl_float4), &origin);
+	result |= clSetKernelArg(edges, 3, sizeof(cl_float4), &spacing);
+	result |= clSetKernelArg(edges, 4, sizeof(cl_mem), &planeLink);
+	result |= clSetKernelArg(edges, 5, sizeof(cl_mem), &columnLink);
+	result |= clSetKernelArg(edges, 6, sizeof(cl_mem), &ringLink);
+	result |= clSetKernelArg(edges, 7, sizeof(cl_int4), &fieldSize);
+	result |= clSetKernelArg(edges, 8, sizeof(cl_float2), &fieldScale);
+	result |= clSetKernelArg(sweep.faces, 1, sizeof(cl_int), &maxFaces);
+	result |= clSetKernelArg(sweep.faces, 2, sizeof(cl_mem), &sweep.faceCountLink);
+	result |= clSetKernelArg(sweep.faces, 3, sizeof(cl_mem), &sweep.vertexLink);
+	result |= clSetKernelArg(sweep.faces, 4, sizeof(cl_float), &threshold);
+	result |= clSetKernelArg(sweep.faces, 5, sizeof(cl_mem), &planeLink);
+	result |= clSetKernelArg(sweep.faces, 6, sizeof(cl_mem), &columnLink);
+	result |= clSetKernelArg(sweep.faces, 7, sizeof(cl_mem), &ringLink);
+	result |= clSetKernelArg(sweep.faces, 8, sizeof(cl_int4), &fieldSize);
+	result |= clSetKernelArg(sweep.faces, 9, sizeof(cl_float2), &fieldScale);
+	CL_CHECK(result);
+	ok = ok && result == CL_SUCCESS;
+
+	// slice s needs s - 2 to s + 1 in the ring for its edges, uploading s + 1 replaces
+	// s - 3. the in-order queue keeps the upload behind the kernels still reading it.
+	// slices are contiguous in the file and go to the device straight from the mapping.
+	size_t slices = volume.size[2];
+	size_t edgeSize[2] = { volume.size[0], volume.size[1] };
+	for (size_t slice = 0; slice < slices && ok; ++slice)
+	{
+		for (size_t upload = slice == 0 ? 0 : slice + 1; upload <= slice + 1 && upload < slices; ++upload)
+		{
+			result = clEnqueueWriteBuffer(queue, ringLink, CL_FALSE, (upload % SWEEP_SLICES) * sliceBytes, sliceBytes,
+				volumeSample(volume, 0, 0, upload), 0, nullptr, nullptr);
+			CL_CHECK(result);
+		}
+
+		cl_int sliceIndex = (cl_int)slice;
+		result |= clSetKernelArg(edges, 0, sizeof(cl_int), &sliceIndex);
+		result |= clEnqueueNDRangeKernel(queue, edges, 2, 0, edgeSize, 0, 0, nullptr, nullptr);
+		CL_CHECK(result);
+		ok = result == CL_SUCCESS;
+		if (slice == 0 || !ok)
+			continue;
+
+		cl_int layer = (cl_int)slice - 1;
+		result = clSetKernelArg(sweep.faces, 0, sizeof(cl_int), &layer);
+		CL_CHECK(result);
+		ok = result == CL_SUCCESS && sweepRows(sweep, cubesX, 0, cubesY);
+
+		// the rows' reads are blocking, the uploads before them are done. slice - 2
+		// won't be uploaded from again, its pages can go.
+		if (slice >= 2)
+			releaseMappedRange(volume.file, volumeSample(volume, 0, 0, slice - 2) - volume.file.data, sliceBytes);
+	}
+
+	printf("Swept %zu slices, %zu faces\n", slices, sweep.totalFaces);
+
+	// cleanup
+	clFinish(queue);
+	clReleaseMemObject(sweep.vertexLink);
+	clReleaseMemObject(sweep.faceCountLink);
+	clReleaseMemObject(columnLink);
+	clReleaseMemObject(planeLink);
+	clReleaseMemObject(ringLink);
+	clReleaseKernel(sweep.faces);
+	clReleaseKernel(edges);
+	clReleaseProgram(program);
+
+	return ok;
+}
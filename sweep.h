@@ -0,0 +1,12 @@
+#pragma once
+
+#include "stream.h"
+
+// out-of-core extraction by slab sweep: the volume is marched one layer of cubes at a
+// time along z with only a ring of four sample slices and the edge vertex caches of
+// two slices on the device, O(n^2) memory where a brick is O(n^3). a vertex on an edge
+// shared by several cubes (in this layer or the next) is computed once. every layer's
+// triangles are read back and handed to the sink, a layer is split into rows when it
+// makes more faces than the output holds. brickSize is unused.
+bool sweepVolume(cl_context context, cl_device_id device, cl_command_queue queue,
+	Volume& volume, const StreamSettings& settings, StreamSink sink, void* userData);
@@ -0,0 +1,138 @@
+#include "trace.h"
+
+// tracks of the timeline, one row each
+enum TraceTrack
+{
+	TRACK_HOST,
+	TRACK_CL_QUEUED,	// a command from its enqueue until it starts
+	TRACK_CL,			// a command running on the device
+	TRACK_GL,
+	TRACK_COUNT
+};
+
+static const char* TRACK_NAMES[TRACK_COUNT] = { "Host", "CL queued", "CL device", "GL" };
+
+Tracer::Tracer()
+	: m_file(nullptr),
+	m_first(true),
+	m_aligned(false),
+	m_deviceOffset(0)
+{
+}
+
+Tracer::~Tracer()
+{
+	close();
+}
+
+bool Tracer::open(const char* path)
+{
+	close();
+	m_file = fopen(path, "wb");
+	if (m_file == nullptr)
+	{
+		printf("Failed to open %s for writing!\n", path);
+		return false;
+	}
+
+	m_first = true;
+	m_aligned = false;
+	m_start = std::chrono::steady_clock::now();
+	fprintf(m_file, "{\"traceEvents\":[");
+	for (int track = 0; track < TRACK_COUNT; ++track)
+	{
+		fprintf(m_file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			m_first ? "" : ",", track, TRACK_NAMES[track]);
+		m_first = false;
+	}
+	return true;
+}
+
+void Tracer::close()
+{
+	if (m_file == nullptr)
+		return;
+
+	// anything not flushed is waited for, the file is useless without it
+	for (size_t i = 0; i < m_commands.size(); ++i)
+		clWaitForEvents(1, &m_commands[i].event);
+	flush();
+
+	fprintf(m_file, "\n]}\n");
+	fclose(m_file);
+	m_file = nullptr;
+}
+
+double Tracer::now() const
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+void Tracer::command(const char* name, cl_event event)
+{
+	if (m_file == nullptr || event == 0)
+		return;
+	clRetainEvent(event);
+	Command command = { name, event, now() };
+	m_commands.push_back(command);
+}
+
+void Tracer::hostSpan(const char* name, double begin, double end)
+{
+	writeEvent(name, TRACK_HOST, begin, end - begin);
+}
+
+void Tracer::gpuSpan(const char* name, double begin, cl_ulong durationNs)
+{
+	writeEvent(name, TRACK_GL, begin, durationNs / 1000.0);
+}
+
+void Tracer::flush()
+{
+	for (size_t i = 0; i < m_commands.size(); ++i)
+	{
+		Command& command = m_commands[i];
+		cl_ulong times[4] = { 0, 0, 0, 0 };
+		static const cl_profiling_info INFOS[4] = { CL_PROFILING_COMMAND_QUEUED, CL_PROFILING_COMMAND_SUBMIT,
+			CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END };
+		cl_int result = CL_SUCCESS;
+		for (int info = 0; info < 4; ++info)
+			result |= clGetEventProfilingInfo(command.event, INFOS[info], sizeof(cl_ulong), &times[info], nullptr);
+		clReleaseEvent(command.event);
+		if (result != CL_SUCCESS)
+		{
+			// GL acquires and releases don't always carry profiling info
+			writeEvent(command.name.c_str(), TRACK_CL_QUEUED, command.recorded, 0, "{\"profiled\":false}");
+			continue;
+		}
+
+		// the device clock has its own epoch, the first command was queued just before it
+		// was recorded
+		if (!m_aligned)
+		{
+			m_deviceOffset = command.recorded - times[0] / 1000.0;
+			m_aligned = true;
+		}
+
+		double queued = times[0] / 1000.0 + m_deviceOffset;
+		double submit = times[1] / 1000.0 + m_deviceOffset;
+		double start = times[2] / 1000.0 + m_deviceOffset;
+		double end = times[3] / 1000.0 + m_deviceOffset;
+		char args[128];
+		snprintf(args, sizeof(args), "{\"submit\":%.3f,\"wait\":%.3f}", submit - queued, start - queued);
+		writeEvent(command.name.c_str(), TRACK_CL_QUEUED, queued, start - queued, args);
+		writeEvent(command.name.c_str(), TRACK_CL, start, end - start);
+	}
+	m_commands.clear();
+	if (m_file != nullptr)
+		fflush(m_file);
+}
+
+void Tracer::writeEvent(const char* name, int track, double begin, double duration, const char* args)
+{
+	if (m_file == nullptr)
+		return;
+	fprintf(m_file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f%s%s}",
+		m_first ? "" : ",", name, track, begin, duration, args != nullptr ? ",\"args\":" : "", args != nullptr ? args : "");
+	m_first = false;
+}
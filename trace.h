@@ -0,0 +1,58 @@
+#pragma once
+
+#include "clutil.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// timeline of a frame loop as a Chrome trace (chrome://tracing, Perfetto). OpenCL
+// commands are recorded by their event, which needs a queue created with
+// CL_QUEUE_PROFILING_ENABLE, and are read back once complete. host waits and GPU work
+// measured elsewhere (GL timer queries) are recorded as spans. times are microseconds
+// on the host's steady clock since open.
+class Tracer
+{
+public:
+	Tracer();
+	~Tracer();
+
+	bool open(const char* path);
+
+	// writes whatever is still pending and finishes the file
+	void close();
+
+	bool isOpen() const { return m_file != nullptr; }
+
+	double now() const;
+
+	// retains the event, it is read by the next flush. call right after the enqueue,
+	// the first command's queued time lines the device clock up with the host's.
+	void command(const char* name, cl_event event);
+
+	// a host span, such as a wait on glFinish or clFinish
+	void hostSpan(const char* name, double begin, double end);
+
+	// GPU work of a known duration, placed where it was issued
+	void gpuSpan(const char* name, double begin, cl_ulong durationNs);
+
+	// writes the recorded commands, which must have completed (after a clFinish)
+	void flush();
+
+private:
+	struct Command
+	{
+		std::string	name;
+		cl_event	event;
+		double		recorded;	// host time just after the enqueue
+	};
+
+	void writeEvent(const char* name, int track, double begin, double duration, const char* args = nullptr);
+
+	FILE*									m_file;
+	bool									m_first;		// no event written yet, for the commas
+	std::chrono::steady_clock::time_point	m_start;
+	std::vector<Command>					m_commands;
+	bool									m_aligned;
+	double									m_deviceOffset;	// device microseconds to host
+};
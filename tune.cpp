@@ -0,0 +1,310 @@
+#include "tune.h"
+
+#include <chrono>
+#include <stdlib.h>
+#include <vector>
+
+// timed runs per candidate, the fastest counts
+#define TUNE_RUNS 2
+
+// work-items per group tried, larger groups rarely win and would make the sweep of a
+// big grid take minutes
+#define TUNE_MIN_ITEMS 32
+#define TUNE_MAX_ITEMS 256
+
+static std::string deviceString(cl_device_id device, cl_device_info info)
+{
+	size_t size = 0;
+	if (clGetDeviceInfo(device, info, 0, nullptr, &size) != CL_SUCCESS || size == 0)
+		return "";
+	std::vector<char> value(size);
+	clGetDeviceInfo(device, info, size, value.data(), nullptr);
+	return value.data();
+}
+
+// a database file is an object of devices, each an object of dispatches mapped to
+// [x, y, z]. the reader only takes that shape, which is all the writer produces.
+static void skipSpace(const char*& p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+		++p;
+}
+
+static bool expect(const char*& p, char c)
+{
+	skipSpace(p);
+	if (*p != c)
+		return false;
+	++p;
+	return true;
+}
+
+static bool readString(const char*& p, std::string& value)
+{
+	if (!expect(p, '"'))
+		return false;
+	value.clear();
+	for (; *p != '"'; ++p)
+	{
+		if (*p == '\0')
+			return false;
+		if (*p == '\\' && p[1] != '\0')
+			++p;
+		value += *p;
+	}
+	++p;
+	return true;
+}
+
+static void writeString(FILE* file, const std::string& value)
+{
+	fputc('"', file);
+	for (size_t i = 0; i < value.size(); ++i)
+	{
+		if (value[i] == '"' || value[i] == '\\')
+			fputc('\\', file);
+		fputc(value[i], file);
+	}
+	fputc('"', file);
+}
+
+static bool readEntries(const char* p, std::map<std::string, std::map<std::string, LocalSize> >& entries)
+{
+	if (!expect(p, '{'))
+		return false;
+	skipSpace(p);
+	while (*p == '"')
+	{
+		std::string device;
+		if (!readString(p, device) || !expect(p, ':') || !expect(p, '{'))
+			return false;
+		skipSpace(p);
+		while (*p == '"')
+		{
+			std::string dispatch;
+			LocalSize local = { { 0, 0, 0 } };
+			if (!readString(p, dispatch) || !expect(p, ':') || !expect(p, '['))
+				return false;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				if (axis > 0 && !expect(p, ','))
+					return false;
+				skipSpace(p);
+				char* end = nullptr;
+				local.size[axis] = (size_t)strtoul(p, &end, 10);
+				if (end == p)
+					return false;
+				p = end;
+			}
+			if (!expect(p, ']'))
+				return false;
+			entries[device][dispatch] = local;
+			expect(p, ',');
+			skipSpace(p);
+		}
+		if (!expect(p, '}'))
+			return false;
+		expect(p, ',');
+		skipSpace(p);
+	}
+	return expect(p, '}');
+}
+
+bool openTuning(TuningDatabase& db, cl_device_id device)
+{
+	db.device = deviceString(device, CL_DEVICE_NAME) + " / " + deviceString(device, CL_DRIVER_VERSION);
+	db.changed = false;
+	db.entries.clear();
+
+	const char* path = db.path.c_str();
+	FILE* file = fopen(path, "rb");
+	if (file == nullptr)
+		return true;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	std::vector<char> text(size > 0 ? size + 1 : 1, '\0');
+	size_t read = size > 0 ? fread(text.data(), 1, size, file) : 0;
+	fclose(file);
+
+	if (read != (size_t)(size > 0 ? size : 0) || !readEntries(text.data(), db.entries))
+	{
+		printf("Tuning database %s is malformed, it will be rewritten!\n", path);
+		db.entries.clear();
+		return false;
+	}
+	return true;
+}
+
+bool saveTuning(TuningDatabase& db)
+{
+	if (!db.changed)
+		return true;
+	FILE* file = fopen(db.path.c_str(), "wb");
+	if (file == nullptr)
+	{
+		printf("Failed to open %s for writing!\n", db.path.c_str());
+		return false;
+	}
+
+	fprintf(file, "{");
+	for (std::map<std::string, std::map<std::string, LocalSize> >::const_iterator device = db.entries.begin(); device != db.entries.end(); ++device)
+	{
+		fprintf(file, "%s\n\t", device == db.entries.begin() ? "" : ",");
+		writeString(file, device->first);
+		fprintf(file, ": {");
+		for (std::map<std::string, LocalSize>::const_iterator entry = device->second.begin(); entry != device->second.end(); ++entry)
+		{
+			fprintf(file, "%s\n\t\t", entry == device->second.begin() ? "" : ",");
+			writeString(file, entry->first);
+			fprintf(file, ": [%u, %u, %u]", (unsigned)entry->second.size[0], (unsigned)entry->second.size[1], (unsigned)entry->second.size[2]);
+		}
+		fprintf(file, "\n\t}");
+	}
+	fprintf(file, "\n}\n");
+	bool written = ferror(file) == 0;
+	fclose(file);
+	db.changed = !written;
+	return written;
+}
+
+// kernel name, build options and global size
+static std::string dispatchKey(cl_kernel kernel, cl_device_id device, cl_uint workDim, const size_t* globalSize)
+{
+	char name[256] = "";
+	clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name), name, nullptr);
+	std::string key = name;
+
+	cl_program program = 0;
+	size_t size = 0;
+	clGetKernelInfo(kernel, CL_KERNEL_PROGRAM, sizeof(program), &program, nullptr);
+	if (clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_OPTIONS, 0, nullptr, &size) == CL_SUCCESS && size > 1)
+	{
+		std::vector<char> options(size);
+		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_OPTIONS, size, options.data(), nullptr);
+		key += std::string(" ") + options.data();
+	}
+
+	for (cl_uint axis = 0; axis < workDim; ++axis)
+		key += (axis == 0 ? " " : "x") + std::to_string(globalSize[axis]);
+	return key;
+}
+
+// every shape of at least a warp or wavefront (and up to TUNE_MAX_ITEMS) that divides
+// the global size and fits the kernel on the device, with the driver's choice first
+static std::vector<LocalSize> candidateSizes(cl_kernel kernel, cl_device_id device, cl_uint workDim, const size_t* globalSize)
+{
+	size_t kernelMax = 0;
+	size_t itemMax[3] = { 1, 1, 1 };
+	clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernelMax), &kernelMax, nullptr);
+	clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(itemMax), itemMax, nullptr);
+
+	std::vector<size_t> edges[3];
+	for (cl_uint axis = 0; axis < 3; ++axis)
+	{
+		if (axis >= workDim)
+		{
+			edges[axis].push_back(1);
+			continue;
+		}
+		for (size_t edge = 1; edge <= itemMax[axis] && edge <= TUNE_MAX_ITEMS && edge <= globalSize[axis]; ++edge)
+			if (globalSize[axis] % edge == 0)
+				edges[axis].push_back(edge);
+	}
+
+	LocalSize driver = { { 0, 0, 0 } };
+	std::vector<LocalSize> candidates(1, driver);
+	for (size_t x : edges[0])
+		for (size_t y : edges[1])
+			for (size_t z : edges[2])
+			{
+				size_t items = x * y * z;
+				if (items >= TUNE_MIN_ITEMS && items <= TUNE_MAX_ITEMS && items <= kernelMax)
+				{
+					LocalSize local = { { x, y, z } };
+					candidates.push_back(local);
+				}
+			}
+	return candidates;
+}
+
+// microseconds of the fastest run, negative if the shape can't be launched
+static double timeDispatch(cl_command_queue queue, cl_kernel kernel, cl_uint workDim, const size_t* globalSize, const LocalSize& local,
+	bool profiling)
+{
+	const size_t* localSize = local.size[0] != 0 ? local.size : nullptr;
+	double best = -1;
+	for (int run = 0; run < TUNE_RUNS; ++run)
+	{
+		cl_event event = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		cl_int result = clEnqueueNDRangeKernel(queue, kernel, workDim, 0, globalSize, localSize, 0, nullptr, profiling ? &event : nullptr);
+		if (result != CL_SUCCESS)
+			return -1;
+		clFinish(queue);
+		double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+		if (event != 0)
+		{
+			cl_ulong begin = 0, end = 0;
+			clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(begin), &begin, nullptr);
+			clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+			clReleaseEvent(event);
+			elapsed = (end - begin) / 1000.0;
+		}
+		if (best < 0 || elapsed < best)
+			best = elapsed;
+	}
+	return best;
+}
+
+const size_t* tunedLocalSize(TuningDatabase& db, cl_command_queue queue, cl_kernel kernel, cl_uint workDim,
+	const size_t* globalSize, cl_uint waitCount, const cl_event* waitEvents, bool* swept)
+{
+	*swept = false;
+	cl_device_id device = 0;
+	clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, nullptr);
+	std::string key = dispatchKey(kernel, device, workDim, globalSize);
+
+	std::map<std::string, LocalSize>& entries = db.entries[db.device];
+	std::map<std::string, LocalSize>::iterator entry = entries.find(key);
+	if (entry == entries.end())
+	{
+		if (!db.tune)
+			return nullptr;
+
+		cl_command_queue_properties properties = 0;
+		clGetCommandQueueInfo(queue, CL_QUEUE_PROPERTIES, sizeof(properties), &properties, nullptr);
+		bool profiling = (properties & CL_QUEUE_PROFILING_ENABLE) != 0;
+
+		// the arguments' buffers may still be being written, here or on another queue
+		if (waitCount > 0)
+			clWaitForEvents(waitCount, waitEvents);
+		clFinish(queue);
+		*swept = true;
+
+		// one untimed run warms caches and builds whatever the driver builds lazily
+		std::vector<LocalSize> candidates = candidateSizes(kernel, device, workDim, globalSize);
+		clEnqueueNDRangeKernel(queue, kernel, workDim, 0, globalSize, nullptr, 0, nullptr, nullptr);
+		clFinish(queue);
+		LocalSize best = candidates[0];
+		double driverTime = -1, bestTime = -1;
+		for (size_t i = 0; i < candidates.size(); ++i)
+		{
+			double time = timeDispatch(queue, kernel, workDim, globalSize, candidates[i], profiling);
+			if (i == 0)
+				driverTime = time;
+			if (time >= 0 && (bestTime < 0 || time < bestTime))
+			{
+				best = candidates[i];
+				bestTime = time;
+			}
+		}
+		printf("Tuned %s: %ux%ux%u in %.3f ms (driver's choice %.3f ms, %u shapes tried)\n", key.c_str(),
+			(unsigned)best.size[0], (unsigned)best.size[1], (unsigned)best.size[2], bestTime / 1000, driverTime / 1000, (unsigned)candidates.size());
+
+		entry = entries.insert(std::make_pair(key, best)).first;
+		db.changed = true;
+	}
+	return entry->second.size[0] != 0 ? entry->second.size : nullptr;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "clutil.h"
+
+#include <map>
+#include <string>
+
+// work-group shapes picked by measurement instead of left to the driver, which tends
+// to choose badly for 3D grids. results are kept per device (name and driver version)
+// in a JSON file and reused by later runs, a dispatch the file has no entry for is
+// swept when tuning is on and left to the driver otherwise.
+struct LocalSize
+{
+	size_t		size[3];	// 0 for the driver's choice
+};
+
+struct TuningDatabase
+{
+	std::string	path;		// set by the caller before opening
+	bool		tune;		// sweep dispatches that have no entry, likewise
+	std::string	device;		// key of this device's entries
+	bool		changed;	// entries were added since loading
+
+	// every device's entries by dispatch, other devices' are kept when saving
+	std::map<std::string, std::map<std::string, LocalSize> >	entries;
+};
+
+// reads the database at db.path for the device, a missing file is an empty database
+bool openTuning(TuningDatabase& db, cl_device_id device);
+
+// writes the database back if it changed
+bool saveTuning(TuningDatabase& db);
+
+// local size for a dispatch of kernel over globalSize on queue's device, keyed by the
+// kernel's name, build options and the global size. nullptr leaves it to the driver.
+// a sweep waits for the wait events (which may be on other queues, such as an upload
+// the dispatch will wait on), finishes the queue and then runs the kernel with its
+// arguments as set once per candidate shape (ones that divide the global size), timed
+// by profiling events when the queue has them. *swept tells the caller to undo
+// whatever the extra runs accumulated, such as a face counter.
+const size_t* tunedLocalSize(TuningDatabase& db, cl_command_queue queue, cl_kernel kernel, cl_uint workDim,
+	const size_t* globalSize, cl_uint waitCount, const cl_event* waitEvents, bool* swept);
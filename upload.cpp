@@ -0,0 +1,75 @@
+#include "upload.h"
+
+bool createUploadRing(UploadRing& ring, cl_context context, cl_command_queue queue, size_t size)
+{
+	ring.size = size;
+	ring.current = UPLOAD_RING_SLOTS - 1;
+	for (int slot = 0; slot < UPLOAD_RING_SLOTS; ++slot)
+	{
+		ring.staging[slot] = 0;
+		ring.mapped[slot] = nullptr;
+		ring.uploaded[slot] = 0;
+	}
+
+	for (int slot = 0; slot < UPLOAD_RING_SLOTS; ++slot)
+	{
+		cl_int result = CL_SUCCESS;
+		ring.staging[slot] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size, nullptr, &result);
+		CL_CHECK(result);
+		if (ring.staging[slot] == 0)
+			return false;
+
+		// the staging buffers are never used by a command, they stay mapped
+		ring.mapped[slot] = clEnqueueMapBuffer(queue, ring.staging[slot], CL_TRUE, CL_MAP_WRITE, 0, size, 0, nullptr, nullptr, &result);
+		CL_CHECK(result);
+		if (ring.mapped[slot] == nullptr)
+			return false;
+	}
+	return true;
+}
+
+void releaseUploadRing(UploadRing& ring, cl_command_queue queue)
+{
+	for (int slot = 0; slot < UPLOAD_RING_SLOTS; ++slot)
+	{
+		if (ring.uploaded[slot] != 0)
+			clReleaseEvent(ring.uploaded[slot]);
+		if (ring.mapped[slot] != nullptr)
+			clEnqueueUnmapMemObject(queue, ring.staging[slot], ring.mapped[slot], 0, nullptr, nullptr);
+	}
+	clFinish(queue);
+	for (int slot = 0; slot < UPLOAD_RING_SLOTS; ++slot)
+		if (ring.staging[slot] != 0)
+			clReleaseMemObject(ring.staging[slot]);
+}
+
+void* nextUploadSlot(UploadRing& ring)
+{
+	ring.current = (ring.current + 1) % UPLOAD_RING_SLOTS;
+	cl_event& uploaded = ring.uploaded[ring.current];
+	if (uploaded != 0)
+	{
+		clWaitForEvents(1, &uploaded);
+		clReleaseEvent(uploaded);
+		uploaded = 0;
+	}
+	return ring.mapped[ring.current];
+}
+
+cl_int enqueueUpload(UploadRing& ring, cl_command_queue queue, cl_mem target, size_t bytes,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event)
+{
+	// the slot is pinned, the non-blocking write is a DMA from it
+	cl_event& uploaded = ring.uploaded[ring.current];
+	cl_int result = clEnqueueWriteBuffer(queue, target, CL_FALSE, 0, bytes, ring.mapped[ring.current],
+		waitCount, waitEvents, &uploaded);
+	CL_CHECK(result);
+	if (result != CL_SUCCESS)
+		uploaded = 0;
+	else if (event != nullptr)
+	{
+		clRetainEvent(uploaded);
+		*event = uploaded;
+	}
+	return result;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "clutil.h"
+
+// staging slots a ring cycles through, a slot is written while the uploads from the
+// others are still in flight
+#define UPLOAD_RING_SLOTS 3
+
+// host to device uploads through a ring of pinned staging buffers. every slot is
+// allocated by the driver (CL_MEM_ALLOC_HOST_PTR) and mapped once for the ring's life,
+// which gives page locked memory the device copies from without a blocking write or
+// a driver side copy. the producer fills a slot in place and enqueues its upload, it
+// only waits when it comes back round to a slot whose upload hasn't finished.
+struct UploadRing
+{
+	cl_mem		staging[UPLOAD_RING_SLOTS];
+	void*		mapped[UPLOAD_RING_SLOTS];
+	cl_event	uploaded[UPLOAD_RING_SLOTS];	// last upload from each slot, 0 for none
+	size_t		size;							// bytes per slot
+	cl_uint		current;
+};
+
+bool createUploadRing(UploadRing& ring, cl_context context, cl_command_queue queue, size_t size);
+void releaseUploadRing(UploadRing& ring, cl_command_queue queue);
+
+// the next slot for the producer to fill, once its last upload is done
+void* nextUploadSlot(UploadRing& ring);
+
+// copies the first bytes of the slot last returned by nextUploadSlot into target,
+// after the wait events. the producer doesn't wait for it.
+cl_int enqueueUpload(UploadRing& ring, cl_command_queue queue, cl_mem target, size_t bytes,
+	cl_uint waitCount, const cl_event* waitEvents, cl_event* event);
@@ -0,0 +1,672 @@
+#include "volume.h"
+
+#include <math.h>
+#include <string>
+#include <vector>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+bool mapFile(MappedFile& mapped, const char* path)
+{
+	mapped.data = nullptr;
+	mapped.size = 0;
+
+#ifdef _WIN32
+	mapped.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (mapped.file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(mapped.file, &fileSize);
+	mapped.size = (size_t)fileSize.QuadPart;
+
+	mapped.mapping = CreateFileMappingA(mapped.file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	if (mapped.mapping != nullptr)
+		mapped.data = (const char*)MapViewOfFile(mapped.mapping, FILE_MAP_COPY, 0, 0, 0);
+	if (mapped.data == nullptr)
+	{
+		if (mapped.mapping != nullptr)
+			CloseHandle(mapped.mapping);
+		CloseHandle(mapped.file);
+		return false;
+	}
+#else
+	mapped.file = open(path, O_RDONLY);
+	if (mapped.file < 0)
+		return false;
+
+	struct stat fileStat;
+	fstat(mapped.file, &fileStat);
+	mapped.size = (size_t)fileStat.st_size;
+
+	void* data = mmap(nullptr, mapped.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, mapped.file, 0);
+	if (data == MAP_FAILED)
+	{
+		close(mapped.file);
+		return false;
+	}
+	mapped.data = (const char*)data;
+#endif
+
+	return true;
+}
+
+void unmapFile(MappedFile& mapped)
+{
+	if (mapped.data == nullptr)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(mapped.data);
+	CloseHandle(mapped.mapping);
+	CloseHandle(mapped.file);
+#else
+	munmap((void*)mapped.data, mapped.size);
+	close(mapped.file);
+#endif
+
+	mapped.data = nullptr;
+	mapped.size = 0;
+}
+
+bool createMappedFile(MappedFile& mapped, const char* path, size_t size)
+{
+	mapped.data = nullptr;
+	mapped.size = size;
+
+#ifdef _WIN32
+	mapped.file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (mapped.file == INVALID_HANDLE_VALUE)
+		return false;
+
+	// a mapping larger than the file grows it
+	LARGE_INTEGER fileSize;
+	fileSize.QuadPart = (LONGLONG)size;
+	mapped.mapping = CreateFileMappingA(mapped.file, nullptr, PAGE_READWRITE, fileSize.HighPart, fileSize.LowPart, nullptr);
+	if (mapped.mapping != nullptr)
+		mapped.data = (const char*)MapViewOfFile(mapped.mapping, FILE_MAP_WRITE, 0, 0, 0);
+	if (mapped.data == nullptr)
+	{
+		if (mapped.mapping != nullptr)
+			CloseHandle(mapped.mapping);
+		CloseHandle(mapped.file);
+		return false;
+	}
+#else
+	mapped.file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (mapped.file < 0)
+		return false;
+
+	void* data = MAP_FAILED;
+	if (ftruncate(mapped.file, (off_t)size) == 0)
+		data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mapped.file, 0);
+	if (data == MAP_FAILED)
+	{
+		close(mapped.file);
+		return false;
+	}
+	mapped.data = (const char*)data;
+#endif
+
+	return true;
+}
+
+bool finishMappedFile(MappedFile& mapped, size_t size)
+{
+	if (mapped.data == nullptr)
+		return false;
+
+	bool ok = true;
+#ifdef _WIN32
+	UnmapViewOfFile(mapped.data);
+	CloseHandle(mapped.mapping);
+	LARGE_INTEGER end;
+	end.QuadPart = (LONGLONG)size;
+	ok = SetFilePointerEx(mapped.file, end, nullptr, FILE_BEGIN) && SetEndOfFile(mapped.file);
+	CloseHandle(mapped.file);
+#else
+	munmap((void*)mapped.data, mapped.size);
+	ok = ftruncate(mapped.file, (off_t)size) == 0;
+	close(mapped.file);
+#endif
+
+	mapped.data = nullptr;
+	mapped.size = 0;
+	return ok;
+}
+
+void releaseMappedRange(MappedFile& mapped, size_t offset, size_t size)
+{
+	// only whole pages can be released, shrink the range to page boundaries
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	size_t pageSize = info.dwPageSize;
+#else
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+	size_t begin = (offset + pageSize - 1) / pageSize * pageSize;
+	size_t end = (offset + size) / pageSize * pageSize;
+	if (end <= begin)
+		return;
+
+#ifdef _WIN32
+	// unlocking pages that were never locked drops them from the working set
+	VirtualUnlock((void*)(mapped.data + begin), end - begin);
+#else
+	madvise((void*)(mapped.data + begin), end - begin, MADV_DONTNEED);
+#endif
+}
+
+static void resetVolume(Volume& volume)
+{
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		volume.size[axis] = 0;
+		volume.spacing[axis] = 1;
+		volume.origin[axis] = 0;
+	}
+	volume.type = VOXEL_FLOAT;
+	volume.voxelBytes = sizeof(float);
+	volume.dataOffset = 0;
+	volume.file.data = nullptr;
+	volume.file.size = 0;
+}
+
+static const size_t VOXEL_BYTES[] = { 1, 2, 2, 2, 4 };
+
+static void setVoxelType(Volume& volume, VoxelType type)
+{
+	volume.type = type;
+	volume.voxelBytes = VOXEL_BYTES[type];
+}
+
+bool parseVoxelType(const char* name, VoxelType& type)
+{
+	static const char* NAMES[] = { "uint8", "uint16", "int16", "half", "float" };
+	for (int i = 0; i <= VOXEL_FLOAT; ++i)
+	{
+		if (strcmp(name, NAMES[i]) == 0)
+		{
+			type = (VoxelType)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* volumeBuildOptions(const Volume& volume, VolumeStorage storage)
+{
+	if (storage == VOLUME_IMAGE)
+		return "-D FIELD_VOLUME -D FIELD_IMAGE";
+	if (storage == VOLUME_BRICKED)
+	{
+		switch (volume.type)
+		{
+		case VOXEL_UINT8:	return "-D FIELD_VOLUME -D FIELD_BRICKED -D VOXEL_T=uchar";
+		case VOXEL_UINT16:	return "-D FIELD_VOLUME -D FIELD_BRICKED -D VOXEL_T=ushort";
+		case VOXEL_INT16:	return "-D FIELD_VOLUME -D FIELD_BRICKED -D VOXEL_T=short";
+		case VOXEL_HALF:	return "-D FIELD_VOLUME -D FIELD_BRICKED -D VOXEL_T=half -D VOXEL_HALF";
+		default:			return "-D FIELD_VOLUME -D FIELD_BRICKED -D VOXEL_T=float";
+		}
+	}
+	switch (volume.type)
+	{
+	case VOXEL_UINT8:	return "-D FIELD_VOLUME -D VOXEL_T=uchar";
+	case VOXEL_UINT16:	return "-D FIELD_VOLUME -D VOXEL_T=ushort";
+	case VOXEL_INT16:	return "-D FIELD_VOLUME -D VOXEL_T=short";
+	case VOXEL_HALF:	return "-D FIELD_VOLUME -D VOXEL_T=half -D VOXEL_HALF";
+	default:			return "-D FIELD_VOLUME -D VOXEL_T=float";
+	}
+}
+
+cl_float2 volumeNormalization(const Volume& volume, VolumeStorage storage)
+{
+	cl_float2 scale = { { 1, 0 } };
+	if (storage == VOLUME_IMAGE)
+		return scale;
+	switch (volume.type)
+	{
+	case VOXEL_UINT8:	scale.s[0] = 1 / 255.0f;	break;
+	case VOXEL_UINT16:	scale.s[0] = 1 / 65535.0f;	break;
+	case VOXEL_INT16:	scale.s[0] = 1 / 32767.0f;	break;
+	default:			break;
+	}
+	return scale;
+}
+
+cl_float4 volumeOrigin(const Volume& volume)
+{
+	cl_float4 origin = { { volume.origin[0], volume.origin[1], volume.origin[2], 0 } };
+	return origin;
+}
+
+cl_float4 volumeSpacing(const Volume& volume)
+{
+	cl_float4 spacing = { { volume.spacing[0], volume.spacing[1], volume.spacing[2], 1 } };
+	return spacing;
+}
+
+static bool hasSuffix(const char* path, const char* suffix)
+{
+	size_t pathLength = strlen(path);
+	size_t suffixLength = strlen(suffix);
+	if (pathLength < suffixLength)
+		return false;
+	for (size_t i = 0; i < suffixLength; ++i)
+	{
+		if (tolower(path[pathLength - suffixLength + i]) != tolower(suffix[i]))
+			return false;
+	}
+	return true;
+}
+
+static std::string trim(const std::string& str)
+{
+	size_t begin = str.find_first_not_of(" \t\r");
+	if (begin == str.npos)
+		return std::string();
+	return str.substr(begin, str.find_last_not_of(" \t\r") - begin + 1);
+}
+
+static std::string lower(std::string str)
+{
+	for (size_t i = 0; i < str.size(); ++i)
+		str[i] = (char)tolower(str[i]);
+	return str;
+}
+
+// detached data files are relative to the header
+static std::string siblingPath(const char* headerPath, const std::string& file)
+{
+	std::string path(headerPath);
+	size_t slash = path.find_last_of("/\\");
+	if (slash == path.npos || file.empty() || file[0] == '/')
+		return file;
+	return path.substr(0, slash + 1) + file;
+}
+
+// reads the next header line, returns false at the end of the mapping
+static bool nextLine(const MappedFile& file, size_t& pos, std::string& line)
+{
+	if (pos >= file.size)
+		return false;
+	const char* begin = file.data + pos;
+	const char* end = (const char*)memchr(begin, '\n', file.size - pos);
+	if (end == nullptr)
+		end = file.data + file.size;
+	line.assign(begin, end);
+	if (!line.empty() && line[line.size() - 1] == '\r')
+		line.resize(line.size() - 1);
+	pos = end - file.data + 1;
+	return true;
+}
+
+// the samples' bytes, 0 when a size is 0 or they take more than limit. the sizes come
+// from headers, each step is checked by division so the product can't wrap.
+static size_t checkedVolumeBytes(const Volume& volume, size_t limit)
+{
+	size_t bytes = volume.voxelBytes;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (volume.size[axis] == 0 || bytes > limit / volume.size[axis])
+			return 0;
+		bytes *= volume.size[axis];
+	}
+	return bytes;
+}
+
+// swaps the header mapping for the detached data file if there is one and checks
+// that the samples fit. dataOffset < 0 means the samples sit at the end of the file.
+static bool mapVolumeData(Volume& volume, const char* headerPath, const std::string& dataFile, long long dataOffset)
+{
+	if (!dataFile.empty())
+	{
+		unmapFile(volume.file);
+		std::string dataPath = siblingPath(headerPath, dataFile);
+		if (!mapFile(volume.file, dataPath.c_str()))
+		{
+			printf("Failed to map volume data %s!\n", dataPath.c_str());
+			return false;
+		}
+	}
+
+	// bytes is at most the file's size, so the subtractions can't wrap either
+	size_t bytes = checkedVolumeBytes(volume, volume.file.size);
+	if (dataOffset < 0)
+		dataOffset = (long long)(volume.file.size - bytes);
+	volume.dataOffset = (size_t)dataOffset;
+
+	if (bytes == 0 || volume.dataOffset > volume.file.size - bytes)
+	{
+		printf("Volume %s is too small for %zu x %zu x %zu samples!\n", headerPath, volume.size[0], volume.size[1], volume.size[2]);
+		unmapFile(volume.file);
+		return false;
+	}
+	return true;
+}
+
+static bool openNrrd(Volume& volume, const char* path)
+{
+	if (!mapFile(volume.file, path))
+	{
+		printf("Failed to map volume %s!\n", path);
+		return false;
+	}
+
+	size_t pos = 0;
+	std::string line;
+	if (!nextLine(volume.file, pos, line) || line.compare(0, 4, "NRRD") != 0)
+	{
+		printf("%s is not a NRRD file!\n", path);
+		unmapFile(volume.file);
+		return false;
+	}
+
+	std::string type, encoding = "raw", endian = "little", dataFile;
+	int dimension = 0;
+	long long byteSkip = 0;
+	bool attached = true;
+	while (nextLine(volume.file, pos, line))
+	{
+		// a blank line ends the header, attached data follows it
+		if (line.empty())
+			break;
+		if (line[0] == '#')
+			continue;
+
+		// "key: value", key/value pairs ("key:=value") are ignored
+		size_t colon = line.find(": ");
+		if (colon == line.npos)
+			continue;
+		std::string key = lower(line.substr(0, colon));
+		std::string value = trim(line.substr(colon + 2));
+
+		if (key == "dimension")
+			dimension = atoi(value.c_str());
+		else if (key == "type")
+			type = lower(value);
+		else if (key == "encoding")
+			encoding = lower(value);
+		else if (key == "endian")
+			endian = lower(value);
+		else if (key == "byte skip")
+			byteSkip = atoll(value.c_str());
+		else if (key == "data file" || key == "datafile")
+		{
+			dataFile = value;
+			attached = false;
+		}
+		else if (key == "sizes")
+			sscanf(value.c_str(), "%zu %zu %zu", &volume.size[0], &volume.size[1], &volume.size[2]);
+		else if (key == "spacings")
+			sscanf(value.c_str(), "%f %f %f", &volume.spacing[0], &volume.spacing[1], &volume.spacing[2]);
+		else if (key == "space origin")
+			sscanf(value.c_str(), " ( %f , %f , %f )", &volume.origin[0], &volume.origin[1], &volume.origin[2]);
+		else if (key == "space directions")
+		{
+			// the length of each axis vector is the spacing along it
+			const char* vector = value.c_str();
+			for (int axis = 0; axis < 3 && (vector = strchr(vector, '(')) != nullptr; ++axis, ++vector)
+			{
+				float x = 0, y = 0, z = 0;
+				if (sscanf(vector, "( %f , %f , %f )", &x, &y, &z) == 3)
+					volume.spacing[axis] = sqrtf(x * x + y * y + z * z);
+			}
+		}
+	}
+
+	// nrrd spells types several ways
+	bool knownType = true;
+	if (type == "uchar" || type == "unsigned char" || type == "uint8" || type == "uint8_t")
+		setVoxelType(volume, VOXEL_UINT8);
+	else if (type == "ushort" || type == "unsigned short" || type == "unsigned short int" || type == "uint16" || type == "uint16_t")
+		setVoxelType(volume, VOXEL_UINT16);
+	else if (type == "short" || type == "short int" || type == "signed short" || type == "signed short int" || type == "int16" || type == "int16_t")
+		setVoxelType(volume, VOXEL_INT16);
+	else if (type == "float")
+		setVoxelType(volume, VOXEL_FLOAT);
+	else
+		knownType = false;
+
+	// endianness only matters for multi byte samples
+	if (dimension != 3 || encoding != "raw" || !knownType || (endian != "little" && volume.voxelBytes > 1))
+	{
+		printf("%s: only 3D raw little endian uint8, uint16, int16 or float NRRDs are supported!\n", path);
+		unmapFile(volume.file);
+		return false;
+	}
+
+	// byte skip counts from the start of the data, attached data starts after the header
+	long long dataOffset = attached ? (long long)pos + byteSkip : byteSkip;
+	return mapVolumeData(volume, path, dataFile, byteSkip < 0 ? -1 : dataOffset);
+}
+
+static bool openMetaImage(Volume& volume, const char* path)
+{
+	if (!mapFile(volume.file, path))
+	{
+		printf("Failed to map volume %s!\n", path);
+		return false;
+	}
+
+	std::string type, dataFile;
+	int dimension = 0;
+	long long headerSize = 0;
+	bool bigEndian = false, compressed = false, local = false;
+	size_t pos = 0;
+	std::string line;
+	while (nextLine(volume.file, pos, line))
+	{
+		size_t equals = line.find('=');
+		if (equals == line.npos)
+			continue;
+		std::string key = lower(trim(line.substr(0, equals)));
+		std::string value = trim(line.substr(equals + 1));
+
+		if (key == "ndims")
+			dimension = atoi(value.c_str());
+		else if (key == "dimsize")
+			sscanf(value.c_str(), "%zu %zu %zu", &volume.size[0], &volume.size[1], &volume.size[2]);
+		else if (key == "elementtype")
+			type = value;
+		else if (key == "elementspacing" || key == "elementsize")
+			sscanf(value.c_str(), "%f %f %f", &volume.spacing[0], &volume.spacing[1], &volume.spacing[2]);
+		else if (key == "offset" || key == "origin" || key == "position")
+			sscanf(value.c_str(), "%f %f %f", &volume.origin[0], &volume.origin[1], &volume.origin[2]);
+		else if (key == "headersize")
+			headerSize = atoll(value.c_str());
+		else if (key == "binarydatabyteordermsb" || key == "elementbyteordermsb")
+			bigEndian = lower(value) == "true";
+		else if (key == "compresseddata")
+			compressed = lower(value) == "true";
+		else if (key == "elementdatafile")
+		{
+			// always the last field, LOCAL data follows straight after it
+			local = lower(value) == "local";
+			if (!local)
+				dataFile = value;
+			break;
+		}
+	}
+
+	bool knownType = true;
+	if (type == "MET_UCHAR")
+		setVoxelType(volume, VOXEL_UINT8);
+	else if (type == "MET_USHORT")
+		setVoxelType(volume, VOXEL_UINT16);
+	else if (type == "MET_SHORT")
+		setVoxelType(volume, VOXEL_INT16);
+	else if (type == "MET_FLOAT")
+		setVoxelType(volume, VOXEL_FLOAT);
+	else
+		knownType = false;
+
+	if (dimension != 3 || (bigEndian && volume.voxelBytes > 1) || compressed || !knownType || (!local && dataFile.empty()))
+	{
+		printf("%s: only 3D uncompressed little endian MET_UCHAR, MET_USHORT, MET_SHORT or MET_FLOAT images are supported!\n", path);
+		unmapFile(volume.file);
+		return false;
+	}
+
+	long long dataOffset = local ? (long long)pos + (headerSize > 0 ? headerSize : 0) : headerSize;
+	return mapVolumeData(volume, path, dataFile, headerSize < 0 ? -1 : dataOffset);
+}
+
+bool openVolume(Volume& volume, const char* path)
+{
+	resetVolume(volume);
+
+	if (hasSuffix(path, ".nrrd") || hasSuffix(path, ".nhdr"))
+		return openNrrd(volume, path);
+	if (hasSuffix(path, ".mhd") || hasSuffix(path, ".mha"))
+		return openMetaImage(volume, path);
+
+	printf("Unknown volume format %s, raw volumes need their dimensions!\n", path);
+	return false;
+}
+
+bool openRawVolume(Volume& volume, const char* path, size_t nx, size_t ny, size_t nz, VoxelType type)
+{
+	resetVolume(volume);
+	if (type < VOXEL_UINT8 || type > VOXEL_FLOAT)
+	{
+		printf("Unknown sample type for %s!\n", path);
+		return false;
+	}
+	setVoxelType(volume, type);
+	volume.size[0] = nx;
+	volume.size[1] = ny;
+	volume.size[2] = nz;
+
+	if (!mapFile(volume.file, path))
+	{
+		printf("Failed to map volume %s!\n", path);
+		return false;
+	}
+	return mapVolumeData(volume, path, std::string(), 0);
+}
+
+void closeVolume(Volume& volume)
+{
+	unmapFile(volume.file);
+}
+
+cl_mem createVolumeBuffer(cl_context context, cl_device_id device, const Volume& volume, cl_int* result)
+{
+	// the runtime can only use the pages directly if they meet the device's base address
+	// alignment. detached data starts on a page, attached data usually doesn't.
+	cl_uint alignBits = 0;
+	clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(cl_uint), &alignBits, 0);
+
+	const char* samples = volume.file.data + volume.dataOffset;
+	cl_mem_flags flags = CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR;
+	if (alignBits >= 8 && (size_t)samples % (alignBits / 8) != 0)
+	{
+		printf("Volume samples are not %u byte aligned, copying them to the device\n", alignBits / 8);
+		flags = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
+	}
+
+	return clCreateBuffer(context, flags, volumeBytes(volume), (void*)samples, result);
+}
+
+cl_mem createBrickedVolumeBuffer(cl_context context, const Volume& volume, cl_int* result)
+{
+	std::vector<char> bricked(brickedVolumeBytes(volume), 0);
+	const size_t voxelBytes = volume.voxelBytes;
+
+	// the x and the y, z parts of an index don't share bits, a row is its start plus a
+	// table of x offsets
+	std::vector<size_t> rowOffsets(volume.size[0]);
+	for (size_t x = 0; x < volume.size[0]; ++x)
+		rowOffsets[x] = brickedIndex(volume.size, x, 0, 0) * voxelBytes;
+	for (size_t z = 0; z < volume.size[2]; ++z)
+		for (size_t y = 0; y < volume.size[1]; ++y)
+		{
+			const char* row = volumeSample(volume, 0, y, z);
+			char* rowStart = &bricked[brickedIndex(volume.size, 0, y, z) * voxelBytes];
+			for (size_t x = 0; x < volume.size[0]; ++x)
+				memcpy(rowStart + rowOffsets[x], row + x * voxelBytes, voxelBytes);
+		}
+
+	return clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bricked.size(), bricked.data(), result);
+}
+
+cl_mem createVolumeImage(cl_context context, cl_device_id device, const Volume& volume, cl_int* result)
+{
+	cl_bool imageSupport = CL_FALSE;
+	size_t maxSize[3] = { 0, 0, 0 };
+	clGetDeviceInfo(device, CL_DEVICE_IMAGE_SUPPORT, sizeof(imageSupport), &imageSupport, 0);
+	clGetDeviceInfo(device, CL_DEVICE_IMAGE3D_MAX_WIDTH, sizeof(size_t), &maxSize[0], 0);
+	clGetDeviceInfo(device, CL_DEVICE_IMAGE3D_MAX_HEIGHT, sizeof(size_t), &maxSize[1], 0);
+	clGetDeviceInfo(device, CL_DEVICE_IMAGE3D_MAX_DEPTH, sizeof(size_t), &maxSize[2], 0);
+	if (!imageSupport)
+	{
+		printf("The device has no image support!\n");
+		*result = CL_INVALID_OPERATION;
+		return 0;
+	}
+	if (volume.size[0] > maxSize[0] || volume.size[1] > maxSize[1] || volume.size[2] > maxSize[2])
+	{
+		printf("Volume exceeds the device's largest 3D image (%u x %u x %u)!\n", (unsigned)maxSize[0], (unsigned)maxSize[1], (unsigned)maxSize[2]);
+		*result = CL_INVALID_IMAGE_SIZE;
+		return 0;
+	}
+
+	cl_image_format format = { CL_R, CL_FLOAT };
+	switch (volume.type)
+	{
+	case VOXEL_UINT8:	format.image_channel_data_type = CL_UNORM_INT8;		break;
+	case VOXEL_UINT16:	format.image_channel_data_type = CL_UNORM_INT16;	break;
+	case VOXEL_INT16:	format.image_channel_data_type = CL_SNORM_INT16;	break;
+	case VOXEL_HALF:	format.image_channel_data_type = CL_HALF_FLOAT;		break;
+	default:			break;
+	}
+
+	cl_uint formatCount = 0;
+	clGetSupportedImageFormats(context, CL_MEM_READ_ONLY, CL_MEM_OBJECT_IMAGE3D, 0, nullptr, &formatCount);
+	std::vector<cl_image_format> formats(formatCount);
+	if (formatCount > 0)
+		clGetSupportedImageFormats(context, CL_MEM_READ_ONLY, CL_MEM_OBJECT_IMAGE3D, formatCount, formats.data(), nullptr);
+	bool supported = false;
+	for (cl_uint i = 0; i < formatCount; ++i)
+		supported = supported || (formats[i].image_channel_order == format.image_channel_order &&
+			formats[i].image_channel_data_type == format.image_channel_data_type);
+	if (!supported)
+	{
+		printf("The device has no 3D image format for the volume's samples!\n");
+		*result = CL_IMAGE_FORMAT_NOT_SUPPORTED;
+		return 0;
+	}
+
+	// samples are tightly packed, the pitches follow from the size
+	cl_image_desc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.image_type = CL_MEM_OBJECT_IMAGE3D;
+	desc.image_width = volume.size[0];
+	desc.image_height = volume.size[1];
+	desc.image_depth = volume.size[2];
+	return clCreateImage(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, &format, &desc,
+		(void*)volumeSample(volume, 0, 0, 0), result);
+}
+
+cl_mem createVolumeField(cl_context context, cl_device_id device, const Volume& volume, VolumeStorage storage, cl_int* result)
+{
+	switch (storage)
+	{
+	case VOLUME_BRICKED:	return createBrickedVolumeBuffer(context, volume, result);
+	case VOLUME_IMAGE:		return createVolumeImage(context, device, volume, result);
+	default:				return createVolumeBuffer(context, device, volume, result);
+	}
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "clutil.h"
+
+#include <stddef.h>
+
+// view of a whole file mapped into the address space. files opened with mapFile are
+// mapped copy-on-write, writes through them (or by a runtime wrapping them) never
+// reach the file. files made by createMappedFile are mapped shared and writable.
+struct MappedFile
+{
+	const char*	data;
+	size_t		size;
+#ifdef _WIN32
+	void*		file;
+	void*		mapping;
+#else
+	int			file;
+#endif
+};
+
+bool mapFile(MappedFile& mapped, const char* path);
+void unmapFile(MappedFile& mapped);
+
+// creates (or replaces) a file of the given size and maps it for writing. most file
+// systems keep the untouched parts sparse, so oversizing is cheap.
+bool createMappedFile(MappedFile& mapped, const char* path, size_t size);
+// unmaps a file made by createMappedFile and cuts it down to its final size
+bool finishMappedFile(MappedFile& mapped, size_t size);
+
+// hint that a range of the mapping is no longer needed so its pages can leave the
+// working set. the data is still valid and will simply be faulted back in if touched.
+void releaseMappedRange(MappedFile& mapped, size_t offset, size_t size);
+
+// sample types a volume can be stored (and marched) in
+enum VoxelType
+{
+	VOXEL_UINT8,
+	VOXEL_UINT16,
+	VOXEL_INT16,
+	VOXEL_HALF,
+	VOXEL_FLOAT,
+};
+
+// how an in-core volume's samples are kept on the device
+enum VolumeStorage
+{
+	VOLUME_LINEAR,		// the mapped samples as they are, x-major
+	VOLUME_BRICKED,		// a copy in bricks of VOLUME_BRICK^3 samples, see brickedIndex
+	VOLUME_IMAGE,		// a copy in a 3D image, filtered by the texture units
+};
+
+// a scalar volume on disk, samples stored x-major
+struct Volume
+{
+	size_t		size[3];		// samples per axis
+	float		spacing[3];		// distance between samples
+	float		origin[3];		// position of the first sample
+	VoxelType	type;
+	size_t		voxelBytes;
+	size_t		dataOffset;		// byte offset of the first sample within the file
+	MappedFile	file;
+};
+
+// opens a volume described by a NRRD (.nrrd/.nhdr) or MetaImage (.mhd/.mha) header.
+// attached and detached data are supported as long as it is raw and little endian,
+// the samples are mapped in place and never read into memory up front.
+bool openVolume(Volume& volume, const char* path);
+bool openRawVolume(Volume& volume, const char* path, size_t nx, size_t ny, size_t nz, VoxelType type);
+void closeVolume(Volume& volume);
+
+// parses "uint8", "uint16", "int16", "half" or "float", returns false for anything else
+bool parseVoxelType(const char* name, VoxelType& type);
+
+// compiler options that build the field for the volume's sample type and storage
+const char* volumeBuildOptions(const Volume& volume, VolumeStorage storage = VOLUME_LINEAR);
+
+// scale and bias applied on the device to every sample read. integer samples are
+// normalised to [0, 1] (unsigned) or [-1, 1] (int16), thresholds are given in that
+// range. half and float samples are used as stored. an image's normalised formats do
+// the integer scaling themselves.
+cl_float2 volumeNormalization(const Volume& volume, VolumeStorage storage = VOLUME_LINEAR);
+
+// world transform kernels apply to the vertices they emit: the position of the first
+// sample and the distance between samples (w = 1)
+cl_float4 volumeOrigin(const Volume& volume);
+cl_float4 volumeSpacing(const Volume& volume);
+
+// an open volume's sizes were checked to fit its file, this can't wrap
+inline size_t volumeBytes(const Volume& volume)
+{
+	return volume.size[0] * volume.size[1] * volume.size[2] * volume.voxelBytes;
+}
+
+// wraps the mapped samples in a read-only buffer with CL_MEM_USE_HOST_PTR so the
+// runtime uses (or copies straight from) the page cache. on devices sharing host
+// memory this is zero copy. the volume must stay open while the buffer is alive and
+// host access to the samples should go through clEnqueueMapBuffer.
+cl_mem createVolumeBuffer(cl_context context, cl_device_id device, const Volume& volume, cl_int* result);
+
+// copies the samples into bricks for the FIELD_BRICKED field. the padding of the
+// bricks past the volume's edges is zero and never read.
+cl_mem createBrickedVolumeBuffer(cl_context context, const Volume& volume, cl_int* result);
+
+// copies the samples into a single channel image3d_t for the FIELD_IMAGE field, in a
+// normalised format for integer samples. fails (printing why) when the device has no
+// images, no such format or the volume exceeds its largest 3D image.
+cl_mem createVolumeImage(cl_context context, cl_device_id device, const Volume& volume, cl_int* result);
+
+// the buffer or image for the storage, see above
+cl_mem createVolumeField(cl_context context, cl_device_id device, const Volume& volume, VolumeStorage storage, cl_int* result);
+
+// pointer to the sample at (x, y, z)
+inline const char* volumeSample(const Volume& volume, size_t x, size_t y, size_t z)
+{
+	return volume.file.data + volume.dataOffset +
+		((z * volume.size[1] + y) * volume.size[0] + x) * volume.voxelBytes;
+}
+
+// bricked layout, matches fieldIndex in field.cl. a z-neighbour in a linear volume
+// is a whole slice away, in a brick it is a few samples away and the eight corners of
+// a cube share a cache line or two. bricks are VOLUME_BRICK samples on a side and
+// stored x-major, the samples within a brick in Morton (z-order) order.
+#define VOLUME_BRICK_BITS	3
+#define VOLUME_BRICK		(1 << VOLUME_BRICK_BITS)
+
+// bits of v spread out to every third bit, for the Morton code
+inline size_t mortonSpread(size_t v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+inline size_t bricksPerAxis(size_t samples)
+{
+	return (samples + VOLUME_BRICK - 1) >> VOLUME_BRICK_BITS;
+}
+
+// offset of the sample at (x, y, z) in a bricked volume of the given size
+inline size_t brickedIndex(const size_t* size, size_t x, size_t y, size_t z)
+{
+	const size_t mask = VOLUME_BRICK - 1;
+	size_t brick = (x >> VOLUME_BRICK_BITS) + bricksPerAxis(size[0]) *
+		((y >> VOLUME_BRICK_BITS) + bricksPerAxis(size[1]) * (z >> VOLUME_BRICK_BITS));
+	size_t morton = mortonSpread(x & mask) | (mortonSpread(y & mask) << 1) | (mortonSpread(z & mask) << 2);
+	return (brick << (3 * VOLUME_BRICK_BITS)) + morton;
+}
+
+inline size_t brickedVolumeBytes(const Volume& volume)
+{
+	return bricksPerAxis(volume.size[0]) * bricksPerAxis(volume.size[1]) * bricksPerAxis(volume.size[2]) *
+		VOLUME_BRICK * VOLUME_BRICK * VOLUME_BRICK * volume.voxelBytes;
+}